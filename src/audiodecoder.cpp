@@ -0,0 +1,105 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "audiodecoder.h"
+#include "mp3decoder.h"
+#include "sndfiledecoder.h"
+#include "wavdecoder.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Frames decoded at a time before being converted to the storage format
+const size_t decodeBlockFrames = 1 << 15;
+
+}
+
+AudioDecoder::AudioDecoder() {
+    position = -1;
+}
+
+void AudioDecoder::scan() {
+}
+
+bool AudioDecoder::getMappedSamples(const void *&, SampleFormat &) {
+    return false;
+}
+
+// Decodes serially, whatever the number of threads
+bool AudioDecoder::decodeAll(SampleBuffer &out, SampleFormat format, int) {
+    if (getChannels() <= 0 || getLength() < 0) {
+        return false;
+    }
+    out.reset(format, getLength() * getChannels());
+    decodeInto(out, 0, getLength());
+    return true;
+}
+
+int64_t AudioDecoder::decodeInto(SampleBuffer &out, int64_t start,
+        int64_t end) {
+    int channels = getChannels();
+    std::vector<float> block(decodeBlockFrames * channels);
+    int64_t frame = start;
+    while (frame < end) {
+        size_t want = std::min((int64_t) decodeBlockFrames, end - frame);
+        size_t got = readAt(frame, want, &block[0]);
+        out.store(frame * channels, &block[0], got * channels);
+        frame += got;
+        if (got < want) {
+            break;
+        }
+    }
+    return frame - start;
+}
+
+size_t AudioDecoder::readAt(int64_t start, size_t frames, float *out) {
+    if (start != position) {
+        if (!seek(start)) {
+            position = -1;
+            return 0;
+        }
+        position = start;
+    }
+    size_t decoded = read(out, frames);
+    position += decoded;
+    return decoded;
+}
+
+AudioDecoder::~AudioDecoder() {
+}
+
+AudioDecoder *createDecoder(std::string path) {
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) {
+        return NULL;
+    }
+    std::string ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == "mp3") {
+        return new Mp3Decoder();
+    } else if (ext == "wav") {
+        return new WavDecoder();
+    } else if (ext == "flac" || ext == "ogg" || ext == "oga") {
+        return new SndfileDecoder();
+    }
+    return NULL;
+}
+
+}
@@ -0,0 +1,151 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "samplebuffer.h"
+
+namespace TuneTutor {
+
+/**
+ * Simple container for metadata fields extracted from a sound file.
+ */
+struct SoundFileMetadata {
+    std::string title;
+    std::string artist;
+    std::string album;
+
+    SoundFileMetadata() {
+        title = "";
+        artist = "";
+        album = "";
+    }
+};
+
+/**
+ * The AudioDecoder class is the interface to the decoder for one sound file
+ * format. SoundFile uses it to read the file's format, length and metadata,
+ * and to decode its samples, either all at once or from any position.
+ * Decoders for more formats can be added in createDecoder() without changing
+ * the rest of the application.
+ */
+class AudioDecoder {
+
+    public:
+        AudioDecoder();
+        virtual ~AudioDecoder();
+
+        /**
+         * Open a file and read its format, length and metadata, without
+         * decoding any samples.
+         *
+         * @param path the full path to the file
+         * @return true if the file was opened
+         */
+        virtual bool open(std::string path) = 0;
+
+        virtual int getSampleRate() const = 0;
+        virtual int getChannels() const = 0;
+
+        /**
+         * @return the length of the file in sample frames, which may be an
+         *         estimate until scan() has been called
+         */
+        virtual int64_t getLength() const = 0;
+
+        virtual SoundFileMetadata getMetadata() const = 0;
+
+        /**
+         * Read through the file so that its length is exact and seeking is
+         * quick. Does nothing for formats whose length is known exactly on
+         * opening.
+         */
+        virtual void scan();
+
+        /**
+         * Get the file's samples without decoding them, if they are stored
+         * in the file in a SampleFormat and the file is mapped into memory.
+         *
+         * @param data set to the first sample
+         * @param format set to the format of the samples
+         * @return false if the samples can only be had by decoding them
+         */
+        virtual bool getMappedSamples(const void *&data, SampleFormat &format);
+
+        /**
+         * Decode the whole file into a buffer, which is sized to fit.
+         *
+         * @param out the buffer for the samples
+         * @param format the format in which to keep the samples
+         * @param numThreads the most threads to decode with, or 0 for one
+         *        per processor core; most formats only use one
+         * @return false if the file couldn't be decoded
+         */
+        virtual bool decodeAll(SampleBuffer &out, SampleFormat format,
+                int numThreads);
+
+        /**
+         * Decode frames start to end into their place in a buffer that holds
+         * the whole file, a block at a time.
+         *
+         * @return the number of frames decoded, fewer at the end of the file
+         */
+        int64_t decodeInto(SampleBuffer &out, int64_t start, int64_t end);
+
+        /**
+         * Decode frames from any position. Reading on from where the last
+         * call stopped doesn't need a seek.
+         *
+         * @param start the first frame to decode
+         * @param frames the number of frames to decode
+         * @param out the buffer for frames * getChannels() samples
+         * @return the number of frames decoded
+         */
+        size_t readAt(int64_t start, size_t frames, float *out);
+
+    protected:
+        /**
+         * Seek to the given frame.
+         * @return false if the seek failed
+         */
+        virtual bool seek(int64_t frame) = 0;
+
+        /**
+         * Decode interleaved frames from the current position.
+         * @return the number of frames decoded, fewer at the end of the file
+         */
+        virtual size_t read(float *out, size_t frames) = 0;
+
+    private:
+        // The frame the next read() will start at, or -1 if unknown
+        int64_t position;
+
+        AudioDecoder(const AudioDecoder &other);
+        AudioDecoder &operator=(const AudioDecoder &other);
+};
+
+/**
+ * @param path the path or name of a sound file
+ * @return a new decoder for the file's format, chosen by its extension, or
+ *         NULL if the format isn't supported
+ */
+AudioDecoder *createDecoder(std::string path);
+
+}
@@ -0,0 +1,113 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <utility>
+
+#include "autosaver.h"
+
+namespace TuneTutor {
+
+Autosaver::Autosaver() {
+    currentPath = "";
+    writingPath = "";
+    writing = false;
+    lastWriteOk = true;
+    stopping = false;
+    thread = std::thread(&Autosaver::run, this);
+}
+
+/**
+ * @return true if the given file has a snapshot waiting or being written.
+ *         The caller must hold the mutex.
+ */
+bool Autosaver::isBusy(const std::string &path) const {
+    return pending.count(path) > 0 || (writing && writingPath == path);
+}
+
+bool Autosaver::load(std::string path, TuneState &state) {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this, &path] { return !isBusy(path); });
+
+    // Stores of other files are only needed until their snapshots are written
+    for (std::map<std::string, TuneStateStore>::iterator it = stores.begin();
+            it != stores.end(); ) {
+        if (it->first != path && !isBusy(it->first)) {
+            stores.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    TuneStateStore &store = stores[path];
+    currentPath = path;
+
+    // The writer thread doesn't touch this store until a snapshot of it is
+    // submitted, which only happens after this returns
+    lock.unlock();
+    return store.load(path, state);
+}
+
+void Autosaver::submit(const TuneState &state) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (currentPath == "") {
+        return;
+    }
+    pending[currentPath] = state;
+    wake.notify_one();
+}
+
+bool Autosaver::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending.empty() && !writing; });
+    return lastWriteOk;
+}
+
+void Autosaver::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return !pending.empty() || stopping; });
+        if (pending.empty()) {
+            break;
+        }
+
+        std::map<std::string, TuneState>::iterator next = pending.begin();
+        writingPath = next->first;
+        TuneState state;
+        std::swap(state, next->second);
+        pending.erase(next);
+        TuneStateStore &store = stores[writingPath];
+        writing = true;
+
+        lock.unlock();
+        bool ok = store.save(state);
+        lock.lock();
+
+        writing = false;
+        lastWriteOk = ok;
+        idle.notify_all();
+    }
+}
+
+Autosaver::~Autosaver() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wake.notify_one();
+    }
+    // Any pending snapshots are written before the thread exits
+    thread.join();
+}
+
+}
@@ -0,0 +1,94 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "tunestate.h"
+
+namespace TuneTutor {
+
+/**
+ * The Autosaver class writes snapshots of a tune's state to its
+ * TuneStateStore on a background thread, so that the caller never waits for
+ * the disk. Snapshots are coalesced: if a new one is submitted before the
+ * previous one has been written, only the newest is written. Because the store
+ * appends only the records that changed, each write is small, and a crash
+ * loses at most the changes since the last snapshot was written.
+ *
+ * Each state file has its own store, so a snapshot of one tune can still be
+ * waiting to be written when another tune is loaded.
+ */
+class Autosaver {
+
+    public:
+        Autosaver();
+        ~Autosaver();
+
+        /**
+         * Wait for any pending snapshot of the given file to be written, then
+         * load the state stored in it and save subsequent snapshots to it.
+         * Snapshots of other files are left to be written in the background.
+         *
+         * @param path the full path to the state file
+         * @param state receives the loaded state
+         * @return true if the file existed and was loaded
+         */
+        bool load(std::string path, TuneState &state);
+
+        /**
+         * Queue a snapshot to be written in the background. Returns
+         * immediately.
+         *
+         * @param state the current state
+         */
+        void submit(const TuneState &state);
+
+        /**
+         * Wait until every submitted snapshot has been written.
+         *
+         * @return false if the last write failed
+         */
+        bool flush();
+
+    private:
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+
+        // The following are guarded by mutex. A store is only used by the
+        // writer thread while its file has a pending snapshot or is being
+        // written, and only by load() otherwise.
+        std::map<std::string, TuneStateStore> stores;
+        std::map<std::string, TuneState> pending;
+        std::string currentPath;
+        std::string writingPath;
+        bool writing;
+        bool lastWriteOk;
+        bool stopping;
+
+        bool isBusy(const std::string &path) const;
+
+        void run();
+};
+
+}
@@ -0,0 +1,134 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "batchanalyzer.h"
+#include "jobscheduler.h"
+#include "library.h"
+#include "phraseindex.h"
+#include "pitchdetector.h"
+#include "soundfile.h"
+#include "util.h"
+
+namespace TuneTutor {
+
+namespace {
+
+std::mutex outputMutex;
+
+// Guards the phrase index, which is shared by all jobs
+std::mutex phraseIndexMutex;
+
+/**
+ * Analyze one file.
+ * @return false if the file couldn't be analyzed
+ */
+bool analyzeFile(const std::string &path, const std::string &settingsRoot,
+        PhraseIndex &phraseIndex, bool &skipped) {
+    skipped = false;
+    std::string hash = getContentHash(path);
+    if (hash == "") {
+        return false;
+    }
+    std::string settingsPath = settingsRoot + "/" + hash;
+    std::string cachePath = settingsPath + "/pitches.dat";
+    bool indexed;
+    {
+        std::lock_guard<std::mutex> lock(phraseIndexMutex);
+        indexed = phraseIndex.contains(hash);
+    }
+    if (indexed && std::ifstream(cachePath.c_str()).good()) {
+        skipped = true;
+        return true;
+    }
+
+    // Files are already analyzed in parallel, so each is decoded serially
+    SoundFile soundFile;
+    if (!soundFile.load(path, 1)) {
+        return false;
+    }
+    PitchDetector pitchDetector(soundFile);
+    if (!pitchDetector.load(cachePath)) {
+        pitchDetector.detectPitches();
+        if (!createDirectories(settingsPath)
+                || !pitchDetector.save(cachePath)) {
+            return false;
+        }
+    }
+
+    std::vector<PhraseNote> notes = getPhraseNotes(
+            pitchDetector.getPitches(), pitchDetector.getSampleInterval(),
+            soundFile.getSampleRate());
+    std::lock_guard<std::mutex> lock(phraseIndexMutex);
+    return phraseIndex.add(hash, notes);
+}
+
+}
+
+int analyzeDirectory(std::string directory, std::string settingsRoot,
+        std::string libraryPath, std::string phraseIndexPath) {
+    PhraseIndex phraseIndex;
+    phraseIndex.load(phraseIndexPath);
+
+    std::vector<std::string> paths;
+    for (const FileInfo &info : listFiles(directory)) {
+        if (isSoundFilePath(info.path)) {
+            paths.push_back(info.path);
+        }
+    }
+    std::cout << "Analyzing " << paths.size() << " files in " << directory
+        << std::endl;
+
+    std::atomic<int> done(0);
+    std::atomic<int> failed(0);
+    JobScheduler scheduler;
+    for (const std::string &path : paths) {
+        scheduler.submit([&, path]() {
+            bool skipped;
+            bool ok = analyzeFile(path, settingsRoot, phraseIndex, skipped);
+            if (!ok) {
+                failed++;
+            }
+            int count = ++done;
+            std::lock_guard<std::mutex> lock(outputMutex);
+            std::cout << "[" << count << "/" << paths.size() << "] "
+                << (!ok ? "failed: " : skipped ? "cached: " : "analyzed: ")
+                << path << std::endl;
+        });
+    }
+    scheduler.wait();
+
+    // Add the tunes to the library too, so that phrase matches can be opened
+    std::cout << "Updating library" << std::endl;
+    LibraryIndex library;
+    library.load(libraryPath);
+    LibraryScanner scanner;
+    scanner.start(directory, library, settingsRoot);
+    for (const LibraryEntry &entry : scanner.finish()) {
+        library.update(entry);
+    }
+    library.save();
+
+    std::cout << "Done; " << failed << " files failed" << std::endl;
+    return failed;
+}
+
+}
@@ -0,0 +1,41 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+namespace TuneTutor {
+
+/**
+ * Decode every sound file under a directory and save its detected pitches in
+ * the tune's settings directory, so that opening it later doesn't need to run
+ * the pitch detection. Each tune is also added to the library and the phrase
+ * index. Files are spread over all processor cores with a JobScheduler. Files
+ * that already have saved pitches and are in the phrase index are skipped.
+ * Progress is printed to standard output.
+ *
+ * @param directory the directory to analyze, including subdirectories
+ * @param settingsRoot the directory containing each tune's settings
+ *        directory, named by content hash
+ * @param libraryPath the full path to the library index file
+ * @param phraseIndexPath the full path to the phrase index file
+ * @return the number of files that couldn't be analyzed
+ */
+int analyzeDirectory(std::string directory, std::string settingsRoot,
+        std::string libraryPath, std::string phraseIndexPath);
+
+}
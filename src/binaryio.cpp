@@ -0,0 +1,113 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include "binaryio.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/**
+ * Wait for the directory containing a file to reach the disk, so that a
+ * rename within it survives a crash.
+ *
+ * @return true if the directory was synced
+ */
+bool syncDirectory(const std::string &path) {
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "."
+        : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    return close(fd) == 0 && ok;
+}
+
+}
+
+void putString(std::vector<char> &buf, const std::string &s) {
+    put<uint32_t>(buf, s.size());
+    buf.insert(buf.end(), s.begin(), s.end());
+}
+
+BinaryReader::BinaryReader(const char *data, size_t size)
+        : data(data), size(size), pos(0) {
+}
+
+bool BinaryReader::getString(std::string &s) {
+    uint32_t length;
+    size_t start = pos;
+    if (!get(length)) {
+        return false;
+    }
+    if (size - pos < length) {
+        pos = start;
+        return false;
+    }
+    s.assign(data + pos, length);
+    pos += length;
+    return true;
+}
+
+bool BinaryReader::atEnd() const {
+    return pos == size;
+}
+
+size_t BinaryReader::getPosition() const {
+    return pos;
+}
+
+bool readFile(const std::string &path, std::vector<char> &buf) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    buf.assign(std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>());
+    return true;
+}
+
+bool writeFile(const std::string &path, const std::vector<char> &buf,
+        const char *mode) {
+    FILE *f = fopen(path.c_str(), mode);
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fwrite(&buf[0], 1, buf.size(), f) == buf.size()
+        && fflush(f) == 0
+        && fsync(fileno(f)) == 0;
+    return fclose(f) == 0 && ok;
+}
+
+bool replaceFile(const std::string &path, const std::vector<char> &buf) {
+    std::string tmpPath = path + ".tmp";
+    return writeFile(tmpPath, buf, "wb")
+        && std::rename(tmpPath.c_str(), path.c_str()) == 0
+        && syncDirectory(path);
+}
+
+}
@@ -0,0 +1,101 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Helpers for the binary cache files kept under ~/.TuneTutor. Integers and
+ * doubles are stored in native byte order, since the files are only ever read
+ * on the machine that wrote them. Strings are stored as a four-byte length
+ * followed by the bytes.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace TuneTutor {
+
+/** Append a value to a buffer */
+template <typename T>
+void put(std::vector<char> &buf, T value) {
+    const char *p = reinterpret_cast<const char *>(&value);
+    buf.insert(buf.end(), p, p + sizeof(T));
+}
+
+/** Append a length-prefixed string to a buffer */
+void putString(std::vector<char> &buf, const std::string &s);
+
+/**
+ * Bounds-checked sequential reader over a buffer. Each get function returns
+ * false, leaving the output unchanged, if the buffer is too short.
+ */
+class BinaryReader {
+
+    public:
+        BinaryReader(const char *data, size_t size);
+
+        template <typename T>
+        bool get(T &value) {
+            if (size - pos < sizeof(T)) {
+                return false;
+            }
+            memcpy(&value, data + pos, sizeof(T));
+            pos += sizeof(T);
+            return true;
+        }
+
+        bool getString(std::string &s);
+
+        /** @return true if the whole buffer has been read */
+        bool atEnd() const;
+
+        /** @return the number of bytes read so far */
+        size_t getPosition() const;
+
+    private:
+        const char *data;
+        size_t size;
+        size_t pos;
+};
+
+/**
+ * Read a whole file into memory.
+ * @return false if the file couldn't be opened
+ */
+bool readFile(const std::string &path, std::vector<char> &buf);
+
+/**
+ * Write a buffer to a file and wait for it to reach the disk.
+ *
+ * @param mode "ab" to append or "wb" to replace the file's contents
+ * @return true if the whole buffer was written
+ */
+bool writeFile(const std::string &path, const std::vector<char> &buf,
+        const char *mode);
+
+/**
+ * Replace a file's contents by writing a temporary file and renaming it over
+ * the original, so that the original is left intact if writing fails partway.
+ * The directory is synced after the rename, so that the new contents are
+ * still in place after a crash.
+ *
+ * @return true if the file was replaced
+ */
+bool replaceFile(const std::string &path, const std::vector<char> &buf);
+
+}
@@ -0,0 +1,316 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "cuecache.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/** Input frames stretched and discarded before each position */
+const int prerollFrames = 8192;
+
+/** Lengths of a cue and of the crossfade at its end, in seconds */
+const double cueSeconds = 0.25;
+const double fadeSeconds = 0.05;
+
+/** Output frames discarded per call to the renderer */
+const int discardBlock = 4096;
+
+}
+
+CueCache::CueCache(const SoundFile &soundFile) {
+    this->soundFile = &soundFile;
+    inputRate = soundFile.getSampleRate();
+    changed = false;
+    working = true;
+    stopping = false;
+    requested = NULL;
+    playing = NULL;
+    requests = 0;
+    requestsSeen = 0;
+    cuePos = 0;
+    quality = QUALITY_MEDIUM;
+    setOutputRate(inputRate);
+    thread = std::thread(&CueCache::run, this);
+}
+
+void CueCache::setOutputRate(int rate) {
+    std::lock_guard<std::mutex> lock(mutex);
+    outputRate = rate;
+    fadeFrames = (int) (fadeSeconds * rate);
+
+    // Cues stretched for the old rate are the wrong length
+    for (std::map<int64_t, std::unique_ptr<Cue> >::iterator it = cues.begin();
+            it != cues.end(); ++it) {
+        retire(it->second);
+    }
+    cues.clear();
+    changed = true;
+    wake.notify_one();
+}
+
+void CueCache::update(const std::vector<int64_t> &positions,
+        const CueSettings &settings) {
+    std::vector<int64_t> sorted(positions);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (sorted == this->positions && settings == this->settings) {
+        return;
+    }
+    this->positions = sorted;
+    this->settings = settings;
+
+    // Drop the cues of positions that have gone, such as deleted marks
+    std::map<int64_t, std::unique_ptr<Cue> >::iterator it = cues.begin();
+    while (it != cues.end()) {
+        if (!std::binary_search(sorted.begin(), sorted.end(), it->first)) {
+            retire(it->second);
+            it = cues.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    changed = true;
+    wake.notify_one();
+}
+
+void CueCache::setQuality(StretchQuality quality) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->quality = quality;
+}
+
+void CueCache::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return (!working && !changed) || stopping; });
+}
+
+/**
+ * Unless asked to wait, the cue is looked up under the lock only if the lock
+ * is free, so that the audio thread never waits for the background thread.
+ * While the lock is held, the cue can't be retired, and once it is in
+ * `requested` it won't be deleted.
+ */
+void CueCache::start(int64_t position, bool wait) {
+    Cue *cue = NULL;
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    if (wait) {
+        lock.lock();
+    } else {
+        lock.try_lock();
+    }
+    if (lock.owns_lock()) {
+        std::map<int64_t, std::unique_ptr<Cue> >::iterator it =
+            cues.find(position);
+        if (it != cues.end() && it->second->settings == settings) {
+            cue = it->second.get();
+        }
+    }
+    requested = cue;
+    requests++;
+}
+
+/**
+ * The cue in `requested` is published in `playing` before it is used, and
+ * `requested` is checked again afterwards. If it has changed, the cue may
+ * have been deleted in between, so the newer request is taken instead.
+ */
+bool CueCache::beginCue() {
+    unsigned count = requests;
+    if (count == requestsSeen) {
+        return false;
+    }
+    requestsSeen = count;
+    Cue *cue;
+    do {
+        cue = requested;
+        playing = cue;
+    } while (requested != cue);
+    cuePos = 0;
+    return cue != NULL;
+}
+
+void CueCache::mix(float *output, int bufferSize, int outputChannels) {
+    Cue *cue = playing;
+    if (cue == NULL) {
+        return;
+    }
+    int frames = cue->frames.size() / cueChannels;
+    int fade = std::min(fadeFrames, frames);
+    int fadeStart = frames - fade;
+    for (int i = 0; i < bufferSize; i++, cuePos++) {
+        if (cuePos >= frames) {
+            playing = NULL;
+            return;
+        }
+
+        // Gain of the live stretcher's output
+        float live = 0;
+        if (cuePos >= fadeStart) {
+            live = (cuePos - fadeStart + 1) / (float) (fade + 1);
+        }
+        const float *in = &cue->frames[cuePos * cueChannels];
+        float *out = output + i * outputChannels;
+        for (int c = 0; c < outputChannels; c++) {
+            float sample = in[std::min(c, cueChannels - 1)];
+            out[c] = sample + live * (out[c] - sample);
+        }
+    }
+}
+
+size_t CueCache::getMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (std::map<int64_t, std::unique_ptr<Cue> >::const_iterator it =
+            cues.begin(); it != cues.end(); ++it) {
+        bytes += it->second->frames.capacity() * sizeof(float);
+    }
+    return bytes;
+}
+
+/**
+ * Move a cue onto the retired list. Called with the lock held.
+ */
+void CueCache::retire(std::unique_ptr<Cue> &cue) {
+    retired.push_back(std::unique_ptr<Cue>());
+    retired.back().swap(cue);
+}
+
+/**
+ * Delete the retired cues that the audio thread can't be playing. Called with
+ * the lock held, so that start() can't request one of them meanwhile.
+ */
+void CueCache::freeRetired() {
+    Cue *inUse[2] = {requested, playing};
+    std::vector<std::unique_ptr<Cue> >::iterator it = retired.begin();
+    while (it != retired.end()) {
+        if (it->get() != inUse[0] && it->get() != inUse[1]) {
+            it = retired.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CueCache::run() {
+    // Created when there is work, and deleted when there isn't, so that an
+    // idle cache doesn't hold on to a stretcher's buffers
+    std::unique_ptr<TimeStretcher> renderer;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        freeRetired();
+
+        // Find a position whose cue is missing or out of date
+        int64_t position = -1;
+        for (int64_t p : positions) {
+            std::map<int64_t, std::unique_ptr<Cue> >::iterator it =
+                cues.find(p);
+            if (it == cues.end() || it->second->settings != settings) {
+                position = p;
+                break;
+            }
+        }
+
+        if (position == -1) {
+            renderer.reset();
+            changed = false;
+            working = false;
+            idle.notify_all();
+            if (retired.empty()) {
+                wake.wait(lock, [this] { return changed || stopping; });
+            } else {
+                // Check again for retired cues that have finished playing
+                wake.wait_for(lock, std::chrono::seconds(1),
+                        [this] { return changed || stopping; });
+            }
+            working = true;
+            continue;
+        }
+
+        std::unique_ptr<Cue> cue(new Cue());
+        cue->settings = settings;
+        int rate = outputRate;
+        StretchQuality renderQuality = quality;
+        lock.unlock();
+
+        if (!renderer) {
+            renderer.reset(new TimeStretcher(*soundFile));
+        }
+        renderer->setOutputRate(rate);
+        render(*renderer, position, rate, renderQuality, *cue);
+
+        lock.lock();
+        // The position may have gone, or the rate changed, while rendering
+        if (rate == outputRate && std::binary_search(positions.begin(),
+                    positions.end(), position)) {
+            std::unique_ptr<Cue> &slot = cues[position];
+            if (slot) {
+                retire(slot);
+            }
+            slot.swap(cue);
+        }
+    }
+}
+
+/**
+ * Stretch the cue for a position. Called without the lock held.
+ */
+void CueCache::render(TimeStretcher &renderer, int64_t position, int rate,
+        StretchQuality quality, Cue &cue) {
+    const CueSettings &s = cue.settings;
+    renderer.setBackend(s.backend);
+    renderer.setQuality(quality);
+    renderer.setSpeed(s.speed);
+    renderer.setPitch(s.semitones);
+    renderer.reset();
+
+    int64_t from = std::max<int64_t>(0, position - prerollFrames);
+    renderer.seek(from);
+
+    // Discard the output up to the position, which starts out the same
+    // distance behind its input as a stretcher started at the position
+    double outputPerInput = rate / (double) inputRate / s.speed;
+    int64_t discard = (int64_t) std::floor(
+            (position - from) * outputPerInput + 0.5);
+    std::vector<float> scratch(discardBlock * cueChannels);
+    while (discard > 0) {
+        int n = (int) std::min<int64_t>(discard, discardBlock);
+        renderer.getOutput(&scratch[0], n, cueChannels);
+        discard -= n;
+    }
+
+    int frames = (int) (cueSeconds * rate);
+    cue.frames.resize(frames * cueChannels);
+    renderer.getOutput(&cue.frames[0], frames, cueChannels);
+}
+
+CueCache::~CueCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wake.notify_one();
+    }
+    thread.join();
+}
+
+}
@@ -0,0 +1,212 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "soundfile.h"
+#include "timestretcher.h"
+
+namespace TuneTutor {
+
+/**
+ * The parameters that a cue is stretched with. A cue is only played if they
+ * match the live stretcher's. The stretch quality isn't one of them: a cue at
+ * another quality tier sounds the same but for detail, and the tier changes
+ * with the load, which would otherwise stretch every cue again.
+ */
+struct CueSettings {
+    double speed;
+    double semitones;
+    StretchBackend backend;
+
+    CueSettings() {
+        speed = 1;
+        semitones = 0;
+        backend = STRETCH_RUBBERBAND;
+    }
+
+    bool operator==(const CueSettings &other) const {
+        return speed == other.speed && semitones == other.semitones
+            && backend == other.backend;
+    }
+
+    bool operator!=(const CueSettings &other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * The CueCache class keeps a short lead-in of stretched audio for each of a
+ * set of positions in a tune, such as the marks and the start of the
+ * selection, so that playback from them starts instantly. A TimeStretcher
+ * started afresh at a position gives tens of milliseconds of silence or
+ * smeared audio while it fills up. A cue is stretched by a separate
+ * TimeStretcher that starts a little before the position, so that it has
+ * settled by the time it gets there, and its output is discarded up to the
+ * position.
+ *
+ * When playback jumps to a cued position, the cue is played while the live
+ * stretcher starts afresh behind it, and the live stretcher is crossfaded in
+ * over the end of the cue. Both stretchers start out the same distance behind
+ * their input, so the two line up at the crossfade.
+ *
+ * Cues are stretched on a background thread, and stretched again whenever the
+ * positions or the settings change.
+ */
+class CueCache {
+
+    public:
+        /**
+         * @param soundFile Must already have a sound loaded via load(), and
+         *        must outlive the CueCache
+         */
+        CueCache(const SoundFile &soundFile);
+        ~CueCache();
+
+        /**
+         * Set the sample rate of the output device. It is the sound file's
+         * sample rate until this is called. Must be called before update(),
+         * and not while mix() may be running.
+         *
+         * @param rate the output sample rate in Hz
+         */
+        void setOutputRate(int rate);
+
+        /**
+         * Set the positions to keep cues for, and the settings of the live
+         * stretcher. Cues that are missing or out of date are stretched in the
+         * background. Cheap when nothing has changed, so it may be called on
+         * every frame.
+         *
+         * @param positions the frames to keep cues for, in any order
+         * @param settings the settings of the live stretcher
+         */
+        void update(const std::vector<int64_t> &positions,
+                const CueSettings &settings);
+
+        /**
+         * Set the quality that cues are stretched at from now on. Cues
+         * already stretched are kept.
+         *
+         * @param quality the quality tier of the live stretcher
+         */
+        void setQuality(StretchQuality quality);
+
+        /**
+         * Wait until every cue is up to date, so that playback is the same
+         * from one run to the next. Used for offline rendering.
+         */
+        void wait();
+
+        /**
+         * Play the cue for the given position, if it is ready, from the next
+         * call to beginCue(). A position without a cue stops any cue that is
+         * playing. Unless wait is true, it never blocks, so it may be called
+         * from any thread, but may miss a cue while the background thread
+         * holds the cache.
+         *
+         * @param position the frame that playback jumped to
+         * @param wait true to wait for the background thread, so that a
+         *        ready cue is always found, as offline playback needs
+         */
+        void start(int64_t position, bool wait = false);
+
+        /**
+         * Pick up a cue started by start(). Called from the audio thread
+         * before getting output from the live stretcher.
+         *
+         * @return true if a cue starts with this buffer, in which case the
+         *         live stretcher should be reset() so that it starts afresh
+         *         behind the cue
+         */
+        bool beginCue();
+
+        /**
+         * Mix the playing cue, if any, over a block of output from the live
+         * stretcher. Called from the audio thread after beginCue().
+         *
+         * @param output the live stretcher's output, interleaved by channel
+         * @param bufferSize the number of frames in the output buffer
+         * @param outputChannels the number of channels in each output frame
+         */
+        void mix(float *output, int bufferSize, int outputChannels);
+
+        /** @return the approximate number of bytes of memory used */
+        size_t getMemoryUsage() const;
+
+    private:
+        // Channels in a cue; the output device is stereo
+        static const int cueChannels = 2;
+
+        struct Cue {
+            CueSettings settings;
+
+            // Stretched frames, interleaved by channel
+            std::vector<float> frames;
+        };
+
+        const SoundFile *soundFile;
+        int inputRate;
+        int fadeFrames;
+
+        // Guards everything below it up to the audio thread's state
+        mutable std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        int outputRate;
+        std::vector<int64_t> positions;
+        CueSettings settings;
+        StretchQuality quality;
+        std::map<int64_t, std::unique_ptr<Cue> > cues;
+        bool changed;
+        bool working;
+        bool stopping;
+
+        // Cues that have been replaced, kept until the audio thread can no
+        // longer be playing them
+        std::vector<std::unique_ptr<Cue> > retired;
+
+        // The cue asked for by start(), and the cue the audio thread is
+        // playing. A cue is not deleted while either of them points to it.
+        std::atomic<Cue *> requested;
+        std::atomic<Cue *> playing;
+        std::atomic<unsigned> requests;
+
+        // Audio thread state: the requests seen so far, and the next frame of
+        // the playing cue
+        unsigned requestsSeen;
+        int cuePos;
+
+        std::thread thread;
+
+        void run();
+        void render(TimeStretcher &renderer, int64_t position, int rate,
+                StretchQuality quality, Cue &cue);
+        void retire(std::unique_ptr<Cue> &cue);
+        void freeRetired();
+};
+
+}
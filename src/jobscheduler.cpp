@@ -0,0 +1,139 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "jobscheduler.h"
+
+namespace TuneTutor {
+
+JobScheduler::JobScheduler(int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    pending = 0;
+    queued = 0;
+    stopping = false;
+    nextWorker = 0;
+    for (int i = 0; i < numThreads; i++) {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    }
+    for (int i = 0; i < numThreads; i++) {
+        threads.push_back(std::thread(&JobScheduler::run, this, i));
+    }
+}
+
+int JobScheduler::getThreadCount() const {
+    return threads.size();
+}
+
+void JobScheduler::submit(Job job) {
+    pending++;
+
+    // A job submitted by a worker goes onto that worker's own queue, where it
+    // is likely to be run soon while its data is still in cache
+    int target = -1;
+    std::thread::id self = std::this_thread::get_id();
+    for (size_t i = 0; i < threads.size(); i++) {
+        if (threads[i].get_id() == self) {
+            target = i;
+            break;
+        }
+    }
+    if (target == -1) {
+        target = nextWorker++ % workers.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->jobs.push_back(job);
+    }
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    queued++;
+    wake.notify_one();
+}
+
+/**
+ * Take the newest job from the given worker's queue, or failing that the
+ * oldest job from another worker's queue.
+ *
+ * @return true if a job was taken
+ */
+bool JobScheduler::takeJob(int worker, Job &job) {
+    bool found = false;
+    {
+        Worker &own = *workers[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty()) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; !found && i < workers.size(); i++) {
+        Worker &victim = *workers[(worker + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued--;
+    }
+    return found;
+}
+
+void JobScheduler::run(int worker) {
+    while (true) {
+        Job job;
+        if (takeJob(worker, job)) {
+            job();
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return queued > 0 || stopping; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
+
+void JobScheduler::wait() {
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+JobScheduler::~JobScheduler() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+        wake.notify_all();
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
+
+}
@@ -0,0 +1,87 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * The JobScheduler class runs jobs on a pool of worker threads, one per
+ * processor core by default. Each worker has its own queue. A worker takes the
+ * newest job from its own queue, and when that is empty it steals the oldest
+ * job from another worker's queue, so that workers stay busy when jobs take
+ * very different amounts of time. Jobs may submit further jobs, which go onto
+ * the submitting worker's own queue.
+ */
+class JobScheduler {
+
+    public:
+        typedef std::function<void()> Job;
+
+        /** @param numThreads the number of workers, or 0 for one per core */
+        JobScheduler(int numThreads = 0);
+
+        /** Waits for all submitted jobs to finish */
+        ~JobScheduler();
+
+        /** @param job the job to run on a worker thread */
+        void submit(Job job);
+
+        /**
+         * Wait until every submitted job has finished. Must not be called
+         * from a job.
+         */
+        void wait();
+
+        /** @return the number of worker threads */
+        int getThreadCount() const;
+
+    private:
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        std::vector<std::unique_ptr<Worker> > workers;
+        std::vector<std::thread> threads;
+
+        // Jobs submitted but not yet finished
+        std::atomic<int> pending;
+
+        // For sleeping when there is nothing to do, and waking when there is
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        int queued;
+        bool stopping;
+
+        // Used to spread jobs submitted from outside the pool over the workers
+        std::atomic<unsigned> nextWorker;
+
+        bool takeJob(int worker, Job &job);
+        void run(int worker);
+};
+
+}
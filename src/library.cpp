@@ -0,0 +1,402 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "binaryio.h"
+#include "jobscheduler.h"
+#include "library.h"
+#include "soundfile.h"
+#include "tunestate.h"
+#include "util.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const char fileMagic[4] = {'T', 'T', 'L', 1};
+
+/** Names of the searchable fields, indexed by LibraryField */
+const char *fieldNames[NUM_LIBRARY_FIELDS] = {
+    "title", "artist", "album", "rhythm", "key"
+};
+
+/**
+ * Split text into lowercase words. Bytes outside of ASCII are treated as
+ * letters, so that UTF-8 encoded words are kept whole.
+ */
+std::vector<std::string> getWords(const std::string &text) {
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : text) {
+        unsigned char u = (unsigned char) c;
+        if (u >= 0x80 || isalnum(u)) {
+            word += (char) tolower(u);
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+    if (!word.empty()) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+std::string toLower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+}
+
+LibraryIndex::LibraryIndex() {
+    path = "";
+    postingsStale = true;
+}
+
+bool LibraryIndex::load(std::string path) {
+    this->path = path;
+    entries.clear();
+    entriesByHash.clear();
+    entriesByPath.clear();
+    postingsStale = true;
+
+    std::vector<char> data;
+    if (!readFile(path, data)) {
+        return false;
+    }
+    if (data.size() < sizeof(fileMagic)
+            || memcmp(&data[0], fileMagic, sizeof(fileMagic)) != 0) {
+        std::cout << "LibraryIndex: " << path << " is not a library index"
+            << std::endl;
+        return false;
+    }
+
+    BinaryReader r(&data[sizeof(fileMagic)], data.size() - sizeof(fileMagic));
+    uint32_t count;
+    if (!r.get(count)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        LibraryEntry entry;
+        bool ok = r.getString(entry.hash) && r.getString(entry.path)
+            && r.get(entry.modified) && r.get(entry.size)
+            && r.get(entry.duration);
+        for (int field = 0; ok && field < NUM_LIBRARY_FIELDS; field++) {
+            ok = r.getString(entry.fields[field]);
+        }
+        if (!ok) {
+            std::cout << "LibraryIndex: " << path << " is truncated"
+                << std::endl;
+            break;
+        }
+        update(entry);
+    }
+    return true;
+}
+
+bool LibraryIndex::save() {
+    std::vector<char> buf(fileMagic, fileMagic + sizeof(fileMagic));
+    put<uint32_t>(buf, entries.size());
+    for (const LibraryEntry &entry : entries) {
+        putString(buf, entry.hash);
+        putString(buf, entry.path);
+        put(buf, entry.modified);
+        put(buf, entry.size);
+        put(buf, entry.duration);
+        for (int field = 0; field < NUM_LIBRARY_FIELDS; field++) {
+            putString(buf, entry.fields[field]);
+        }
+    }
+    if (path == "" || !replaceFile(path, buf)) {
+        std::cout << "LibraryIndex: error writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Remove an entry by moving the last entry into its place.
+ */
+void LibraryIndex::remove(int index) {
+    entriesByHash.erase(entries[index].hash);
+    entriesByPath.erase(entries[index].path);
+    int last = entries.size() - 1;
+    if (index != last) {
+        entries[index] = entries[last];
+        entriesByHash[entries[index].hash] = index;
+        entriesByPath[entries[index].path] = index;
+    }
+    entries.pop_back();
+}
+
+void LibraryIndex::update(const LibraryEntry &entry) {
+    std::map<std::string, int>::iterator it;
+
+    // A file whose content has changed leaves behind an entry under its old
+    // hash, and a file that has moved leaves one under its old path
+    it = entriesByPath.find(entry.path);
+    if (it != entriesByPath.end() && entries[it->second].hash != entry.hash) {
+        remove(it->second);
+    }
+    it = entriesByHash.find(entry.hash);
+    if (it != entriesByHash.end()) {
+        entriesByPath.erase(entries[it->second].path);
+        entries[it->second] = entry;
+        entriesByPath[entry.path] = it->second;
+    } else {
+        entriesByHash[entry.hash] = entries.size();
+        entriesByPath[entry.path] = entries.size();
+        entries.push_back(entry);
+    }
+    postingsStale = true;
+}
+
+const LibraryEntry *LibraryIndex::findByPath(std::string path) const {
+    std::map<std::string, int>::const_iterator it = entriesByPath.find(path);
+    if (it == entriesByPath.end()) {
+        return NULL;
+    }
+    return &entries[it->second];
+}
+
+const LibraryEntry *LibraryIndex::findByHash(std::string hash) const {
+    std::map<std::string, int>::const_iterator it = entriesByHash.find(hash);
+    if (it == entriesByHash.end()) {
+        return NULL;
+    }
+    return &entries[it->second];
+}
+
+int LibraryIndex::size() const {
+    return entries.size();
+}
+
+const std::vector<LibraryEntry> &LibraryIndex::getEntries() const {
+    return entries;
+}
+
+void LibraryIndex::buildPostings() const {
+    postings.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        for (int field = 0; field < NUM_LIBRARY_FIELDS; field++) {
+            for (const std::string &word : getWords(entries[i].fields[field])) {
+                Posting posting;
+                posting.word = word;
+                posting.entry = i;
+                posting.field = field;
+                postings.push_back(posting);
+            }
+        }
+    }
+    std::sort(postings.begin(), postings.end());
+    postingsStale = false;
+}
+
+std::vector<LibraryEntry> LibraryIndex::search(std::string query,
+        int maxResults) const {
+    if (postingsStale) {
+        buildPostings();
+    }
+
+    // Entries matching all query words so far; initially all entries
+    std::vector<bool> matched(entries.size(), true);
+
+    std::stringstream terms(query);
+    std::string term;
+    while (terms >> term) {
+        int field = -1;
+        size_t colon = term.find(':');
+        if (colon != std::string::npos) {
+            std::string name = toLower(term.substr(0, colon));
+            for (int f = 0; f < NUM_LIBRARY_FIELDS; f++) {
+                if (name == fieldNames[f]) {
+                    field = f;
+                    term = term.substr(colon + 1);
+                }
+            }
+        }
+
+        for (const std::string &word : getWords(term)) {
+            std::vector<bool> wordMatched(entries.size(), false);
+            Posting key;
+            key.word = word;
+            for (std::vector<Posting>::const_iterator it = std::lower_bound(
+                        postings.begin(), postings.end(), key);
+                    it != postings.end()
+                    && it->word.compare(0, word.size(), word) == 0;
+                    ++it) {
+                if (field == -1 || it->field == field) {
+                    wordMatched[it->entry] = true;
+                }
+            }
+            for (size_t i = 0; i < entries.size(); i++) {
+                matched[i] = matched[i] && wordMatched[i];
+            }
+        }
+    }
+
+    std::vector<LibraryEntry> results;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (matched[i]) {
+            results.push_back(entries[i]);
+        }
+    }
+    std::sort(results.begin(), results.end(),
+            [](const LibraryEntry &a, const LibraryEntry &b) {
+                std::string titleA = toLower(a.fields[FIELD_TITLE]);
+                std::string titleB = toLower(b.fields[FIELD_TITLE]);
+                return titleA != titleB ? titleA < titleB : a.path < b.path;
+            });
+    if ((int) results.size() > maxResults) {
+        results.resize(maxResults);
+    }
+    return results;
+}
+
+LibraryScanner::LibraryScanner() {
+    running = false;
+    stopping = false;
+    filesFound = 0;
+    filesDone = 0;
+}
+
+void LibraryScanner::start(std::string directory, const LibraryIndex &index,
+        std::string settingsRoot) {
+    if (running || thread.joinable()) {
+        return;
+    }
+    this->directory = directory;
+    this->settingsRoot = settingsRoot;
+    known.clear();
+    results.clear();
+    filesFound = 0;
+    filesDone = 0;
+    running = true;
+
+    // Take a copy of what's needed from the index, so that the caller is free
+    // to change it while the scan runs
+    for (const LibraryEntry &entry : index.getEntries()) {
+        known[entry.path] = std::make_pair(entry.modified, entry.size);
+    }
+
+    thread = std::thread(&LibraryScanner::run, this);
+}
+
+bool LibraryScanner::isRunning() const {
+    return running;
+}
+
+int LibraryScanner::getFilesFound() const {
+    return filesFound;
+}
+
+int LibraryScanner::getFilesDone() const {
+    return filesDone;
+}
+
+std::vector<LibraryEntry> LibraryScanner::finish() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+    std::vector<LibraryEntry> finished;
+    std::swap(finished, results);
+    return finished;
+}
+
+void LibraryScanner::run() {
+    std::vector<FileInfo> files;
+    for (const FileInfo &info : listFiles(directory)) {
+        if (isSoundFilePath(info.path)) {
+            files.push_back(info);
+            filesFound++;
+        }
+    }
+
+    JobScheduler scheduler;
+    for (const FileInfo &info : files) {
+        scheduler.submit([this, info]() {
+            if (stopping) {
+                return;
+            }
+            std::map<std::string, std::pair<int64_t, int64_t> >::iterator it =
+                known.find(info.path);
+            if (it == known.end() || it->second.first != info.modified
+                    || it->second.second != info.size) {
+                scanFile(info.path, info.modified, info.size);
+            }
+            filesDone++;
+        });
+    }
+    scheduler.wait();
+
+    running = false;
+}
+
+void LibraryScanner::scanFile(const std::string &path, int64_t modified,
+        int64_t size) {
+    SoundFile soundFile;
+    if (!soundFile.loadInfo(path)) {
+        return;
+    }
+
+    LibraryEntry entry;
+    entry.hash = getContentHash(path);
+    if (entry.hash == "") {
+        return;
+    }
+    entry.path = path;
+    entry.modified = modified;
+    entry.size = size;
+    if (soundFile.getSampleRate() > 0) {
+        entry.duration = soundFile.getLength()
+            / (double) soundFile.getSampleRate();
+    }
+    SoundFileMetadata metadata = soundFile.getMetadata();
+    entry.fields[FIELD_TITLE] = metadata.title;
+    entry.fields[FIELD_ARTIST] = metadata.artist;
+    entry.fields[FIELD_ALBUM] = metadata.album;
+
+    // Fields edited in TuneTutor take precedence over the file's tags
+    TuneStateStore store;
+    TuneState state;
+    if (store.load(settingsRoot + "/" + entry.hash + "/state.dat", state)) {
+        for (int field = 0; field < NUM_LIBRARY_FIELDS; field++) {
+            std::map<std::string, std::string>::iterator text =
+                state.texts.find(fieldNames[field]);
+            if (text != state.texts.end() && text->second != "") {
+                entry.fields[field] = text->second;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(resultsMutex);
+    results.push_back(entry);
+}
+
+LibraryScanner::~LibraryScanner() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+}
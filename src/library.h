@@ -0,0 +1,215 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * Searchable fields of a library entry. These match the names of the text
+ * inputs in the metadata table.
+ */
+enum LibraryField {
+    FIELD_TITLE,
+    FIELD_ARTIST,
+    FIELD_ALBUM,
+    FIELD_RHYTHM,
+    FIELD_KEY,
+    NUM_LIBRARY_FIELDS
+};
+
+/**
+ * One tune in the library.
+ */
+struct LibraryEntry {
+
+    /** Content hash of the file, as returned by getContentHash() */
+    std::string hash;
+
+    /** Full path to the file where it was last seen */
+    std::string path;
+
+    /** Modification time and size of the file when it was last scanned */
+    int64_t modified;
+    int64_t size;
+
+    /** Length of the tune in seconds */
+    double duration;
+
+    /** Values of the searchable fields, indexed by LibraryField */
+    std::string fields[NUM_LIBRARY_FIELDS];
+
+    LibraryEntry() {
+        hash = "";
+        path = "";
+        modified = 0;
+        size = 0;
+        duration = 0;
+    }
+};
+
+/**
+ * The LibraryIndex class is a collection of LibraryEntries, keyed by content
+ * hash, that is kept in a single local file. It maintains an in-memory
+ * inverted index from the words of the searchable fields to entries, so that
+ * searches don't need to look at every entry.
+ */
+class LibraryIndex {
+
+    public:
+        LibraryIndex();
+
+        /**
+         * @param path the full path to the index file
+         * @return true if the file existed and was loaded
+         */
+        bool load(std::string path);
+
+        /**
+         * Write the index to the file it was loaded from.
+         * @return true if the index was written successfully
+         */
+        bool save();
+
+        /**
+         * Add an entry, replacing any existing entry with the same hash or
+         * path.
+         */
+        void update(const LibraryEntry &entry);
+
+        /**
+         * @return the entry for the given path, or NULL if it isn't indexed.
+         *         The pointer is invalidated by update().
+         */
+        const LibraryEntry *findByPath(std::string path) const;
+
+        /**
+         * @return the entry with the given content hash, or NULL if it isn't
+         *         indexed. The pointer is invalidated by update().
+         */
+        const LibraryEntry *findByHash(std::string hash) const;
+
+        /** @return the number of entries */
+        int size() const;
+
+        /** @return all entries, in no particular order */
+        const std::vector<LibraryEntry> &getEntries() const;
+
+        /**
+         * Find the entries matching every word of a query. A query word
+         * matches any word of the searchable fields that starts with it,
+         * ignoring case. A word may be restricted to one field with a prefix,
+         * as in "artist:hayes" or "key:dmaj".
+         *
+         * @param query the words to search for
+         * @param maxResults the maximum number of entries to return
+         * @return the matching entries, ordered by title
+         */
+        std::vector<LibraryEntry> search(std::string query,
+                int maxResults) const;
+
+    private:
+        std::string path;
+        std::vector<LibraryEntry> entries;
+        std::map<std::string, int> entriesByHash;
+        std::map<std::string, int> entriesByPath;
+
+        /** A word of a searchable field of an entry */
+        struct Posting {
+            std::string word;
+            int entry;
+            int field;
+            bool operator<(const Posting &other) const {
+                return word < other.word;
+            }
+        };
+
+        // Sorted by word, and rebuilt on the next search after a change
+        mutable std::vector<Posting> postings;
+        mutable bool postingsStale;
+
+        void buildPostings() const;
+        void remove(int index);
+};
+
+/**
+ * The LibraryScanner class finds all the sound files under a directory and
+ * reads their tags and durations, using a JobScheduler to spread the files
+ * over all processor cores. Files whose size and modification time match their
+ * index entry are skipped. Values of the rhythm and key fields are taken from
+ * each tune's saved settings, if it has any.
+ */
+class LibraryScanner {
+
+    public:
+        LibraryScanner();
+        ~LibraryScanner();
+
+        /**
+         * Start scanning in the background. Does nothing if a scan is already
+         * running.
+         *
+         * @param directory the directory to scan, including subdirectories
+         * @param index the index to compare files against; it is only read
+         *        during this call
+         * @param settingsRoot the directory containing each tune's settings
+         *        directory, named by content hash
+         */
+        void start(std::string directory, const LibraryIndex &index,
+                std::string settingsRoot);
+
+        /** @return true if a scan has been started and not yet finished */
+        bool isRunning() const;
+
+        /** @return the number of files found so far, and processed so far */
+        int getFilesFound() const;
+        int getFilesDone() const;
+
+        /**
+         * Wait for the scan to finish, and get the new and changed entries.
+         * Call this once for each scan, after isRunning() returns false.
+         */
+        std::vector<LibraryEntry> finish();
+
+    private:
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<bool> stopping;
+        std::atomic<int> filesFound;
+        std::atomic<int> filesDone;
+
+        std::string directory;
+        std::string settingsRoot;
+
+        // Size and modification time of indexed files, by path
+        std::map<std::string, std::pair<int64_t, int64_t> > known;
+
+        std::mutex resultsMutex;
+        std::vector<LibraryEntry> results;
+
+        void run();
+        void scanFile(const std::string &path, int64_t modified, int64_t size);
+};
+
+}
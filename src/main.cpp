@@ -14,17 +14,166 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
 #include <string>
 #include "ofMain.h"
 #include "ofApp.h"
+#include "batchanalyzer.h"
+#include "mp3decoder.h"
+#include "offlineplayer.h"
+#include "pitchbenchmark.h"
+#include "pitchstream.h"
+#include "soundfile.h"
+#include "util.h"
 
 int main(int argc, char *argv[]) {
+
+    // Analyze a whole directory without opening a window
+    if (argc > 2 && std::string(argv[1]) == "--analyze") {
+        std::string home = getHomeDirectory();
+        int failed = TuneTutor::analyzeDirectory(std::string(argv[2]),
+                ofApp::getSettingsRoot(), home + "/.TuneTutor/library.idx",
+                home + "/.TuneTutor/phrases.idx");
+        return failed == 0 ? 0 : 1;
+    }
+
+    // Play a tune by a script into a WAV file, without a sound card
+    if (argc > 4 && std::string(argv[1]) == "--render") {
+        bool paced = false;
+        std::string referencePath = "";
+        for (int i = 5; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (arg == "--real-time") {
+                paced = true;
+            } else if (arg == "--compare" && i + 1 < argc) {
+                referencePath = argv[++i];
+            } else {
+                std::cerr << "Unknown option " << arg << " for --render"
+                    << std::endl;
+                return 1;
+            }
+        }
+        return TuneTutor::renderScript(std::string(argv[2]),
+                std::string(argv[3]), std::string(argv[4]), paced,
+                referencePath);
+    }
+
+    // Measure the accuracy and speed of the pitch smoothing on synthetic
+    // melodies
+    if (argc > 1 && std::string(argv[1]) == "--pitch-benchmark") {
+        return TuneTutor::benchmarkPitchSmoothing();
+    }
+
+    // Check that an MP3 file decodes the same in parallel as serially
+    if (argc > 2 && std::string(argv[1]) == "--check-decode") {
+        int ranges = argc > 3 ? atoi(argv[3]) : 4;
+        return TuneTutor::Mp3Decoder::checkParallelDecode(
+                std::string(argv[2]), std::max(ranges, 2)) ? 0 : 1;
+    }
+
+    // Track the pitch of audio piped to standard input, writing a record for
+    // each hop to standard output as it goes
+    if (argc > 1 && std::string(argv[1]) == "--pitch-stream") {
+        TuneTutor::PitchStreamOptions options;
+        for (int i = 2; i < argc; i++) {
+            std::string arg(argv[i]);
+            if (arg == "--format" && i + 1 < argc) {
+                std::string format(argv[++i]);
+                if (format == "pcm16") {
+                    options.format = TuneTutor::STREAM_PCM16;
+                } else if (format == "float32") {
+                    options.format = TuneTutor::STREAM_FLOAT32;
+                } else if (format == "mp3") {
+                    options.format = TuneTutor::STREAM_MP3;
+                } else {
+                    std::cerr << "Unknown format " << format
+                        << "; expected pcm16, float32 or mp3" << std::endl;
+                    return 1;
+                }
+            } else if (arg == "--rate" && i + 1 < argc) {
+                options.sampleRate = atoi(argv[++i]);
+            } else if (arg == "--channels" && i + 1 < argc) {
+                options.channels = atoi(argv[++i]);
+            } else if (arg == "--binary") {
+                options.binary = true;
+            } else {
+                std::cerr << "Unknown option " << arg << " for --pitch-stream"
+                    << std::endl;
+                return 1;
+            }
+        }
+        return TuneTutor::streamPitches(stdin, stdout, options);
+    }
+
     ofSetupOpenGL(1100, 700, OF_WINDOW);
     ofApp *app = new ofApp();
-    if (argc > 1) {
-        app->setFilePath(std::string(argv[1]));
-    } else {
-        app->setFilePath("");
+    app->setFilePath("");
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg == "--memory-budget" && i + 1 < argc) {
+            // Megabytes of decoded audio to keep in memory for open tunes
+            app->setMemoryBudget(atoi(argv[++i]));
+        } else if (arg == "--max-resident" && i + 1 < argc) {
+            // Megabytes of decoded audio to keep in memory for one tune;
+            // longer recordings are decoded as they play
+            TuneTutor::SoundFile::setMaxResidentBytes(
+                    (size_t) atoi(argv[++i]) << 20);
+        } else if (arg == "--output-rate" && i + 1 < argc) {
+            // Open the output device at this rate instead of its own
+            app->setOutputRate(atoi(argv[++i]));
+        } else if (arg == "--quality" && i + 1 < argc) {
+            // Use one time stretching quality instead of adapting it to the
+            // load
+            std::string quality(argv[++i]);
+            if (quality == "low") {
+                app->setStretchQuality(TuneTutor::QUALITY_LOW);
+            } else if (quality == "medium") {
+                app->setStretchQuality(TuneTutor::QUALITY_MEDIUM);
+            } else if (quality == "high") {
+                app->setStretchQuality(TuneTutor::QUALITY_HIGH);
+            } else {
+                std::cerr << "Unknown quality " << quality
+                    << "; expected low, medium or high" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--stretcher" && i + 1 < argc) {
+            // Use the lightweight built-in stretcher instead of Rubber Band
+            std::string backend(argv[++i]);
+            if (backend == "native") {
+                app->setStretchBackend(TuneTutor::STRETCH_NATIVE);
+            } else if (backend == "rubberband") {
+                app->setStretchBackend(TuneTutor::STRETCH_RUBBERBAND);
+            } else {
+                std::cerr << "Unknown stretcher " << backend
+                    << "; expected native or rubberband" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--realtime") {
+            // Lock the open tune in memory and run the audio thread at
+            // real-time priority
+            app->setRealtimeMode(true);
+        } else if (arg == "--sample-format" && i + 1 < argc) {
+            // Keep decoded audio as 16-bit integers or half floats to save
+            // memory
+            std::string format(argv[++i]);
+            if (format == "int16") {
+                TuneTutor::SoundFile::setSampleFormat(TuneTutor::SAMPLE_INT16);
+            } else if (format == "half") {
+                TuneTutor::SoundFile::setSampleFormat(
+                        TuneTutor::SAMPLE_FLOAT16);
+            } else if (format == "float32") {
+                TuneTutor::SoundFile::setSampleFormat(
+                        TuneTutor::SAMPLE_FLOAT32);
+            } else {
+                std::cerr << "Unknown sample format " << format
+                    << "; expected float32, int16 or half" << std::endl;
+                return 1;
+            }
+        } else {
+            app->setFilePath(arg);
+        }
     }
     ofRunApp(app);
 }
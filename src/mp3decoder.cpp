@@ -0,0 +1,404 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jobscheduler.h"
+#include "mp3decoder.h"
+
+namespace TuneTutor {
+
+namespace {
+
+std::once_flag mpg123InitFlag;
+
+// Files are decoded in parallel in ranges of at least this many frames, about
+// 47 seconds at 44.1 kHz, so that opening a handle for each range is cheap in
+// comparison
+const int64_t minRangeLength = 1 << 21;
+
+// Entries added to the frame index at a time as it grows, so that it holds
+// every frame and a range can start decoding close to where it must
+const long indexGrowth = 1000;
+
+// The most bytes of main data that a Layer III frame can take from the frames
+// before it through main_data_begin, the bit reservoir
+const off_t maxReservoirBytes = 511;
+
+// The most bytes of a frame that aren't main data: the header, the CRC, and
+// the side information
+const off_t maxFrameOverhead = 4 + 2 + 32;
+
+// Frames before a range whose main data must all be decoded: the two that the
+// IMDCT and the synthesis filter overlap into the range, and one more for the
+// encoder delay, which shifts samples against frames
+const int64_t overlapFrames = 3;
+
+/**
+ * Find the sample at which to start decoding so that the samples from the
+ * given one on come out exactly as they would from a serial decode. The frame
+ * index is walked back from the frames that overlap the start until the bytes
+ * in between are sure to hold as much main data as the bit reservoir can
+ * reach back for, however small the frames are.
+ *
+ * @param start the first sample of the range
+ * @param samplesPerFrame the samples in each MPEG frame
+ * @return the sample to start decoding at, which may be 0
+ */
+int64_t getPrerollStart(int64_t start, int samplesPerFrame,
+        const off_t *index, off_t step, size_t fill) {
+    int64_t frame = start / samplesPerFrame - overlapFrames;
+    if (frame <= 0 || fill == 0 || step <= 0) {
+        return 0;
+    }
+    size_t last = std::min((size_t) (frame / step), fill - 1);
+    size_t first = last;
+    while (first > 0 && index[last] - index[first]
+            - maxFrameOverhead * (off_t) (last - first) * step
+            < maxReservoirBytes) {
+        first--;
+    }
+
+    // Back one more frame, since the encoder delay puts the start of a frame
+    // before its sample position
+    return std::max((int64_t) 0,
+            ((int64_t) first * step - 1) * samplesPerFrame);
+}
+
+/**
+ * Initialize libmpg123 the first time it is needed. mpg123_init() must not be
+ * called concurrently, so this is the only place it is called.
+ */
+void initMpg123() {
+    std::call_once(mpg123InitFlag, [] { mpg123_init(); });
+}
+
+/**
+ * Get the ID3 metadata from an opened mpg123 handle. ID3v2 fields take
+ * precedence over ID3v1 fields.
+ */
+void readMp3Metadata(mpg123_handle *f, SoundFileMetadata &metadata) {
+    mpg123_id3v1 *id3v1;
+    mpg123_id3v2 *id3v2;
+    mpg123_id3(f, &id3v1, &id3v2);
+    if (id3v1 != NULL) {
+        // ID3v1 fields are padded with nulls
+        metadata.title = std::string(id3v1->title,
+                strnlen(id3v1->title, 30));
+        metadata.artist = std::string(id3v1->artist,
+                strnlen(id3v1->artist, 30));
+        metadata.album = std::string(id3v1->album,
+                strnlen(id3v1->album, 30));
+    }
+    if (id3v2 != NULL) {
+        if (id3v2->title != NULL) {
+            metadata.title = id3v2->title->p;
+        }
+        if (id3v2->artist != NULL) {
+            metadata.artist = id3v2->artist->p;
+        }
+        if (id3v2->album != NULL) {
+            metadata.album = id3v2->album->p;
+        }
+    }
+}
+
+}
+
+Mp3Decoder::Mp3Decoder() {
+    handle = NULL;
+    path = "";
+    sampleRate = 0;
+    channels = 0;
+    length = 0;
+    scanned = false;
+}
+
+bool Mp3Decoder::open(std::string path) {
+    int err = MPG123_OK;
+    initMpg123();
+    handle = mpg123_new(NULL, &err);
+    if (handle == NULL) {
+        return false;
+    }
+    mpg123_param(handle, MPG123_ADD_FLAGS,
+            MPG123_FORCE_FLOAT | MPG123_QUIET, 0.);
+    mpg123_param(handle, MPG123_INDEX_SIZE, -indexGrowth, 0.);
+    if ((err = mpg123_open(handle, path.c_str())) != MPG123_OK) {
+        std::cout << "Mp3Decoder: mpg123_open() returned " << err << "\n";
+        return false;
+    }
+
+    // Reading the format parses the tags and the first frame header, which
+    // includes the Xing/Info header if there is one, but decodes nothing
+    long rate;
+    int encoding;
+    if (mpg123_getformat(handle, &rate, &channels, &encoding)
+            != MPG123_OK) {
+        return false;
+    }
+    sampleRate = rate;
+    length = mpg123_length(handle);
+    readMp3Metadata(handle, metadata);
+    this->path = path;
+    return true;
+}
+
+int Mp3Decoder::getSampleRate() const {
+    return sampleRate;
+}
+
+int Mp3Decoder::getChannels() const {
+    return channels;
+}
+
+int64_t Mp3Decoder::getLength() const {
+    return length;
+}
+
+SoundFileMetadata Mp3Decoder::getMetadata() const {
+    return metadata;
+}
+
+void Mp3Decoder::scan() {
+    // The scan reads the frame headers but decodes nothing
+    if (!scanned) {
+        mpg123_scan(handle);
+        length = mpg123_length(handle);
+        scanned = true;
+    }
+}
+
+bool Mp3Decoder::seek(int64_t frame) {
+    return mpg123_seek(handle, (off_t) frame, SEEK_SET) >= 0;
+}
+
+size_t Mp3Decoder::read(float *out, size_t frames) {
+    size_t count = frames * channels;
+    size_t total = 0;
+    while (total < count) {
+        size_t done = 0;
+        int err = mpg123_read(handle, (unsigned char *) (out + total),
+                (count - total) * sizeof(float), &done);
+        total += done / sizeof(float);
+        if (err != MPG123_OK || done == 0) {
+            break;
+        }
+    }
+    return total / channels;
+}
+
+bool Mp3Decoder::decodeAll(SampleBuffer &out, SampleFormat format,
+        int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    int numRanges = std::min((int64_t) numThreads, length / minRangeLength);
+    if (numRanges > 1) {
+        // The ranges are found from the index, and the scan makes the length
+        // exact
+        scan();
+        out.reset(format, length * channels);
+        if (decodeParallel(out, numRanges)) {
+            return true;
+        }
+        std::cout << "Mp3Decoder: parallel decode failed; decoding serially"
+            << std::endl;
+    }
+    return AudioDecoder::decodeAll(out, format, numThreads);
+}
+
+/**
+ * Decode the whole file by splitting it into ranges and decoding them on
+ * separate threads, each with its own handle. The handles are given the index
+ * from this one's scan, so that they don't need to scan the file again.
+ *
+ * @param out the buffer for the whole file, already sized
+ * @return false if any range couldn't be decoded
+ */
+bool Mp3Decoder::decodeParallel(SampleBuffer &out, int numRanges) {
+    off_t *index;
+    off_t step;
+    size_t fill;
+    if (mpg123_index(handle, &index, &step, &fill) != MPG123_OK) {
+        return false;
+    }
+
+    int samplesPerFrame = mpg123_spf(handle);
+    if (samplesPerFrame <= 0) {
+        return false;
+    }
+
+    std::atomic<bool> ok(true);
+    JobScheduler scheduler(numRanges);
+    for (int i = 0; i < numRanges; i++) {
+        int64_t start = length * i / numRanges;
+        int64_t end = length * (i + 1) / numRanges;
+        scheduler.submit([&, start, end]() {
+            Mp3Decoder range;
+            if (!range.open(path)) {
+                ok = false;
+                return;
+            }
+            mpg123_set_index(range.handle, index, step, fill);
+            int64_t from = getPrerollStart(start, samplesPerFrame, index,
+                    step, fill);
+            std::vector<float> overlap((start - from) * channels);
+            if (from < start && range.readAt(from, start - from,
+                        &overlap[0]) != (size_t) (start - from)) {
+                ok = false;
+                return;
+            }
+            if (range.decodeInto(out, start, end) != end - start) {
+                ok = false;
+            }
+        });
+    }
+    scheduler.wait();
+    return ok;
+}
+
+bool Mp3Decoder::checkParallelDecode(std::string path, int numRanges) {
+    Mp3Decoder serial;
+    Mp3Decoder parallel;
+    if (!serial.open(path) || !parallel.open(path)) {
+        std::cout << "Mp3Decoder: can't open " << path << std::endl;
+        return false;
+    }
+    serial.scan();
+    parallel.scan();
+    SampleBuffer expected;
+    SampleBuffer actual;
+    actual.reset(SAMPLE_FLOAT32, parallel.length * parallel.channels);
+    if (!serial.AudioDecoder::decodeAll(expected, SAMPLE_FLOAT32, 1)
+            || !parallel.decodeParallel(actual, numRanges)) {
+        std::cout << "Mp3Decoder: can't decode " << path << std::endl;
+        return false;
+    }
+    if (expected.size() != actual.size()) {
+        std::cout << "Serial decode has " << expected.size()
+            << " samples, parallel decode " << actual.size() << std::endl;
+        return false;
+    }
+
+    // Compare a block at a time, so that neither decode is copied whole
+    const size_t blockSamples = 1 << 16;
+    std::vector<float> a(blockSamples);
+    std::vector<float> b(blockSamples);
+    size_t mismatched = 0;
+    int64_t firstMismatch = -1;
+    for (size_t i = 0; i < expected.size(); i += blockSamples) {
+        size_t n = std::min(blockSamples, expected.size() - i);
+        expected.load(i, n, &a[0]);
+        actual.load(i, n, &b[0]);
+        for (size_t j = 0; j < n; j++) {
+            if (a[j] != b[j]) {
+                if (firstMismatch < 0) {
+                    firstMismatch = (i + j) / parallel.channels;
+                }
+                mismatched++;
+            }
+        }
+    }
+    if (mismatched > 0) {
+        std::cout << mismatched << " samples differ between the serial and "
+            << "parallel decodes of " << path << ", from frame "
+            << firstMismatch << std::endl;
+        return false;
+    }
+    std::cout << "Serial and parallel decodes of " << path
+        << " match in all " << expected.size() << " samples, in "
+        << numRanges << " ranges" << std::endl;
+    return true;
+}
+
+Mp3Decoder::~Mp3Decoder() {
+    if (handle != NULL) {
+        mpg123_close(handle);
+        mpg123_delete(handle);
+    }
+}
+
+Mp3StreamDecoder::Mp3StreamDecoder() {
+    handle = NULL;
+    sampleRate = 0;
+    channels = 0;
+}
+
+bool Mp3StreamDecoder::open() {
+    int err = MPG123_OK;
+    initMpg123();
+    handle = mpg123_new(NULL, &err);
+    if (handle == NULL) {
+        return false;
+    }
+    mpg123_param(handle, MPG123_ADD_FLAGS,
+            MPG123_FORCE_FLOAT | MPG123_QUIET, 0.);
+    if ((err = mpg123_open_feed(handle)) != MPG123_OK) {
+        std::cerr << "Mp3StreamDecoder: mpg123_open_feed() returned " << err
+            << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Mp3StreamDecoder::feed(const unsigned char *data, size_t size) {
+    return mpg123_feed(handle, data, size) == MPG123_OK;
+}
+
+size_t Mp3StreamDecoder::read(float *out, size_t frames) {
+    while (true) {
+        size_t done = 0;
+        size_t bytes = frames * std::max(channels, 1) * sizeof(float);
+        int err = mpg123_read(handle, (unsigned char *) out, bytes, &done);
+        if (err == MPG123_NEW_FORMAT) {
+            long rate;
+            int encoding;
+            mpg123_getformat(handle, &rate, &channels, &encoding);
+            sampleRate = rate;
+            continue;
+        }
+        if (channels == 0 || (err != MPG123_OK && done == 0)) {
+            // MPG123_NEED_MORE, or a broken frame that will be skipped
+            return 0;
+        }
+        return done / sizeof(float) / channels;
+    }
+}
+
+int Mp3StreamDecoder::getSampleRate() const {
+    return sampleRate;
+}
+
+int Mp3StreamDecoder::getChannels() const {
+    return channels;
+}
+
+Mp3StreamDecoder::~Mp3StreamDecoder() {
+    if (handle != NULL) {
+        mpg123_close(handle);
+        mpg123_delete(handle);
+    }
+}
+
+}
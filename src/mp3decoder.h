@@ -0,0 +1,123 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+extern "C" {
+#include <mpg123.h>
+}
+
+#include "audiodecoder.h"
+
+namespace TuneTutor {
+
+/**
+ * The Mp3Decoder class decodes MP3 files using libmpg123. A long file is
+ * decoded on several threads at once: the file is scanned to build an index
+ * of its frames, and each thread decodes one range of it with a handle of its
+ * own that seeks through the index.
+ */
+class Mp3Decoder : public AudioDecoder {
+
+    public:
+        Mp3Decoder();
+        ~Mp3Decoder();
+
+        bool open(std::string path);
+        int getSampleRate() const;
+        int getChannels() const;
+        int64_t getLength() const;
+        SoundFileMetadata getMetadata() const;
+        void scan();
+        bool decodeAll(SampleBuffer &out, SampleFormat format,
+                int numThreads);
+
+        /**
+         * Decode a file serially, and then in parallel in the given number of
+         * ranges however short it is, and report on standard output whether
+         * the two decodes are identical, as they should be.
+         *
+         * @param path the full path to the MP3 file
+         * @param numRanges the number of ranges to decode in parallel
+         * @return true if every sample matched
+         */
+        static bool checkParallelDecode(std::string path, int numRanges);
+
+    protected:
+        bool seek(int64_t frame);
+        size_t read(float *out, size_t frames);
+
+    private:
+        mpg123_handle *handle;
+        std::string path;
+        int sampleRate;
+        int channels;
+        int64_t length;
+        SoundFileMetadata metadata;
+        bool scanned;
+
+        bool decodeParallel(SampleBuffer &out, int numRanges);
+};
+
+/**
+ * The Mp3StreamDecoder class decodes MP3 data as it arrives, such as from a
+ * pipe, using libmpg123's feed interface. Nothing is buffered beyond what
+ * libmpg123 needs to decode the next frame, so a stream of any length can be
+ * decoded in constant memory.
+ */
+class Mp3StreamDecoder {
+
+    public:
+        Mp3StreamDecoder();
+        ~Mp3StreamDecoder();
+
+        /** @return false if libmpg123 couldn't be set up */
+        bool open();
+
+        /**
+         * @param data the next bytes of the stream
+         * @param size the number of bytes
+         * @return false if the data couldn't be accepted
+         */
+        bool feed(const unsigned char *data, size_t size);
+
+        /**
+         * Decode frames from the data fed so far.
+         *
+         * @param out the buffer for the samples, interleaved by channel, with
+         *        room for two channels, the most an MP3 stream can have
+         * @param frames the most frames to decode
+         * @return the number of frames decoded, or 0 if more data is needed
+         */
+        size_t read(float *out, size_t frames);
+
+        /**
+         * @return the sample rate and number of channels, which are 0 until
+         *         the first frame has been decoded, and may change between
+         *         reads if the stream changes format
+         */
+        int getSampleRate() const;
+        int getChannels() const;
+
+    private:
+        mpg123_handle *handle;
+        int sampleRate;
+        int channels;
+};
+
+}
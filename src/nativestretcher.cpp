@@ -0,0 +1,496 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "nativestretcher.h"
+#include "realtime.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+// Limits on the stretch of the first stage and on the pitch scale. Within
+// them, and fed no more than getSamplesRequired() at a time, the input holds
+// at most hop / minStretch frames plus a window, and one hop resamples to at
+// most hop / minPitchScale output frames, so neither outgrows the room
+// reserved for it; at most, the stretch is still under one hop per input
+// frame, so every hop consumes input
+const double minStretch = 1.0 / 16;
+const double maxStretch = 256;
+const double minPitchScale = 1.0 / 16;
+
+// Room reserved in the buffers, so that they don't grow on the audio thread
+const size_t reservedFrames = 1 << 14;
+
+/** Remove the first count elements of a buffer */
+void dropFront(std::vector<float> &buffer, size_t count) {
+    buffer.erase(buffer.begin(),
+            buffer.begin() + std::min(count, buffer.size()));
+}
+
+/** @return the phase wrapped to the range -pi to pi */
+double wrapPhase(double phase) {
+    return phase - 2 * pi * std::floor(phase / (2 * pi) + 0.5);
+}
+
+/**
+ * Dot product of two vectors. The eight partial sums are independent, so the
+ * compiler can keep them in one SIMD register without reordering the sums.
+ */
+float dot(const float *a, const float *b, int n) {
+    float sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int j = 0; j < 8; j++) {
+            sums[j] += a[i + j] * b[i + j];
+        }
+    }
+    float total = 0;
+    for (int j = 0; j < 8; j++) {
+        total += sums[j];
+    }
+    for (; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+/**
+ * Cubic (Catmull-Rom) interpolation at fraction t of the way from x0 to x1.
+ */
+float interpolate(float xm1, float x0, float x1, float x2, float t) {
+    float c1 = 0.5f * (x1 - xm1);
+    float c2 = xm1 - 2.5f * x0 + 2 * x1 - 0.5f * x2;
+    float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+}
+
+const int NativeStretcher::wsolaLength;
+const int NativeStretcher::wsolaTolerance;
+const int NativeStretcher::fftLength;
+const int NativeStretcher::hop;
+
+NativeStretcher::NativeStretcher(int channels) {
+    this->channels = std::min(std::max(channels, 1), 2);
+    timeRatio = 1;
+    pitchScale = 1;
+    rateRatio = 1;
+    vocoding = false;
+
+    // Periodic Hann windows. WSOLA frames overlapping by half sum to one;
+    // phase vocoder frames, windowed twice and overlapping by three quarters,
+    // sum to 1.5.
+    wsolaWindow.resize(wsolaLength);
+    for (int i = 0; i < wsolaLength; i++) {
+        wsolaWindow[i] = 0.5 - 0.5 * std::cos(2 * pi * i / wsolaLength);
+    }
+    fftWindow.resize(fftLength);
+    for (int i = 0; i < fftLength; i++) {
+        fftWindow[i] = 0.5 - 0.5 * std::cos(2 * pi * i / fftLength);
+    }
+
+    cosTable.resize(fftLength / 2);
+    sinTable.resize(fftLength / 2);
+    for (int i = 0; i < fftLength / 2; i++) {
+        cosTable[i] = std::cos(2 * pi * i / fftLength);
+        sinTable[i] = std::sin(2 * pi * i / fftLength);
+    }
+    int bits = 0;
+    while ((1 << bits) < fftLength) {
+        bits++;
+    }
+    bitReverse.resize(fftLength);
+    for (int i = 0; i < fftLength; i++) {
+        int reversed = 0;
+        for (int b = 0; b < bits; b++) {
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        bitReverse[i] = reversed;
+    }
+    re.resize(fftLength);
+    im.resize(fftLength);
+
+    for (int c = 0; c < 2; c++) {
+        input[c].reserve(reservedFrames);
+        stretched[c].reserve(reservedFrames);
+        output[c].reserve(reservedFrames);
+        overlap[c].resize(fftLength);
+        lastPhase[c].resize(fftLength / 2 + 1);
+        synthPhase[c].resize(fftLength / 2 + 1);
+        specRe[c].resize(fftLength / 2 + 1);
+        specIm[c].resize(fftLength / 2 + 1);
+    }
+    mono.reserve(reservedFrames);
+
+    reset();
+}
+
+void NativeStretcher::setTimeRatio(double ratio) {
+    timeRatio = ratio;
+}
+
+void NativeStretcher::setPitchScale(double scale) {
+    pitchScale = std::max(scale, minPitchScale);
+}
+
+void NativeStretcher::setRateRatio(double ratio) {
+    rateRatio = ratio;
+}
+
+void NativeStretcher::reset() {
+    for (int c = 0; c < 2; c++) {
+        input[c].clear();
+        std::fill(overlap[c].begin(), overlap[c].end(), 0.0f);
+
+        // One frame before the first, for the interpolation
+        stretched[c].assign(1, 0.0f);
+        output[c].clear();
+    }
+    mono.clear();
+    inputPos = 0;
+    lastFrame = 0;
+    haveLastFrame = false;
+    resamplePos = 1;
+}
+
+/**
+ * The buffers never grow beyond the room reserved for them as long as the
+ * input comes in blocks no larger than getSamplesRequired(), so locking their
+ * capacity covers every page they will use.
+ */
+bool NativeStretcher::lockMemory() {
+    bool ok = TuneTutor::lockMemory(mono)
+        && TuneTutor::lockMemory(wsolaWindow)
+        && TuneTutor::lockMemory(fftWindow)
+        && TuneTutor::lockMemory(cosTable)
+        && TuneTutor::lockMemory(sinTable)
+        && TuneTutor::lockMemory(bitReverse)
+        && TuneTutor::lockMemory(re)
+        && TuneTutor::lockMemory(im);
+    for (int c = 0; ok && c < 2; c++) {
+        ok = TuneTutor::lockMemory(input[c])
+            && TuneTutor::lockMemory(overlap[c])
+            && TuneTutor::lockMemory(stretched[c])
+            && TuneTutor::lockMemory(output[c])
+            && TuneTutor::lockMemory(lastPhase[c])
+            && TuneTutor::lockMemory(synthPhase[c])
+            && TuneTutor::lockMemory(specRe[c])
+            && TuneTutor::lockMemory(specIm[c]);
+    }
+    return ok;
+}
+
+void NativeStretcher::unlockMemory() {
+    TuneTutor::unlockMemory(mono);
+    TuneTutor::unlockMemory(wsolaWindow);
+    TuneTutor::unlockMemory(fftWindow);
+    TuneTutor::unlockMemory(cosTable);
+    TuneTutor::unlockMemory(sinTable);
+    TuneTutor::unlockMemory(bitReverse);
+    TuneTutor::unlockMemory(re);
+    TuneTutor::unlockMemory(im);
+    for (int c = 0; c < 2; c++) {
+        TuneTutor::unlockMemory(input[c]);
+        TuneTutor::unlockMemory(overlap[c]);
+        TuneTutor::unlockMemory(stretched[c]);
+        TuneTutor::unlockMemory(output[c]);
+        TuneTutor::unlockMemory(lastPhase[c]);
+        TuneTutor::unlockMemory(synthPhase[c]);
+        TuneTutor::unlockMemory(specRe[c]);
+        TuneTutor::unlockMemory(specIm[c]);
+    }
+}
+
+void NativeStretcher::process(const float *const *in, size_t frames) {
+    for (int c = 0; c < channels; c++) {
+        input[c].insert(input[c].end(), in[c], in[c] + frames);
+    }
+    for (size_t i = 0; i < frames; i++) {
+        mono.push_back(channels == 1 ? in[0][i] : in[0][i] + in[1][i]);
+    }
+    while (stretchHop()) {
+        resample();
+    }
+}
+
+size_t NativeStretcher::getSamplesRequired() const {
+    bool transposing = std::fabs(pitchScale * rateRatio - 1) > 1e-6;
+    int window = transposing ? fftLength : wsolaTolerance + wsolaLength;
+    return std::max((int) inputPos + window - (int) mono.size(), 1);
+}
+
+int NativeStretcher::available() const {
+    return output[0].size();
+}
+
+size_t NativeStretcher::retrieve(float *const *out, size_t frames) {
+    frames = std::min(frames, output[0].size());
+    for (int c = 0; c < channels; c++) {
+        std::copy(output[c].begin(), output[c].begin() + frames, out[c]);
+        dropFront(output[c], frames);
+    }
+    return frames;
+}
+
+/**
+ * Stretch one hop of audio, if there is enough input for it.
+ *
+ * @return false if more input is needed
+ */
+bool NativeStretcher::stretchHop() {
+    // Switching between WSOLA and the phase vocoder starts afresh
+    bool transposing = std::fabs(pitchScale * rateRatio - 1) > 1e-6;
+    if (transposing != vocoding) {
+        vocoding = transposing;
+        haveLastFrame = false;
+        for (int c = 0; c < channels; c++) {
+            std::fill(overlap[c].begin(), overlap[c].end(), 0.0f);
+        }
+    }
+
+    // The first stage stretches by the time ratio and by the pitch scale, so
+    // that resampling by the pitch scale brings the duration back
+    double stretch = std::min(std::max(timeRatio * pitchScale, minStretch),
+            maxStretch);
+    int nominal = (int) inputPos;
+    int size = mono.size();
+    int start;
+    if (vocoding) {
+        if (nominal + fftLength > size) {
+            return false;
+        }
+        start = nominal;
+        vocodeFrame(start, haveLastFrame ? start - lastFrame : -1);
+    } else {
+        if (nominal + wsolaTolerance + wsolaLength > size) {
+            return false;
+        }
+        start = haveLastFrame ? findBestOffset(nominal) : nominal;
+        for (int c = 0; c < channels; c++) {
+            const float *in = &input[c][start];
+            float *out = &overlap[c][0];
+            for (int i = 0; i < wsolaLength; i++) {
+                out[i] += wsolaWindow[i] * in[i];
+            }
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        stretched[c].insert(stretched[c].end(), overlap[c].begin(),
+                overlap[c].begin() + hop);
+        std::copy(overlap[c].begin() + hop, overlap[c].end(),
+                overlap[c].begin());
+        std::fill(overlap[c].end() - hop, overlap[c].end(), 0.0f);
+    }
+    lastFrame = start;
+    haveLastFrame = true;
+    inputPos += hop / stretch;
+
+    // Drop the input that no later frame can reach: WSOLA compares against
+    // the continuation of the last frame, and searches either side of the
+    // next nominal position
+    int unneeded = vocoding ? std::min(lastFrame, (int) inputPos)
+        : std::min(lastFrame + hop, (int) inputPos - wsolaTolerance);
+    if (unneeded > 0) {
+        for (int c = 0; c < channels; c++) {
+            dropFront(input[c], unneeded);
+        }
+        dropFront(mono, unneeded);
+        inputPos -= unneeded;
+        lastFrame -= unneeded;
+    }
+    return true;
+}
+
+/**
+ * Find the start of the WSOLA frame near the nominal position whose first
+ * half best matches the natural continuation of the last frame, so that they
+ * overlap without cancelling. The search is coarse first, then fine around
+ * the best coarse match.
+ *
+ * @return the start of the frame
+ */
+int NativeStretcher::findBestOffset(int nominal) {
+    const int length = wsolaLength - hop;
+    const float *reference = &mono[lastFrame + hop];
+    int lowest = std::max(-wsolaTolerance, -nominal);
+    int best = lowest;
+    float bestScore = -1e30f;
+    int from = lowest;
+    int to = wsolaTolerance;
+    for (int pass = 0; pass < 2; pass++) {
+        int step = pass == 0 ? 4 : 1;
+        for (int k = from; k <= to; k += step) {
+            const float *candidate = &mono[nominal + k];
+            float energy = dot(candidate, candidate, length);
+            float score = dot(reference, candidate, length)
+                / std::sqrt(energy + 1e-9f);
+            if (score > bestScore) {
+                bestScore = score;
+                best = k;
+            }
+        }
+        from = std::max(lowest, best - 3);
+        to = std::min(wsolaTolerance, best + 3);
+    }
+    return nominal + best;
+}
+
+/**
+ * Add one phase vocoder frame to the overlap. Each bin's phase advances by
+ * its measured frequency over the synthesis hop, which keeps the pitch while
+ * the frames are spaced differently than they were in the input.
+ *
+ * @param start the start of the analysis frame in the input
+ * @param advance the distance from the last analysis frame, or -1 if there
+ *        was none, in which case the phases are taken as they are
+ */
+void NativeStretcher::vocodeFrame(int start, int advance) {
+    // A stereo pair is packed into the real and imaginary parts of one FFT
+    for (int i = 0; i < fftLength; i++) {
+        re[i] = fftWindow[i] * input[0][start + i];
+        im[i] = channels > 1 ? fftWindow[i] * input[1][start + i] : 0.0f;
+    }
+    fft(false);
+
+    const int bins = fftLength / 2 + 1;
+    for (int k = 0; k < bins; k++) {
+        int mirror = (fftLength - k) & (fftLength - 1);
+        if (channels == 1) {
+            specRe[0][k] = re[k];
+            specIm[0][k] = im[k];
+        } else {
+            specRe[0][k] = 0.5f * (re[k] + re[mirror]);
+            specIm[0][k] = 0.5f * (im[k] - im[mirror]);
+            specRe[1][k] = 0.5f * (im[k] + im[mirror]);
+            specIm[1][k] = 0.5f * (re[mirror] - re[k]);
+        }
+    }
+
+    for (int c = 0; c < channels; c++) {
+        for (int k = 0; k < bins; k++) {
+            double omega = 2 * pi * k / fftLength;
+            float magnitude = std::sqrt(specRe[c][k] * specRe[c][k]
+                    + specIm[c][k] * specIm[c][k]);
+            float phase = std::atan2(specIm[c][k], specRe[c][k]);
+            double synth = synthPhase[c][k];
+            if (advance < 0) {
+                synth = phase;
+            } else if (advance == 0) {
+                synth += omega * hop;
+            } else {
+                double deviation = wrapPhase(phase - lastPhase[c][k]
+                        - omega * advance);
+                synth += (omega + deviation / advance) * hop;
+            }
+            synth = wrapPhase(synth);
+            lastPhase[c][k] = phase;
+            synthPhase[c][k] = synth;
+            specRe[c][k] = magnitude * std::cos(synth);
+            specIm[c][k] = magnitude * std::sin(synth);
+        }
+    }
+
+    // Repack both channels, with the mirrored half of each spectrum
+    // conjugated, so that the inverse FFT gives them as real and imaginary
+    // parts
+    for (int k = 0; k < fftLength; k++) {
+        int bin = k < bins ? k : fftLength - k;
+        float sign = k < bins ? 1.0f : -1.0f;
+        float leftRe = specRe[0][bin];
+        float leftIm = sign * specIm[0][bin];
+        float rightRe = channels > 1 ? specRe[1][bin] : 0.0f;
+        float rightIm = channels > 1 ? sign * specIm[1][bin] : 0.0f;
+        re[k] = leftRe - rightIm;
+        im[k] = leftIm + rightRe;
+    }
+    fft(true);
+
+    float scale = 1.0f / (fftLength * 1.5f);
+    for (int i = 0; i < fftLength; i++) {
+        overlap[0][i] += re[i] * fftWindow[i] * scale;
+    }
+    if (channels > 1) {
+        for (int i = 0; i < fftLength; i++) {
+            overlap[1][i] += im[i] * fftWindow[i] * scale;
+        }
+    }
+}
+
+/**
+ * Resample the stretched audio into the output, stepping through it by the
+ * pitch scale. There is no anti-aliasing filter, so shifting up by a large
+ * interval adds some aliasing to the highest frequencies.
+ */
+void NativeStretcher::resample() {
+    int size = stretched[0].size();
+    while (resamplePos + 2 < size) {
+        int i = (int) resamplePos;
+        float t = resamplePos - i;
+        for (int c = 0; c < channels; c++) {
+            const float *x = &stretched[c][i];
+            output[c].push_back(interpolate(x[-1], x[0], x[1], x[2], t));
+        }
+        resamplePos += pitchScale;
+    }
+    int used = (int) resamplePos - 1;
+    if (used > 0) {
+        for (int c = 0; c < channels; c++) {
+            dropFront(stretched[c], used);
+        }
+        resamplePos -= used;
+    }
+}
+
+/**
+ * In-place radix-2 FFT of re and im. The inverse is not scaled.
+ */
+void NativeStretcher::fft(bool inverse) {
+    for (int i = 0; i < fftLength; i++) {
+        int j = bitReverse[i];
+        if (j > i) {
+            std::swap(re[i], re[j]);
+            std::swap(im[i], im[j]);
+        }
+    }
+    float sign = inverse ? 1.0f : -1.0f;
+    for (int size = 2; size <= fftLength; size *= 2) {
+        int half = size / 2;
+        int step = fftLength / size;
+        for (int start = 0; start < fftLength; start += size) {
+            for (int k = 0; k < half; k++) {
+                float wr = cosTable[k * step];
+                float wi = sign * sinTable[k * step];
+                int a = start + k;
+                int b = a + half;
+                float tr = re[b] * wr - im[b] * wi;
+                float ti = re[b] * wi + im[b] * wr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+}
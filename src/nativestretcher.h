@@ -0,0 +1,169 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * The NativeStretcher class is a lightweight alternative to the
+ * RubberBandStretcher, for machines that can't run it in real time, with the
+ * same streaming interface. It works in two stages. The first stretches the
+ * audio in time without changing its pitch: by WSOLA (waveform similarity
+ * overlap-add) when the tune isn't transposed, and by a phase vocoder when it
+ * is. The second resamples the stretched audio, which shifts its pitch and
+ * converts it to the output sample rate.
+ *
+ * CPU budget, per second of stereo audio played at normal speed, measured on
+ * one core of an x86 server processor: WSOLA takes about 4 ms, most of it in
+ * the search for the best-matching segment, and the phase vocoder about 30
+ * ms, most of it in the per-bin trigonometry; the two channels of a stereo
+ * file share each FFT. The cost of both scales with the number of stretched
+ * frames, so it falls as the speed rises, down to about 1 ms for WSOLA at
+ * 400%.
+ */
+class NativeStretcher {
+
+    public:
+        /** @param channels the number of channels, 1 or 2 */
+        NativeStretcher(int channels);
+
+        /**
+         * @param ratio the ratio of output duration to input duration, as
+         *        for RubberBandStretcher. Together with the pitch scale it
+         *        stretches the audio by 1/16 to 256 times at most.
+         */
+        void setTimeRatio(double ratio);
+
+        /**
+         * @param scale the ratio of output frequency to input frequency,
+         *        including any sample rate conversion, as for
+         *        RubberBandStretcher; it is held to at least 1/16
+         */
+        void setPitchScale(double scale);
+
+        /**
+         * Set how much of the pitch scale is sample rate conversion, so that
+         * audio that isn't transposed can be stretched by WSOLA.
+         *
+         * @param ratio the output sample rate divided by the input sample rate
+         */
+        void setRateRatio(double ratio);
+
+        /** Discard all buffered audio */
+        void reset();
+
+        /**
+         * @param input one buffer of frames per channel
+         * @param frames the number of frames in each buffer, which must be no
+         *        more than getSamplesRequired() for the buffers to keep to
+         *        the room reserved for them
+         */
+        void process(const float *const *input, size_t frames);
+
+        /**
+         * @return the number of input frames needed before process() can
+         *         produce more output, at least one
+         */
+        size_t getSamplesRequired() const;
+
+        /** @return the number of output frames ready to be retrieved */
+        int available() const;
+
+        /**
+         * @param output one buffer per channel for the frames
+         * @param frames the most frames to retrieve
+         * @return the number of frames retrieved
+         */
+        size_t retrieve(float *const *output, size_t frames);
+
+        /**
+         * Lock all the buffers in RAM, with lockMemory() from realtime.h.
+         *
+         * @return true if every buffer was locked
+         */
+        bool lockMemory();
+
+        /** Undo lockMemory() */
+        void unlockMemory();
+
+    private:
+        static const int wsolaLength = 1024;
+        static const int wsolaTolerance = 256;
+        static const int fftLength = 2048;
+        static const int hop = 512;
+
+        int channels;
+        double timeRatio;
+        double pitchScale;
+        double rateRatio;
+
+        // True while the phase vocoder is in use rather than WSOLA
+        bool vocoding;
+
+        // Input not yet consumed, per channel, and its mono mix for WSOLA
+        std::vector<float> input[2];
+        std::vector<float> mono;
+
+        // Position in the input of the next analysis frame, and the start of
+        // the last one, which may be before the start of the input kept;
+        // there has been none since a reset or a change of method unless
+        // haveLastFrame is true
+        double inputPos;
+        int lastFrame;
+        bool haveLastFrame;
+
+        // Overlap-add of the synthesized frames, per channel
+        std::vector<float> overlap[2];
+
+        // Stretched audio waiting to be resampled, per channel, and the
+        // position in it of the next output frame
+        std::vector<float> stretched[2];
+        double resamplePos;
+
+        // Output ready to be retrieved, per channel
+        std::vector<float> output[2];
+
+        std::vector<float> wsolaWindow;
+        std::vector<float> fftWindow;
+
+        // FFT tables and work space
+        std::vector<float> cosTable;
+        std::vector<float> sinTable;
+        std::vector<int> bitReverse;
+        std::vector<float> re;
+        std::vector<float> im;
+
+        // Phase vocoder state per channel: the analysis phase of each bin in
+        // the last frame, and its synthesis phase
+        std::vector<float> lastPhase[2];
+        std::vector<float> synthPhase[2];
+
+        // Spectra of each channel, split out of the shared FFT
+        std::vector<float> specRe[2];
+        std::vector<float> specIm[2];
+
+        bool stretchHop();
+        int findBestOffset(int nominal);
+        void vocodeFrame(int start, int advance);
+        void resample();
+        void fft(bool inverse);
+};
+
+}
@@ -29,6 +29,7 @@
 #include <cstdio>
 #include <cstring>
 
+#include "RtAudio.h"
 #include "ofxXmlSettings.h"
 
 #include "ofApp.h"
@@ -52,20 +53,31 @@ void ofApp::setup() {
     transpose = 0;
     tuning = 0;
     playing = false;
-    playbackDelayed = false;
-    silentSamplesPlayed = 0;
     playMode = PLAYMODE_PLAY_TO_END;
 
     markBeingDragged = NULL;
 
-    // Set up audio
+    // Set up audio. The device stays at its own rate, and each tune's time
+    // stretcher converts to it.
     bufferSize = 512;
     sampleRate = 44100;
     channels = 2;
-    soundStream.setup(this, channels, 0, sampleRate, bufferSize, 4);
+    outputRate = requestedOutputRate > 0
+        ? requestedOutputRate : getNativeOutputRate();
+    ofLog() << "Output sample rate: " << outputRate;
+    soundStream.setup(this, channels, 0, outputRate, bufferSize, 4);
     soundStream.stop();
+    playback.setOutputRate(outputRate);
 
+    session = NULL;
+    numFrames = 0;
     stretcher = NULL;
+    scrubber = NULL;
+    cueCache = NULL;
+    realtimePriority = 0;
+    realtimePriorityReported = false;
+    scrubbing = false;
+    scrubbed = false;
 
     minPitch = pitchRangeMin;
     maxPitch = pitchRangeMax;
@@ -73,6 +85,10 @@ void ofApp::setup() {
     pitchDetector = NULL;
     pitchesDetected = false;
 
+    showProfiler = false;
+
+    lastAutosaveTime = 0;
+
     /***************************************************************************
      * Set up GUI from top to bottom, including ofxUI widgets and elements drawn
      * using the draw() method.
@@ -89,6 +105,7 @@ void ofApp::setup() {
     
     topGui->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
     openFileButton = topGui->addLabelButton("Open File", false);
+    compareFileButton = topGui->addLabelButton("Compare", false);
 
     topGui->addSpacer(padding, 0);
 
@@ -114,7 +131,8 @@ void ofApp::setup() {
 
     topGui->addSpacer(padding, 0);
 
-    topGui->addSlider("Playback Delay", 0.0, 2.0, &playbackDelay);
+    playbackDelaySlider = topGui->addSlider(
+            "Playback Delay", 0.0, 2.0, &playbackDelay);
     zoomSlider = topGui->addSlider("Zoom", 0.25, 4.0, &zoom);
     topGui->setWidgetPosition(OFX_UI_WIDGET_POSITION_DOWN);
     pitchRangeSlider = topGui->addRangeSlider("Pitch Range",
@@ -125,7 +143,16 @@ void ofApp::setup() {
     topGui->getRect()->setWidth(ofGetWidth());
     ofAddListener(topGui->newGUIEvent, this, &ofApp::guiEvent);
 
-    markStripTop = topGui->getRect()->getHeight() + padding;
+    float tabBarY = topGui->getRect()->getHeight() + padding;
+    tabBar = new ofxUICanvas(0, tabBarY, 10, 10);
+    configureCanvas(tabBar);
+    tabBar->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
+    updateTabs();
+    tabBar->autoSizeToFitWidgets();
+    tabBar->getRect()->setWidth(ofGetWidth());
+    ofAddListener(tabBar->newGUIEvent, this, &ofApp::guiEventTabs);
+
+    markStripTop = tabBarY + tabBar->getRect()->getHeight() + padding;
     markStripBottom = markStripTop + markHeight;
 
     selectionStripTop = markStripTop + markHeight + 1;
@@ -157,7 +184,7 @@ void ofApp::setup() {
 
     midGui->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
     speedSlider = midGui->addIntSlider(
-            "Speed (%)", 10, 100, &speed, ofGetWidth()/3 - padding, 24);
+            "Speed (%)", 10, 400, &speed, ofGetWidth()/3 - padding, 24);
     transposeSlider = midGui->addIntSlider(
             "Transpose (semitones)", -12, 12, &transpose,
             ofGetWidth()/3 - padding, 24);
@@ -169,18 +196,20 @@ void ofApp::setup() {
     ofAddListener(midGui->newGUIEvent, this, &ofApp::guiEvent);
 
     float markTableGuiY = midGuiY + midGui->getRect()->getHeight() + padding;
-    ofxUICanvas *markTableGui = new ofxUICanvas();
+    markTableGui = new ofxUICanvas();
     markTableGui->getRect()->setY(markTableGuiY);
     configureCanvas(markTableGui);
     markTableGui->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
     markTableGui->addLabel("Marks", OFX_UI_FONT_LARGE);
     addMarkButton = markTableGui->addLabelButton("Add Mark", false, false);
+    findSimilarButton = markTableGui->addLabelButton(
+            "Find Similar", false, false);
     markTableGui->autoSizeToFitWidgets();
     ofAddListener(markTableGui->newGUIEvent, this, &ofApp::guiEventMarkTable);
     
     float markTableHeaderY = markTableGuiY +
         markTableGui->getRect()->getHeight() + padding; 
-    ofxUICanvas *markTableHeader = new ofxUICanvas(0, markTableHeaderY, 10, 10);
+    markTableHeader = new ofxUICanvas(0, markTableHeaderY, 10, 10);
     configureCanvas(markTableHeader);
     markTableHeader->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
     ofxUILabel *headerLabel;
@@ -267,10 +296,59 @@ void ofApp::setup() {
     textInput->getRect()->setX(150);
 
     metadataTable->autoSizeToFitWidgets();
-    rect->setHeight(ofGetHeight() - metadataTableY);
+    rect->setWidth(ofGetWidth() - metadataTableX);
 
     ofAddListener(metadataTable->newGUIEvent, this, &ofApp::guiEvent);
 
+    float libraryGuiY = metadataTableY + rect->getHeight() + padding;
+    libraryGui = new ofxUICanvas();
+    libraryGui->getRect()->setX(metadataTableX);
+    libraryGui->getRect()->setY(libraryGuiY);
+    configureCanvas(libraryGui);
+    libraryGui->setWidgetPosition(OFX_UI_WIDGET_POSITION_RIGHT);
+    libraryGui->addLabel("Library", OFX_UI_FONT_LARGE);
+    scanFolderButton = libraryGui->addLabelButton("Scan Folder", false, false);
+    findPhraseButton = libraryGui->addLabelButton("Find Phrase", false, false);
+    libraryStatusLabel = libraryGui->addLabel(
+            "libraryStatus", "", OFX_UI_FONT_SMALL);
+    librarySearchInput = new ofxUITextInput("librarySearch", "", 400, 0, 0, 0);
+    libraryGui->addWidgetSouthOf(librarySearchInput, "Library", false);
+    libraryGui->autoSizeToFitWidgets();
+    libraryGui->getRect()->setWidth(ofGetWidth() - metadataTableX);
+    ofAddListener(libraryGui->newGUIEvent, this, &ofApp::guiEventLibrary);
+
+    float libraryResultsY = libraryGuiY + libraryGui->getRect()->getHeight()
+        + padding;
+    libraryResults = new ofxUIScrollableCanvas(
+            metadataTableX, libraryResultsY,
+            ofGetWidth() - metadataTableX,
+            ofGetHeight() - libraryResultsY - padding);
+    configureCanvas(libraryResults);
+    libraryResults->setScrollableDirections(false, true);
+    libraryResults->getSRect()->setWidth(ofGetWidth() - metadataTableX);
+    libraryResults->getSRect()->setHeight(ofGetHeight() - libraryResultsY);
+    ofAddListener(libraryResults->newGUIEvent, this, &ofApp::guiEventLibrary);
+
+    libraryScanning = false;
+    findingRepeats = false;
+    aligning = false;
+    compareFilePath = "";
+    ofDirectory::createDirectory(
+            getHomeDirectory() + "/.TuneTutor", false, true);
+    library.load(getHomeDirectory() + "/.TuneTutor/library.idx");
+    phraseIndex.load(getPhraseIndexPath());
+    searchLibrary();
+
+    addCanvas(topGui, "topGui");
+    addCanvas(tabBar, "tabBar");
+    addCanvas(midGui, "midGui");
+    addCanvas(markTableGui, "markTableGui");
+    addCanvas(markTableHeader, "markTableHeader");
+    addCanvas(markTable, "markTable");
+    addCanvas(metadataTable, "metadataTable");
+    addCanvas(libraryGui, "libraryGui");
+    addCanvas(libraryResults, "libraryResults");
+
     if (filePath != "") {
         openFile();
     }
@@ -287,8 +365,24 @@ void ofApp::configureCanvas(ofxUICanvas *canvas) {
     //canvas->setColorBack(ofColor(128));
 }
 
+/**
+ * Take over drawing of an ofxUI canvas from ofxUI, so that draw() can time it.
+ * Canvases are drawn in the order they are added.
+ *
+ * @param canvas the canvas to draw
+ * @param scopeName the name under which the canvas is shown by the profiler
+ */
+void ofApp::addCanvas(ofxUICanvas *canvas, const char *scopeName) {
+    canvas->disableAppDrawCallback();
+    canvases.push_back(std::make_pair(canvas, scopeName));
+}
+
 void ofApp::update() {
 
+    // The frame is timed from the start of update() to the end of draw()
+    profiler.beginFrame();
+    TuneTutor::ProfileScope scope(profiler, "update");
+
     // Calculate the sample frame positions at the start and end of the visible
     // region of audio
     displayStartSample = getSampleIndexFromDisplayX(padding);
@@ -310,7 +404,7 @@ void ofApp::update() {
         }
     }
 
-    positionHandleX = playheadPos / (float) (inputSamples.size() / channels)
+    positionHandleX = playheadPos / (float) numFrames
         * (ofGetWidth() - 2 * padding)
         + padding;
 
@@ -324,9 +418,55 @@ void ofApp::update() {
             pitchRangeSlider->setValueHigh(maxPitch);
         }
     }
+
+    if (libraryScanning) {
+        if (libraryScanner.isRunning()) {
+            libraryStatusLabel->setLabel("Scanned "
+                    + ofToString(libraryScanner.getFilesDone()) + " of "
+                    + ofToString(libraryScanner.getFilesFound()));
+        } else {
+            libraryScanning = false;
+            for (const TuneTutor::LibraryEntry &entry
+                    : libraryScanner.finish()) {
+                library.update(entry);
+            }
+            library.save();
+            libraryStatusLabel->setLabel(
+                    ofToString(library.size()) + " tunes");
+            searchLibrary();
+        }
+    }
+
+    if (requestedTabPath != "") {
+        filePath = requestedTabPath;
+        requestedTabPath = "";
+        openFile();
+    }
+
+    if (session != NULL) {
+        updateCues();
+    }
+    reportRealtimeStatus();
+
+    if (findingRepeats && !repeatFinder.isRunning()) {
+        insertRepeatMarks();
+    }
+    if (aligning && !trackAligner.isRunning()) {
+        finishComparison();
+    }
+
+    // Periodically hand a snapshot of the state to the autosaver, which
+    // writes whatever changed on its own thread
+    uint64_t now = ofGetElapsedTimeMillis();
+    if (session != NULL && now - lastAutosaveTime >= autosaveInterval) {
+        autosaver.submit(getTuneState());
+        lastAutosaveTime = now;
+    }
 }
 
 void ofApp::draw() {
+    profiler.beginScope("draw");
+
     ofBackground(190);
     ofSetColor(mainColor);
 
@@ -341,8 +481,12 @@ void ofApp::draw() {
 
 
     // Draw visualization area
+    profiler.beginScope("drawVisualization");
     drawVisualization();
+    profiler.endScope();
+    profiler.beginScope("drawPitchLines");
     drawPitchLines();
+    profiler.endScope();
 
     // Draw marks
     ofSetColor(markLineColor);
@@ -368,8 +512,21 @@ void ofApp::draw() {
             ofGetWidth() * .5, selectionStripTop, 
             ofGetWidth() * .5, vizBottom);
     
-
+    profiler.beginScope("drawPositionBar");
     drawPositionBar();
+    profiler.endScope();
+
+    for (auto &canvas : canvases) {
+        TuneTutor::ProfileScope scope(profiler, canvas.second);
+        canvas.first->draw();
+    }
+
+    profiler.endScope();
+    profiler.endFrame();
+
+    if (showProfiler) {
+        drawProfilerOverlay();
+    }
 }
 
 /**
@@ -387,7 +544,7 @@ void ofApp::drawVisualization() {
     if (!pitchesDetected) {
         return;
     }
-    vector<float> pitchValues = pitchDetector->getPitches();
+    const vector<float> &pitchValues = pitchDetector->getPitches();
 
     ofSetColor(255);
 
@@ -451,6 +608,33 @@ void ofApp::drawPositionBar() {
     ofCircle(positionHandleX, positionHandleY, positionHandleRadius);
 }
 
+/**
+ * Draw frame time percentiles and the most expensive profiler scopes over the
+ * top of the window.
+ */
+void ofApp::drawProfilerOverlay() {
+    std::stringstream ss;
+    ss.precision(2);
+    ss << std::fixed;
+    ss << "Frame time (ms) over " << profiler.getFrameCount() << " frames\n"
+        << "  p50 " << profiler.getFrameTimePercentile(50)
+        << "  p95 " << profiler.getFrameTimePercentile(95)
+        << "  p99 " << profiler.getFrameTimePercentile(99)
+        << "  max " << profiler.getFrameTimePercentile(100) << "\n";
+    const char *qualityNames[] = {"low", "medium", "high"};
+    ss << "Stretch quality " << qualityNames[qualityGovernor.getQuality()]
+        << ", audio load " << qualityGovernor.getLoad() * 100 << "%\n\n";
+    char line[100];
+    snprintf(line, 100, "%-20s %6s %6s\n", "Scope", "mean", "max");
+    ss << line;
+    for (const TuneTutor::ScopeSummary &summary : profiler.getTopScopes(10)) {
+        snprintf(line, 100, "%-20s %6.2f %6.2f\n", summary.name.c_str(),
+                summary.meanMs, summary.maxMs);
+        ss << line;
+    }
+    ofDrawBitmapStringHighlight(ss.str(), padding * 2, padding * 4);
+}
+
 /**
  * ofxUI widget event handler
  */
@@ -463,6 +647,12 @@ void ofApp::guiEvent(ofxUIEventArgs &e) {
             filePath = openFileResult.getPath();
             openFile();
 		}
+    } else if (e.widget == compareFileButton && compareFileButton->getValue()) {
+        ofFileDialogResult result = ofSystemLoadDialog(
+                "Compare with Another Recording");
+        if (result.bSuccess) {
+            startComparison(result.getPath());
+        }
     } else if (e.widget == playButton) {
         if (playButton->getValue()) {
             playPause();
@@ -504,6 +694,7 @@ void ofApp::guiEvent(ofxUIEventArgs &e) {
             for (Mark *mark : marks) {
                 mark->labelInput->setFocus(false);
             }
+            librarySearchInput->setFocus(false);
         } else if(input->getInputTriggerType() == OFX_UI_TEXTINPUT_ON_UNFOCUS) {
         }
     }
@@ -523,6 +714,7 @@ void ofApp::guiEventMarkTable(ofxUIEventArgs &e) {
             for (ofxUITextInput *otherInput : metadataInputs) {
                 otherInput->setFocus(false);
             }
+            librarySearchInput->setFocus(false);
             // Also, manually unfocus the other mark text inputs.
             // TODO: Figure out why they aren't automatically unfocused
             for (Mark *mark : marks) {
@@ -541,6 +733,9 @@ void ofApp::guiEventMarkTable(ofxUIEventArgs &e) {
         }
     } else if (e.widget == addMarkButton && addMarkButton->getValue()) {
         insertMark(playheadPos, "");
+    } else if (e.widget == findSimilarButton
+            && findSimilarButton->getValue()) {
+        findRepeats();
     } else if (e.widget->getKind() == OFX_UI_WIDGET_LABELBUTTON
             && ((ofxUILabelButton *) e.widget)->getValue()) {
 
@@ -553,7 +748,7 @@ void ofApp::guiEventMarkTable(ofxUIEventArgs &e) {
             // Try to get the position from the name and set the selection from
             // it.
             std::stringstream ss(e.widget->getName().substr(1));
-            int pos;
+            int64_t pos;
             ss >> pos;
             if (!ss.fail()) {
                 if (e.widget->getName()[0] == 'S') {
@@ -577,7 +772,7 @@ void ofApp::guiEventMarkTable(ofxUIEventArgs &e) {
             // position stored as its name. Try to get the position from the
             // name and seek to it.
             std::stringstream ss(e.widget->getName());
-            int pos;
+            int64_t pos;
             ss >> pos;
             if (!ss.fail()) {
                 seek(pos);
@@ -587,6 +782,216 @@ void ofApp::guiEventMarkTable(ofxUIEventArgs &e) {
     }
 }
 
+/**
+ * A separate event handler for widgets in the library panel.
+ */
+void ofApp::guiEventLibrary(ofxUIEventArgs &e) {
+    if (e.widget == librarySearchInput) {
+        if (librarySearchInput->getInputTriggerType()
+                == OFX_UI_TEXTINPUT_ON_FOCUS) {
+            // As in the other tables, manually unfocus the text inputs in
+            // other canvases
+            for (ofxUITextInput *otherInput : metadataInputs) {
+                otherInput->setFocus(false);
+            }
+            for (Mark *mark : marks) {
+                mark->labelInput->setFocus(false);
+            }
+        } else {
+            searchLibrary();
+        }
+    } else if (e.widget == scanFolderButton && scanFolderButton->getValue()) {
+        ofFileDialogResult result = ofSystemLoadDialog(
+                "Scan Folder for Tunes", true);
+        if (result.bSuccess && !libraryScanning) {
+            libraryScanner.start(result.getPath(), library, getSettingsRoot());
+            libraryScanning = true;
+        }
+    } else if (e.widget == findPhraseButton && findPhraseButton->getValue()) {
+        findPhrase();
+    } else if (e.widget->getKind() == OFX_UI_WIDGET_LABELBUTTON
+            && ((ofxUILabelButton *) e.widget)->getValue()) {
+
+        // This is a search result button. As with the mark table buttons, its
+        // name is its index into libraryResultPaths.
+        std::stringstream ss(e.widget->getName());
+        size_t index;
+        ss >> index;
+        if (!ss.fail() && index < libraryResultPaths.size()) {
+            filePath = libraryResultPaths[index];
+            int offset = libraryResultOffsets[index];
+            if (openFile() && offset >= 0) {
+                seek((int64_t) offset * sampleRate / 1000);
+            }
+        }
+    }
+}
+
+/**
+ * Fill the library results list with the tunes matching the search input.
+ */
+void ofApp::searchLibrary() {
+    libraryResults->clearWidgets();
+    libraryResultPaths.clear();
+    libraryResultOffsets.clear();
+
+    std::vector<TuneTutor::LibraryEntry> results = library.search(
+            librarySearchInput->getTextString(), maxLibraryResults);
+    char text[300];
+    char widgetName[100];
+    for (const TuneTutor::LibraryEntry &entry : results) {
+        std::string title = entry.fields[TuneTutor::FIELD_TITLE];
+        if (title == "") {
+            title = ofFilePath::getFileName(entry.path);
+        }
+        int seconds = entry.duration;
+        snprintf(text, 300, "%s - %s (%d:%02d)", title.c_str(),
+                entry.fields[TuneTutor::FIELD_ARTIST].c_str(),
+                seconds / 60, seconds % 60);
+
+        ofxUILabelButton *button = new ofxUILabelButton(
+                text, false, 0, 0, 0, 0, OFX_UI_FONT_SMALL);
+        snprintf(widgetName, 100, "%d", (int) libraryResultPaths.size());
+        button->setName(widgetName);
+        libraryResults->addWidgetPosition(button,
+                OFX_UI_WIDGET_POSITION_DOWN, OFX_UI_ALIGN_LEFT);
+        libraryResultPaths.push_back(entry.path);
+        libraryResultOffsets.push_back(-1);
+    }
+}
+
+/**
+ * Fill the library results list with the places in all tunes where a phrase
+ * occurs. The phrase is taken from the search input if it is a list of
+ * intervals in semitones, such as "2 2 -4 5", and otherwise from the pitches
+ * of the current selection.
+ */
+void ofApp::findPhrase() {
+    std::vector<int> intervals;
+    std::stringstream ss(librarySearchInput->getTextString());
+    int interval;
+    while (ss >> interval) {
+        // Consecutive notes in the index always differ in pitch
+        if (interval != 0) {
+            intervals.push_back(interval);
+        }
+    }
+    if (!ss.eof() || intervals.empty()) {
+        intervals.clear();
+        if (pitchDetector != NULL && selectionStart >= 0
+                && selectionEnd > selectionStart) {
+            int sampleInterval = pitchDetector->getSampleInterval();
+            const std::vector<float> &pitches = pitchDetector->getPitches();
+            size_t first = std::min((size_t) selectionStart / sampleInterval,
+                    pitches.size());
+            size_t last = std::min((size_t) selectionEnd / sampleInterval,
+                    pitches.size());
+            intervals = TuneTutor::getPhraseIntervals(
+                    TuneTutor::getPhraseNotes(std::vector<float>(
+                            pitches.begin() + first, pitches.begin() + last),
+                        sampleInterval, sampleRate));
+        }
+    }
+    if ((int) intervals.size() < TuneTutor::PhraseIndex::phraseLength) {
+        libraryStatusLabel->setLabel("Phrase too short");
+        return;
+    }
+
+    libraryResults->clearWidgets();
+    libraryResultPaths.clear();
+    libraryResultOffsets.clear();
+
+    std::vector<TuneTutor::PhraseMatch> matches =
+        phraseIndex.search(intervals, maxLibraryResults);
+    char text[300];
+    char widgetName[100];
+    for (const TuneTutor::PhraseMatch &match : matches) {
+        const TuneTutor::LibraryEntry *entry = library.findByHash(match.hash);
+        if (entry == NULL) {
+            continue;
+        }
+        std::string title = entry->fields[TuneTutor::FIELD_TITLE];
+        if (title == "") {
+            title = ofFilePath::getFileName(entry->path);
+        }
+        int seconds = match.offsetMs / 1000;
+        snprintf(text, 300, "%s - %s at %d:%02d", title.c_str(),
+                entry->fields[TuneTutor::FIELD_ARTIST].c_str(),
+                seconds / 60, seconds % 60);
+
+        ofxUILabelButton *button = new ofxUILabelButton(
+                text, false, 0, 0, 0, 0, OFX_UI_FONT_SMALL);
+        snprintf(widgetName, 100, "%d", (int) libraryResultPaths.size());
+        button->setName(widgetName);
+        libraryResults->addWidgetPosition(button,
+                OFX_UI_WIDGET_POSITION_DOWN, OFX_UI_ALIGN_LEFT);
+        libraryResultPaths.push_back(entry->path);
+        libraryResultOffsets.push_back(match.offsetMs);
+    }
+    libraryStatusLabel->setLabel(ofToString(libraryResultPaths.size())
+            + " matches");
+}
+
+/**
+ * @return the path to the phrase index shared by all tunes
+ */
+std::string ofApp::getPhraseIndexPath() {
+    return getHomeDirectory() + "/.TuneTutor/phrases.idx";
+}
+
+/**
+ * Update the current tune's library entry from its metadata table, so that
+ * searches reflect edits to it.
+ */
+void ofApp::updateLibraryEntry() {
+    TuneTutor::LibraryEntry entry;
+    const TuneTutor::LibraryEntry *existing =
+        library.findByPath(loadedFilePath);
+    if (existing != NULL && existing->hash == fileHash) {
+        entry = *existing;
+    }
+    entry.hash = fileHash;
+    entry.path = loadedFilePath;
+    if (session != NULL) {
+        // Lets the hash be taken from here the next time the file is opened
+        entry.modified = session->fileModified;
+        entry.size = session->fileSize;
+    }
+    entry.duration = numFrames / (double) sampleRate;
+    entry.fields[TuneTutor::FIELD_TITLE] = ((ofxUITextInput *)
+            metadataTable->getWidget("title"))->getTextString();
+    entry.fields[TuneTutor::FIELD_ARTIST] = ((ofxUITextInput *)
+            metadataTable->getWidget("artist"))->getTextString();
+    entry.fields[TuneTutor::FIELD_ALBUM] = ((ofxUITextInput *)
+            metadataTable->getWidget("album"))->getTextString();
+    entry.fields[TuneTutor::FIELD_RHYTHM] = ((ofxUITextInput *)
+            metadataTable->getWidget("rhythm"))->getTextString();
+    entry.fields[TuneTutor::FIELD_KEY] = ((ofxUITextInput *)
+            metadataTable->getWidget("key"))->getTextString();
+    library.update(entry);
+}
+
+/**
+ * Get the content hash of a file. Hashing reads the whole file, so the hash
+ * in the file's library entry is used instead if the file has the same
+ * modification time and size as when that hash was taken.
+ *
+ * @param path the full path to the file
+ * @param info receives the file's modification time and size
+ * @return the hash, or "" if the file can't be read
+ */
+std::string ofApp::getFileHash(std::string path, FileInfo &info) {
+    if (!getFileInfo(path, info)) {
+        return "";
+    }
+    const TuneTutor::LibraryEntry *entry = library.findByPath(path);
+    if (entry != NULL && entry->hash != "" && entry->modified == info.modified
+            && entry->size == info.size) {
+        return entry->hash;
+    }
+    return TuneTutor::getContentHash(path);
+}
+
 /**
  * Play or pause playback, depending on whether currently playing.
  */
@@ -598,8 +1003,11 @@ void ofApp::playPause() {
     } else {
         playButton->setImage(&pauseImage);
         playing = true;
-        playbackDelayed = true;
-        silentSamplesPlayed = 0;
+        playback.startDelay();
+        if (realtimeMode && session != NULL) {
+            // Let a paged file decode the start of playback during the delay
+            session->soundFile.prefetch(playheadPos);
+        }
         soundStream.start();
     }
 }
@@ -629,7 +1037,7 @@ void ofApp::seekToNextMark(bool backward) {
         it = marks.upper_bound(&m);
         if (it == marks.end()) {
             // No mark forward of the playhead position, so seek to the end
-            seek(inputSamples.size() / channels - 1);
+            seek(numFrames - 1);
         } else {
             seek((*it)->position);
         }
@@ -637,7 +1045,11 @@ void ofApp::seekToNextMark(bool backward) {
 }
 
 void ofApp::keyPressed(int key) {
-
+    if (key == profilerToggleKey) {
+        showProfiler = !showProfiler;
+    } else if (key == switchRecordingKey) {
+        switchRecording();
+    }
 }
 
 void ofApp::keyReleased(int key) {
@@ -680,9 +1092,7 @@ void ofApp::mousePressed(int x, int y, int button) {
             draggingViz = true;
             vizDragStartX = x;
             prevPlayheadPos = playheadPos;
-            if (playing) {
-                soundStream.stop();
-            }
+            startScrubbing();
 
         // Left click on position handle
         } else if (y >= positionHandleY - positionHandleRadius
@@ -694,9 +1104,7 @@ void ofApp::mousePressed(int x, int y, int button) {
             draggingPosition = true;
             positionDragStartX = x;
             prevPlayheadPos = playheadPos;
-            if (playing) {
-                soundStream.stop();
-            }
+            startScrubbing();
         }
 
     } else if (button == 2) {
@@ -718,22 +1126,24 @@ void ofApp::mouseDragged(int x, int y, int button) {
         if (snapMark) {
             selectionStart = snapMark->position;
         } else {
-            selectionStart = getSampleIndexFromDisplayX(x);
+            selectionStart = getSnappedSampleIndex(x);
         }
     } else if (draggingSelectionEnd) {
         Mark *snapMark = getMarkAtDisplayX(x);
         if (snapMark) {
             selectionEnd = snapMark->position;
         } else {
-            selectionEnd = getSampleIndexFromDisplayX(x);
+            selectionEnd = getSnappedSampleIndex(x);
         }
     } else if (draggingViz) {
         seek(prevPlayheadPos + (vizDragStartX - x) * samplesPerPixel);
+        scrubber->setPosition(playheadPos);
     } else if (draggingPosition) {
         seek(prevPlayheadPos - (positionDragStartX - x) *
-            (inputSamples.size() / channels / (ofGetWidth() - 2 * padding)));
+            (numFrames / (ofGetWidth() - 2 * padding)));
+        scrubber->setPosition(playheadPos);
     } else if (markBeingDragged != NULL) {
-        updateMarkPosition(markBeingDragged, getSampleIndexFromDisplayX(x));
+        updateMarkPosition(markBeingDragged, getSnappedSampleIndex(x));
     }
 }
 
@@ -741,15 +1151,36 @@ void ofApp::mouseReleased(int x, int y, int button) {
     if (draggingViz || draggingPosition) {
         draggingViz = false;
         draggingPosition = false;
-        if (playing) {
-            soundStream.start();
-        }
+        stopScrubbing();
     }
     draggingSelectionStart = false;
     draggingSelectionEnd = false;
     markBeingDragged = NULL;
 }
 
+/**
+ * Start playing the audio around the playhead as it is dragged, starting the
+ * sound stream if it isn't already playing.
+ */
+void ofApp::startScrubbing() {
+    scrubber->start(playheadPos);
+    scrubbing = true;
+    if (!playing) {
+        soundStream.start();
+    }
+}
+
+/**
+ * Stop scrubbing, and either carry on playing from where the playhead was
+ * dragged to or stop the sound stream again.
+ */
+void ofApp::stopScrubbing() {
+    scrubbing = false;
+    if (!playing) {
+        soundStream.stop();
+    }
+}
+
 void ofApp::windowResized(int w, int h) {
 
 }
@@ -763,39 +1194,48 @@ void ofApp::dragEvent(ofDragInfo dragInfo) {
 }
 
 void ofApp::audioOut(float *output, int bufferSize, int nChannels) {
-
-    if (playheadPos * channels >= inputSamples.size()) {
-        playheadPos = inputSamples.size() / channels;
-        playPause();
+    TuneTutor::RealtimeScope realtimeScope;
+    if (realtimeMode && realtimePriority == 0) {
+        realtimePriority = TuneTutor::setRealtimePriority() ? 1 : -1;
     }
 
-    if (stretcher == NULL) {
+    if (scrubbing) {
+        scrubber->getOutput(output, bufferSize, nChannels);
+        scrubbed = true;
         return;
     }
+    if (scrubbed) {
+        // Start stretching afresh from where the playhead was dragged to,
+        // rather than finishing what was buffered before the drag
+        stretcher->reset();
+        scrubbed = false;
+    }
 
-    // When a playback delay is set by the user, output silence until the set
-    // delay time has elapsed. Don't advance the playhead.
-    if (playbackDelayed) {
-        memset((void *) output, 0, bufferSize * channels * sizeof(float));
-        silentSamplesPlayed += bufferSize;
-        if (silentSamplesPlayed / (float) sampleRate >= playbackDelay) {
-            playbackDelayed = false;
-        }
+    if (stretcher == NULL) {
         return;
     }
 
-    stretcher->getOutput(output, bufferSize);
-    playheadPos = stretcher->getPosition();
-
-    if (playheadPos > selectionEnd) {
-        if (playMode == PLAYMODE_LOOP_SELECTION) {
-            seek(selectionStart);
-            playbackDelayed = true;
-            silentSamplesPlayed = 0;
-        } else if (playMode == PLAYMODE_PLAY_SELECTION) {
-            seek(selectionStart);
-            playPause();
-        }
+    TuneTutor::SelectionEnd atEnd = TuneTutor::SELECTION_CONTINUE;
+    if (playMode == PLAYMODE_LOOP_SELECTION) {
+        atEnd = TuneTutor::SELECTION_LOOP;
+    } else if (playMode == PLAYMODE_PLAY_SELECTION) {
+        atEnd = TuneTutor::SELECTION_STOP;
+    }
+    playback.setSelection(selectionStart, selectionEnd, atEnd);
+    playback.setDelay(playbackDelay);
+    playback.setBackend(stretchBackend);
+    playback.setQuality(qualityGovernor.getQuality());
+    bool more = playback.process(output, bufferSize, nChannels);
+
+    // Time the stretcher against the duration of the buffer, so that the
+    // governor can keep the quality as high as the machine can sustain
+    if (playback.getStretchTime() > 0) {
+        qualityGovernor.update(playback.getStretchTime(),
+                bufferSize / (double) outputRate);
+    }
+    playheadPos = std::min(playback.getPosition(), numFrames);
+    if (!more) {
+        playPause();
     }
 }
 
@@ -804,15 +1244,15 @@ void ofApp::audioOut(float *output, int bufferSize, int nChannels) {
  * 
  * @param position The desired playhead position in sample frames
  */
-void ofApp::seek(int position) {
+void ofApp::seek(int64_t position) {
     if (position <= 0) {
         playheadPos = 0;
-    } else if (position * channels >= inputSamples.size()) {
-        playheadPos = inputSamples.size() / channels - 1;
+    } else if (position >= numFrames) {
+        playheadPos = numFrames - 1;
     } else {
         playheadPos = position;
     }
-    stretcher->seek(playheadPos);
+    playback.seek(playheadPos);
 }
 
 /**
@@ -829,54 +1269,370 @@ void ofApp::setFilePath(std::string path) {
  * @return true if the file was opened successfully.
  */
 bool ofApp::openFile() {
-    if (soundFile.isLoaded()) {
-        saveSettings();
+    openTracer.start();
+    openTracer.beginSpan("open");
+    if (session != NULL) {
+        // The state is written in the background, so that switching tunes
+        // doesn't wait for the disk
+        updateLibraryEntry();
+        autosaver.submit(getTuneState());
+        session->playheadPos = playheadPos;
+    }
+    if (filePath != compareFilePath) {
+        // Opening an unrelated tune ends the comparison
+        compareFilePath = "";
+        warpMap = TuneTutor::WarpMap();
     }
     if (playing) {
         playPause();
     }
-    bool ok = soundFile.load(filePath);
-    if (ok) {
-        fileName = ofFilePath::getBaseName(filePath);
-        ofLog() << "fileName = " << fileName;
-        sampleRate = soundFile.getSampleRate();
-        channels = soundFile.getChannels();
-        inputSamples = soundFile.getSamples();
-
-        ofLog() << "Successfully opened file "
-            << filePath
-            << "\nSize: " << inputSamples.size()
-            << "\nSample rate: " << sampleRate
-            << "\nChannels: " << channels;
-
-        clearMarks();
-        clearMetadata();
-
-        TuneTutor::SoundFileMetadata metadata = soundFile.getMetadata();
-        ((ofxUITextInput *) (metadataTable->getWidget("title")))
-            ->setTextString(metadata.title);
-        ((ofxUITextInput *) (metadataTable->getWidget("artist")))
-            ->setTextString(metadata.artist);
-        ((ofxUITextInput *) (metadataTable->getWidget("album")))
-            ->setTextString(metadata.album);
 
-        if (stretcher != NULL) {
-            delete stretcher;
+    // Only the open tune is kept locked in memory
+    if (realtimeMode && session != NULL) {
+        lockSessionMemory(false);
+    }
+
+    // A recently used tune is still in memory, with its pitches detected
+    TuneTutor::TuneSession *next = sessions.find(filePath);
+    if (next == NULL) {
+        next = loadSession(filePath);
+        if (next == NULL) {
+            ofLogError() << "Error opening sound file";
+            openTracer.stop();
+            if (realtimeMode && session != NULL) {
+                lockSessionMemory(true);
+            }
+            return false;
+        }
+        sessions.add(next);
+    }
+    session = next;
+    if (realtimeMode) {
+        lockSessionMemory(true);
+    }
+
+    fileName = ofFilePath::getBaseName(filePath);
+    ofLog() << "fileName = " << fileName;
+    loadedFilePath = filePath;
+    fileHash = session->hash;
+    sampleRate = session->soundFile.getSampleRate();
+    channels = session->soundFile.getChannels();
+    numFrames = session->soundFile.getLength();
+    stretcher = session->stretcher;
+    scrubber = session->scrubber;
+    cueCache = session->cueCache;
+    playback.setSource(stretcher, cueCache, numFrames);
+    pitchDetector = session->pitchDetector;
+
+    ofLog() << "Successfully opened file "
+        << filePath
+        << "\nFrames: " << numFrames
+        << "\nSample rate: " << sampleRate
+        << "\nChannels: " << channels;
+
+    openTracer.beginSpan("clear");
+    clearMarks();
+    clearMetadata();
+    openTracer.endSpan();
+
+    TuneTutor::SoundFileMetadata metadata = session->soundFile.getMetadata();
+    ((ofxUITextInput *) (metadataTable->getWidget("title")))
+        ->setTextString(metadata.title);
+    ((ofxUITextInput *) (metadataTable->getWidget("artist")))
+        ->setTextString(metadata.artist);
+    ((ofxUITextInput *) (metadataTable->getWidget("album")))
+        ->setTextString(metadata.album);
+
+    seek(session->playheadPos);
+    pitchesDetected = true;
+    setSamplesPerPixel(defaultSamplesPerPixel);
+    openTracer.beginSpan("settings");
+    loadSettings();
+    openTracer.endSpan();
+
+    // Suggest the detected tempo until a rhythm has been entered
+    ofxUITextInput *rhythmInput =
+        (ofxUITextInput *) metadataTable->getWidget("rhythm");
+    if (rhythmInput->getTextString() == "" && pitchDetector->getTempo() > 0) {
+        rhythmInput->setTextString(
+                ofToString(pitchDetector->getTempo(), 0) + " bpm");
+    }
+    updateTabs();
+    openTracer.endSpan();
+    finishOpenTrace();
+    return true;
+}
+
+/**
+ * Record the memory used by each part of the open tune, log a summary of
+ * where the time and memory of opening it went, and write the spans to
+ * ~/.TuneTutor/opentrace.json.
+ */
+void ofApp::finishOpenTrace() {
+    openTracer.setMemory("samples", session->soundFile.getMemoryUsage());
+    openTracer.setMemory("pitch track", pitchDetector->getMemoryUsage());
+    openTracer.setMemory("cues", cueCache->getMemoryUsage());
+    openTracer.setMemory("mark table", openTracer.getHeapBytes("mark table"));
+    openTracer.stop();
+
+    for (const TuneTutor::TraceSpan &span : openTracer.getSpans()) {
+        ofLog() << std::string(2 * span.depth, ' ') << span.name << ": "
+            << span.duration / 1000 << " ms, "
+            << span.cpuTime / 1000 << " ms CPU, "
+            << span.heapBytes / 1024 << " KB heap, "
+            << span.residentBytes / 1024 << " KB resident";
+    }
+    ofLog() << "Samples: " << session->soundFile.getMemoryUsage() / 1024
+        << " KB, pitch track: " << pitchDetector->getMemoryUsage() / 1024
+        << " KB, mark table: "
+        << openTracer.getHeapBytes("mark table") / 1024 << " KB";
+
+    std::string tracePath = getHomeDirectory() + "/.TuneTutor/opentrace.json";
+    if (!openTracer.writeTrace(tracePath)) {
+        ofLogError() << "Error writing open trace to " << tracePath;
+    }
+}
+
+/**
+ * Decode a sound file and get its pitches, from the pitch cache if they have
+ * been saved before.
+ *
+ * @param path the full path to the sound file
+ * @return a new session, or NULL if the file couldn't be loaded
+ */
+TuneTutor::TuneSession *ofApp::loadSession(std::string path) {
+    TuneTutor::TuneSession *newSession = new TuneTutor::TuneSession();
+    openTracer.beginSpan("decode");
+    if (!newSession->soundFile.load(path)) {
+        delete newSession;
+        return NULL;
+    }
+    openTracer.endSpan();
+    newSession->path = path;
+    openTracer.beginSpan("hash");
+    FileInfo info;
+    newSession->hash = getFileHash(path, info);
+    newSession->fileModified = info.modified;
+    newSession->fileSize = info.size;
+    openTracer.endSpan();
+    std::string settingsPath = getSettingsRoot() + "/" + newSession->hash;
+
+    // Settings used to be kept under the file's base name rather than its
+    // content hash, so move them if they haven't been moved yet
+    std::string legacySettingsPath = getSettingsRoot() + "/"
+        + ofFilePath::getBaseName(path);
+    if (!ofDirectory::doesDirectoryExist(settingsPath, false)
+            && ofDirectory::doesDirectoryExist(legacySettingsPath, false)) {
+        ofLog() << "Moving settings from " << legacySettingsPath;
+        std::rename(legacySettingsPath.c_str(), settingsPath.c_str());
+    }
+
+    openTracer.beginSpan("stretcher");
+    newSession->stretcher = new TuneTutor::TimeStretcher(newSession->soundFile);
+    newSession->stretcher->setOutputRate(outputRate);
+    newSession->stretcher->setWaitForPages(false);
+    newSession->scrubber = new TuneTutor::Scrubber(newSession->soundFile);
+    newSession->scrubber->setOutputRate(outputRate);
+    newSession->cueCache = new TuneTutor::CueCache(newSession->soundFile);
+    newSession->cueCache->setOutputRate(outputRate);
+    openTracer.endSpan();
+
+    openTracer.beginSpan("pitches");
+    TuneTutor::PitchDetector *detector =
+        new TuneTutor::PitchDetector(newSession->soundFile);
+    newSession->pitchDetector = detector;
+
+    // Pitches may have been saved by an earlier open or by --analyze
+    std::string pitchCachePath = settingsPath + "/pitches.dat";
+    if (!detector->load(pitchCachePath)) {
+        detector->detectPitches();
+        createDirectories(settingsPath);
+        detector->save(pitchCachePath);
+    }
+    openTracer.endSpan();
+
+    if (!phraseIndex.contains(newSession->hash)) {
+        TuneTutor::TraceScope scope(openTracer, "phrase index");
+        phraseIndex.add(newSession->hash, TuneTutor::getPhraseNotes(
+                    detector->getPitches(), detector->getSampleInterval(),
+                    newSession->soundFile.getSampleRate()));
+    }
+    return newSession;
+}
+
+/**
+ * Rebuild the tab bar, which has a button for each tune still in memory.
+ */
+void ofApp::updateTabs() {
+    tabBar->clearWidgets();
+    tabBar->addLabel("Tunes", OFX_UI_FONT_MEDIUM);
+    char widgetName[100];
+    const std::vector<TuneTutor::TuneSession *> &open = sessions.getSessions();
+    for (size_t i = 0; i < open.size(); i++) {
+        std::string name = ofFilePath::getBaseName(open[i]->path);
+        if (name.size() > maxTabNameLength) {
+            name = name.substr(0, maxTabNameLength - 3) + "...";
         }
-        stretcher = new TuneTutor::TimeStretcher(soundFile);
-        seek(0);
-        if (pitchDetector != NULL) {
-            delete pitchDetector;
+        if (open[i] == session) {
+            name = "[" + name + "]";
         }
-        pitchDetector = new TuneTutor::PitchDetector(soundFile);
-        pitchDetector->detectPitches();
-        pitchesDetected = true;
-        setSamplesPerPixel(defaultSamplesPerPixel);
-        loadSettings();
-    } else {
-        ofLogError() << "Error opening sound file";
+        ofxUILabelButton *button = tabBar->addLabelButton(name, false);
+
+        // As with the mark table buttons, the name is the index into the list
+        snprintf(widgetName, 100, "%d", (int) i);
+        button->setName(widgetName);
+    }
+}
+
+/**
+ * Event handler for the tab bar.
+ */
+void ofApp::guiEventTabs(ofxUIEventArgs &e) {
+    if (e.widget->getKind() != OFX_UI_WIDGET_LABELBUTTON
+            || !((ofxUILabelButton *) e.widget)->getValue()) {
+        return;
+    }
+    std::stringstream ss(e.widget->getName());
+    size_t index;
+    ss >> index;
+    const std::vector<TuneTutor::TuneSession *> &open = sessions.getSessions();
+    if (!ss.fail() && index < open.size() && open[index] != session) {
+        // Switching rebuilds the tab bar, which mustn't happen while it is
+        // still dispatching this event, so it is left to update()
+        requestedTabPath = open[index]->path;
     }
-    return ok;
+}
+
+/**
+ * Set the memory budget for tunes kept in memory. Called by main() when it is
+ * given on the command line.
+ *
+ * @param megabytes the budget in megabytes
+ */
+void ofApp::setMemoryBudget(int megabytes) {
+    sessions.setBudget((size_t) megabytes << 20);
+}
+
+/**
+ * Set the sample rate to open the output device at, instead of the rate it
+ * prefers. Called by main() when it is given on the command line.
+ *
+ * @param rate the sample rate in Hz
+ */
+void ofApp::setOutputRate(int rate) {
+    requestedOutputRate = rate;
+}
+
+/**
+ * Use the given time stretching quality whatever the load, instead of
+ * adapting it. Called by main() when it is given on the command line.
+ *
+ * @param quality the quality tier
+ */
+void ofApp::setStretchQuality(TuneTutor::StretchQuality quality) {
+    qualityGovernor.fixQuality(quality);
+}
+
+/**
+ * Set the engine used for time stretching. Called by main() when it is given
+ * on the command line.
+ *
+ * @param backend the engine to use
+ */
+void ofApp::setStretchBackend(TuneTutor::StretchBackend backend) {
+    stretchBackend = backend;
+}
+
+/**
+ * Turn on real-time hardening of the audio thread. Called by main() when it is
+ * given on the command line.
+ *
+ * @param enabled true to lock the open tune in memory and ask for real-time
+ *        scheduling of the audio thread
+ */
+void ofApp::setRealtimeMode(bool enabled) {
+    realtimeMode = enabled;
+}
+
+/**
+ * Lock or unlock the memory that the audio thread reads for the current
+ * session: its samples, and the time stretcher's buffers.
+ *
+ * @param lock true to lock, false to unlock
+ */
+void ofApp::lockSessionMemory(bool lock) {
+    if (!lock) {
+        session->soundFile.unlockMemory();
+        session->stretcher->unlockMemory();
+        return;
+    }
+    if (!session->soundFile.lockMemory()) {
+        ofLogWarning() << "Couldn't lock the samples in memory;"
+            << " try raising ulimit -l";
+    }
+    if (!session->stretcher->lockMemory()) {
+        ofLogWarning() << "Couldn't lock the time stretcher in memory;"
+            << " try raising ulimit -l";
+    }
+}
+
+/**
+ * Log whether the audio thread got real-time scheduling, and whether it has
+ * done anything since the last frame that could block it. The audio thread
+ * can't log these itself without blocking.
+ */
+void ofApp::reportRealtimeStatus() {
+    if (realtimePriority != 0 && !realtimePriorityReported) {
+        if (realtimePriority > 0) {
+            ofLog() << "Audio thread is scheduled SCHED_FIFO";
+        } else {
+            ofLogWarning() << "Audio thread couldn't get real-time priority;"
+                << " try raising ulimit -r";
+        }
+        realtimePriorityReported = true;
+    }
+
+    TuneTutor::RealtimeViolations violations =
+        TuneTutor::getRealtimeViolations();
+    if (violations.allocations != reportedViolations.allocations
+            || violations.locks != reportedViolations.locks) {
+        ofLogWarning() << "Audio thread made "
+            << violations.allocations - reportedViolations.allocations
+            << " allocator calls and "
+            << violations.locks - reportedViolations.locks
+            << " mutex locks";
+        reportedViolations = violations;
+    }
+}
+
+/**
+ * Find the sample rate the default output device runs at natively, so that
+ * the sound card and operating system don't resample the output again. That
+ * is 48 kHz for most hardware, then 44.1 kHz; failing both, the highest rate
+ * the device supports.
+ *
+ * @return the sample rate in Hz, or 44100 if the device can't be queried
+ */
+int ofApp::getNativeOutputRate() {
+    std::vector<unsigned int> rates;
+    try {
+        RtAudio audio;
+        if (audio.getDeviceCount() > 0) {
+            rates = audio.getDeviceInfo(audio.getDefaultOutputDevice())
+                .sampleRates;
+        }
+    } catch (...) {
+        ofLogWarning() << "Can't query the output device's sample rates";
+    }
+    for (unsigned int preferred : {48000u, 44100u}) {
+        if (std::find(rates.begin(), rates.end(), preferred) != rates.end()) {
+            return preferred;
+        }
+    }
+    if (!rates.empty()) {
+        return *std::max_element(rates.begin(), rates.end());
+    }
+    return 44100;
 }
 
 /**
@@ -886,7 +1642,7 @@ bool ofApp::openFile() {
  * @param sampleIndex the position to convert, in sample frames
  * @return the corresponding x coordinate
  */
-float ofApp::getDisplayXFromSampleIndex(int sampleIndex) {
+float ofApp::getDisplayXFromSampleIndex(int64_t sampleIndex) {
    return ofGetWidth() / 2 + (sampleIndex - playheadPos) / samplesPerPixel;
 }
 
@@ -897,10 +1653,26 @@ float ofApp::getDisplayXFromSampleIndex(int sampleIndex) {
  * @param the x coordinate to convert, in pixels
  * @return the corresponding sample frame position
  */
-int ofApp::getSampleIndexFromDisplayX(float displayX) {
+int64_t ofApp::getSampleIndexFromDisplayX(float displayX) {
     return samplesPerPixel * (displayX - ofGetWidth() / 2) + playheadPos;
 }
 
+/**
+ * Get the sample frame position for the given x coordinate, moved to the
+ * nearest onset or beat within a mark's width of it. Holding Shift turns the
+ * snapping off.
+ *
+ * @param the x coordinate to convert, in pixels
+ * @return the snapped sample frame position
+ */
+int64_t ofApp::getSnappedSampleIndex(float displayX) {
+    int64_t position = getSampleIndexFromDisplayX(displayX);
+    if (pitchDetector == NULL || ofGetKeyPressed(OF_KEY_SHIFT)) {
+        return position;
+    }
+    return pitchDetector->snap(position, markWidth * samplesPerPixel);
+}
+
 /**
  * Get the mark whose triangle is intersected by the given x coordinate.
  *
@@ -926,6 +1698,166 @@ Mark *ofApp::getMarkAtDisplayX(int x) {
     return locatedMark;
 }
 
+/**
+ * Start searching in the background for the parts of the tune that are
+ * similar to the selection. Marks are inserted by insertRepeatMarks() when the
+ * search finishes.
+ */
+void ofApp::findRepeats() {
+    if (findingRepeats || pitchDetector == NULL || selectionStart < 0
+            || selectionEnd <= selectionStart) {
+        return;
+    }
+    int interval = pitchDetector->getSampleInterval();
+    repeatFinder.start(pitchDetector->getPitches(),
+            selectionStart / interval, selectionEnd / interval);
+    findingRepeats = true;
+    repeatSearchHash = fileHash;
+    repeatLabel = "Like " + formatTime(selectionStart);
+}
+
+/**
+ * Insert a mark at the start of each part found by findRepeats(), unless a
+ * different tune has been opened since the search started.
+ */
+void ofApp::insertRepeatMarks() {
+    findingRepeats = false;
+    std::vector<size_t> matches = repeatFinder.finish();
+    if (repeatSearchHash != fileHash || pitchDetector == NULL) {
+        return;
+    }
+    int interval = pitchDetector->getSampleInterval();
+    for (size_t match : matches) {
+        insertMark(match * interval, repeatLabel);
+    }
+    ofLog() << "Found " << matches.size() << " parts similar to the selection";
+}
+
+/**
+ * Start comparing the open recording with another recording of the same tune.
+ * The two are aligned in the background, unless they have been aligned before,
+ * and switchRecording() can then switch between them.
+ *
+ * @param otherPath the full path to the other recording
+ */
+void ofApp::startComparison(std::string otherPath) {
+    if (aligning || pitchDetector == NULL) {
+        return;
+    }
+    compareFilePath = "";
+    warpMap = TuneTutor::WarpMap();
+    FileInfo info;
+    std::string otherHash = getFileHash(otherPath, info);
+    if (otherHash == "" || otherHash == fileHash) {
+        return;
+    }
+    if (loadWarpMap(otherHash)) {
+        compareFilePath = otherPath;
+        ofLog() << "Comparing with " << otherPath;
+        return;
+    }
+    trackAligner.start(pitchDetector->getPitches(), otherPath,
+            getSettingsRoot());
+    aligning = true;
+    alignedHash = fileHash;
+    aligningPath = otherPath;
+    ofLog() << "Aligning with " << otherPath;
+}
+
+/**
+ * Take the result of an alignment started by startComparison(), unless a
+ * different tune has been opened since it started.
+ */
+void ofApp::finishComparison() {
+    aligning = false;
+    TuneTutor::WarpMap map;
+    std::string otherHash = trackAligner.finish(map);
+    if (otherHash == "" || alignedHash != fileHash) {
+        ofLogError() << "Could not align with " << aligningPath;
+        return;
+    }
+    warpMap = map;
+    compareFilePath = aligningPath;
+    warpMap.save(getSettingsPath() + "/align-" + otherHash + ".dat");
+    ofLog() << "Comparing with " << compareFilePath;
+}
+
+/**
+ * Load the alignment of the open recording with another one, which is saved
+ * in the settings directory of whichever recording was open when it was made.
+ *
+ * @return true if the alignment was found
+ */
+bool ofApp::loadWarpMap(std::string otherHash) {
+    if (warpMap.load(getSettingsPath() + "/align-" + otherHash + ".dat")) {
+        return true;
+    }
+    if (warpMap.load(getSettingsRoot() + "/" + otherHash + "/align-"
+                + fileHash + ".dat")) {
+        warpMap = warpMap.inverted();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Switch to the recording being compared with, at the musically matching
+ * position. The selection is carried across, and so are the marks, except
+ * where the other recording already has a mark close by.
+ */
+void ofApp::switchRecording() {
+    if (compareFilePath == "" || warpMap.isEmpty() || pitchDetector == NULL) {
+        return;
+    }
+
+    // Positions in the other recording, in pitch values
+    double interval = pitchDetector->getSampleInterval();
+    double position = warpMap.map(playheadPos / interval);
+    double otherSelectionStart = warpMap.map(selectionStart / interval);
+    double otherSelectionEnd = warpMap.map(selectionEnd / interval);
+    bool hasSelection = selectionStart >= 0 && selectionEnd > selectionStart;
+    std::vector<std::pair<double, std::string> > otherMarks;
+    for (Mark *mark : marks) {
+        otherMarks.push_back(std::make_pair(
+                    warpMap.map(mark->position / interval), mark->label));
+    }
+
+    bool wasPlaying = playing;
+    std::string previousPath = loadedFilePath;
+    TuneTutor::WarpMap inverse = warpMap.inverted();
+    filePath = compareFilePath;
+    if (!openFile()) {
+        return;
+    }
+    compareFilePath = previousPath;
+    warpMap = inverse;
+
+    interval = pitchDetector->getSampleInterval();
+    int tolerance = sampleRate / 4;
+    for (const std::pair<double, std::string> &otherMark : otherMarks) {
+        int64_t markPosition = std::min(otherMark.first * interval,
+                numFrames - 1.0);
+        bool nearby = false;
+        for (Mark *mark : marks) {
+            if (std::abs(mark->position - markPosition) < tolerance) {
+                nearby = true;
+                break;
+            }
+        }
+        if (!nearby) {
+            insertMark(markPosition, otherMark.second);
+        }
+    }
+    if (hasSelection) {
+        selectionStart = otherSelectionStart * interval;
+        selectionEnd = otherSelectionEnd * interval;
+    }
+    seek(position * interval);
+    if (wasPlaying) {
+        playPause();
+    }
+}
+
 /**
  * Create a new mark.
  *
@@ -934,7 +1866,7 @@ Mark *ofApp::getMarkAtDisplayX(int x) {
  * @return the created mark, or NULL if it could not be created at the given
  *         position
  */
-Mark *ofApp::insertMark(int position, std::string label) {
+Mark *ofApp::insertMark(int64_t position, std::string label) {
     Mark *mark = new Mark();
     mark->position = position;
     mark->label = label;
@@ -956,7 +1888,7 @@ Mark *ofApp::insertMark(int position, std::string label) {
     char widgetName[100];
     mark->positionButton =  new ofxUILabelButton(
             formatTime(mark->position), false);
-    snprintf(widgetName, 100, "%d", mark->position);
+    snprintf(widgetName, 100, "%lld", (long long) mark->position);
     mark->positionButton->setName(widgetName);
     if (lastMarkPositionButton == NULL) {
         markTable->addWidgetPosition(mark->positionButton,
@@ -968,7 +1900,7 @@ Mark *ofApp::insertMark(int position, std::string label) {
     lastMarkPositionButton = mark->positionButton;
     mark->selectStartToggle = new ofxUILabelButton(
             "", false, 20, 0, 0, 0, OFX_UI_FONT_MEDIUM);
-    snprintf(widgetName, 100, "S%d", mark->position);
+    snprintf(widgetName, 100, "S%lld", (long long) mark->position);
     mark->selectStartToggle->setName(widgetName);
     markTable->addWidgetPosition(mark->selectStartToggle,
             OFX_UI_WIDGET_POSITION_RIGHT, OFX_UI_ALIGN_LEFT);
@@ -976,7 +1908,7 @@ Mark *ofApp::insertMark(int position, std::string label) {
 
     mark->selectEndToggle = new ofxUILabelButton(
             "", false, 20, 0, 0, 0, OFX_UI_FONT_MEDIUM);
-    snprintf(widgetName, 100, "E%d", mark->position);
+    snprintf(widgetName, 100, "E%lld", (long long) mark->position);
     mark->selectEndToggle->setName(widgetName);
     markTable->addWidgetPosition(mark->selectEndToggle,
             OFX_UI_WIDGET_POSITION_RIGHT, OFX_UI_ALIGN_LEFT);
@@ -1017,7 +1949,7 @@ void ofApp::clearMarks() {
  * @param mark the mark to move
  * @param the position to move it to, in sample frames
  */
-void ofApp::updateMarkPosition(Mark *mark, int position) {
+void ofApp::updateMarkPosition(Mark *mark, int64_t position) {
 
     // Because marks is an ordered set, and the key for ordering is the position,
     // the set needs to be updated when a mark's position changes.
@@ -1031,19 +1963,27 @@ void ofApp::updateMarkPosition(Mark *mark, int position) {
     // navigation to the mark by clicking on the button.
     // This hack is also used for the selection toggle buttons.
     char widgetName[100];
-    snprintf(widgetName, 100, "%d", mark->position);
+    snprintf(widgetName, 100, "%lld", (long long) mark->position);
     mark->positionButton->setName(widgetName);
-    snprintf(widgetName, 100, "S%d", mark->position);
+    snprintf(widgetName, 100, "S%lld", (long long) mark->position);
     mark->selectStartToggle->setName(widgetName);
-    snprintf(widgetName, 100, "E%d", mark->position);
+    snprintf(widgetName, 100, "E%lld", (long long) mark->position);
     mark->selectEndToggle->setName(widgetName);
 }
 
 /**
- * @return the path to the directory for saved settings
+ * @return the path to the directory containing each tune's settings directory
+ */
+std::string ofApp::getSettingsRoot() {
+    return getHomeDirectory() + "/.TuneTutor/metadata";
+}
+
+/**
+ * @return the path to the directory for saved settings of the current tune,
+ *         which is named by the tune's content hash
  */
 std::string ofApp::getSettingsPath() {
-    return getHomeDirectory() + "/.TuneTutor/metadata/" + fileName;
+    return getSettingsRoot() + "/" + fileHash;
 }
 
 /**
@@ -1051,6 +1991,24 @@ std::string ofApp::getSettingsPath() {
  */
 void ofApp::loadSettings() {
     ofLog() << "Loading settings";
+    std::string path = getSettingsPath();
+    ofDirectory dir(path);
+    if (!dir.exists()) {
+        dir.create(true);
+    }
+    TuneTutor::TuneState state;
+    if (autosaver.load(path + "/state.dat", state)) {
+        applyTuneState(state);
+    } else {
+        // Settings saved by older versions are converted on the next save
+        loadLegacySettings();
+    }
+}
+
+/**
+ * Load settings saved as XML files by older versions of TuneTutor.
+ */
+void ofApp::loadLegacySettings() {
     std::string path = getSettingsPath();
     topGui->loadSettings(path + "/settings1.xml");
     midGui->loadSettings(path + "/settings2.xml");
@@ -1071,6 +2029,98 @@ void ofApp::loadSettings() {
     }
 }
 
+/**
+ * @return the current GUI parameters, selection, metadata, and marks
+ */
+TuneTutor::TuneState ofApp::getTuneState() {
+    TuneTutor::TuneState state;
+    state.numbers["playMode"] = playMode;
+    state.numbers["playbackDelay"] = playbackDelay;
+    state.numbers["zoom"] = zoom;
+    state.numbers["minPitch"] = minPitch;
+    state.numbers["maxPitch"] = maxPitch;
+    state.numbers["speed"] = speed;
+    state.numbers["transpose"] = transpose;
+    state.numbers["tuning"] = tuning;
+    state.numbers["selectionStart"] = selectionStart;
+    state.numbers["selectionEnd"] = selectionEnd;
+
+    for (ofxUITextInput *input : metadataInputs) {
+        state.texts[input->getName()] = input->getTextString();
+    }
+
+    for (Mark *mark : marks) {
+        // Workaround for when text input has been typed into but hasn't been
+        // unfocused
+        mark->label = mark->labelInput->getTextString();
+
+        state.marks[mark->position] = mark->label;
+    }
+
+    return state;
+}
+
+/**
+ * Set the GUI parameters, selection, metadata, and marks from a saved state.
+ * Values missing from the state are left unchanged.
+ *
+ * @param state the state to apply
+ */
+void ofApp::applyTuneState(const TuneTutor::TuneState &state) {
+    std::map<std::string, double>::const_iterator it;
+
+    if ((it = state.numbers.find("playMode")) != state.numbers.end()
+            && it->second >= 0 && it->second < playModeToggles.size()) {
+        playMode = (PlayMode) (int) it->second;
+        playModeRadio->activateToggle(playModeToggles[playMode]->getName());
+    }
+    if ((it = state.numbers.find("playbackDelay")) != state.numbers.end()) {
+        playbackDelaySlider->setValue(it->second);
+    }
+    if ((it = state.numbers.find("zoom")) != state.numbers.end()) {
+        zoomSlider->setValue(it->second);
+        setSamplesPerPixel(defaultSamplesPerPixel / zoom);
+    }
+    if ((it = state.numbers.find("minPitch")) != state.numbers.end()) {
+        pitchRangeSlider->setValueLow(it->second);
+    }
+    if ((it = state.numbers.find("maxPitch")) != state.numbers.end()) {
+        pitchRangeSlider->setValueHigh(it->second);
+    }
+    if ((it = state.numbers.find("speed")) != state.numbers.end()) {
+        speedSlider->setValue(it->second);
+    }
+    if ((it = state.numbers.find("transpose")) != state.numbers.end()) {
+        transposeSlider->setValue(it->second);
+    }
+    if ((it = state.numbers.find("tuning")) != state.numbers.end()) {
+        tuningSlider->setValue(it->second);
+    }
+    if ((it = state.numbers.find("selectionStart")) != state.numbers.end()) {
+        selectionStart = it->second;
+    }
+    if ((it = state.numbers.find("selectionEnd")) != state.numbers.end()) {
+        selectionEnd = it->second;
+    }
+    if (stretcher != NULL) {
+        stretcher->setSpeed(speed / 100.0);
+        stretcher->setPitch(transpose + tuning / 100.0);
+    }
+
+    for (ofxUITextInput *input : metadataInputs) {
+        std::map<std::string, std::string>::const_iterator text =
+            state.texts.find(input->getName());
+        if (text != state.texts.end()) {
+            input->setTextString(text->second);
+        }
+    }
+
+    TuneTutor::TraceScope scope(openTracer, "mark table");
+    for (const std::pair<const int64_t, std::string> &mark : state.marks) {
+        insertMark(mark.first, mark.second);
+    }
+}
+
 /**
  * Clear the fields of the metadata GUI table.
  */
@@ -1081,40 +2131,17 @@ void ofApp::clearMetadata() {
 }
 
 /**
- * Save all current GUI parameters, marks, selection, and metadata to disk.
+ * Save all current GUI parameters, marks, selection, and metadata to disk, and
+ * wait for them to be written. Only the values that changed since the last
+ * load or save are written.
  */
 void ofApp::saveSettings() {
     ofLog() << "Saving settings";
-    std::string path = getSettingsPath();
-    ofDirectory dir(path);
-    if (!dir.exists()) {
-        dir.create(true);
-    }
-    topGui->saveSettings(path + "/settings1.xml");
-    midGui->saveSettings(path + "/settings2.xml");
-    metadataTable->saveSettings(path + "/metadata.xml");
-
-    ofxXmlSettings xml;
-    xml.addTag("marks");
-    xml.pushTag("marks");
-    int i = 0;
-    for (Mark *mark : marks) {
-        xml.addTag("mark");
-        xml.pushTag("mark", i);
-        xml.addValue("position", mark->position);
-
-        // Workaround for when text input has been typed into but hasn't been
-        // unfocused
-        mark->label = mark->labelInput->getTextString();
-
-        xml.addValue("label", mark->label);
-        xml.popTag();
-        i++;
+    updateLibraryEntry();
+    autosaver.submit(getTuneState());
+    if (!autosaver.flush()) {
+        ofLogError() << "Error saving settings to " << getSettingsPath();
     }
-    xml.popTag();
-    xml.setValue("selectionStart", selectionStart);
-    xml.setValue("selectionEnd", selectionEnd);
-    xml.save(path + "/marks.xml");
 }
 
 /**
@@ -1136,17 +2163,46 @@ void ofApp::setSamplesPerPixel(float ratio) {
  * @param the sample frame position to format
  * @return a formatted string representation of the given position
  */
-std::string ofApp::formatTime(int sample) {
-    int milliseconds = sample / (float) sampleRate * 1000;
+std::string ofApp::formatTime(int64_t sample) {
+    int64_t milliseconds = sample * 1000 / sampleRate;
     int seconds = milliseconds / 1000;
-    milliseconds -= seconds * 1000;
+    milliseconds -= seconds * 1000LL;
     int minutes = seconds / 60;
     seconds -= minutes * 60;
-    char buffer[10];
-    snprintf(buffer, 10, "%d:%02d.%03d", minutes, seconds, milliseconds);
+    char buffer[20];
+    snprintf(buffer, 20, "%d:%02d.%03d", minutes, seconds,
+            (int) milliseconds);
     return std::string(buffer);
 }
 
 void ofApp::exit() {
-    saveSettings();
+    if (session != NULL) {
+        saveSettings();
+    }
+    library.save();
+
+    std::string tracePath = getHomeDirectory() + "/.TuneTutor/frametrace.json";
+    if (profiler.writeTrace(tracePath)) {
+        ofLog() << "Wrote frame trace to " << tracePath;
+    } else {
+        ofLogError() << "Error writing frame trace to " << tracePath;
+    }
+}
+
+/**
+ * Tell the cue cache where the marks and the selection start are, and what
+ * the stretcher's settings are, so that it can keep their cues up to date.
+ */
+void ofApp::updateCues() {
+    std::vector<int64_t> positions;
+    positions.push_back(selectionStart);
+    for (Mark *mark : marks) {
+        positions.push_back(mark->position);
+    }
+    TuneTutor::CueSettings settings;
+    settings.speed = speed / 100.0;
+    settings.semitones = transpose + tuning / 100.0;
+    settings.backend = stretchBackend;
+    cueCache->setQuality(qualityGovernor.getQuality());
+    cueCache->update(positions, settings);
 }
@@ -20,12 +20,28 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "ofMain.h"
 #include "ofxUI.h"
 
 #include "soundfile.h"
 #include "timestretcher.h"
 #include "pitchdetector.h"
+#include "profiler.h"
+#include "qualitygovernor.h"
+#include "realtime.h"
+#include "autosaver.h"
+#include "cuecache.h"
+#include "library.h"
+#include "phraseindex.h"
+#include "playbackengine.h"
+#include "repeatfinder.h"
+#include "scrubber.h"
+#include "sessioncache.h"
+#include "trackaligner.h"
+#include "tunestate.h"
+#include "util.h"
 
 enum PlayMode {
     PLAYMODE_PLAY_SELECTION,
@@ -39,7 +55,7 @@ enum PlayMode {
 struct Mark {
 
     /** Position of the mark in sample frames */
-    int position;
+    int64_t position;
 
     /** Description of the mark entered by the user */
     std::string label;
@@ -84,9 +100,22 @@ class ofApp : public ofBaseApp {
         void audioOut(float* output, int bufferSize, int nChannels);
         void guiEvent(ofxUIEventArgs &e);
         void guiEventMarkTable(ofxUIEventArgs &e);
+        void guiEventLibrary(ofxUIEventArgs &e);
+        void guiEventTabs(ofxUIEventArgs &e);
         void exit();
 
         void setFilePath(std::string path);
+        void setMemoryBudget(int megabytes);
+        void setOutputRate(int rate);
+        void setStretchQuality(TuneTutor::StretchQuality quality);
+        void setStretchBackend(TuneTutor::StretchBackend backend);
+        void setRealtimeMode(bool enabled);
+
+        /**
+         * @return the path to the directory containing each tune's settings
+         *         directory
+         */
+        static std::string getSettingsRoot();
 
     private:
         const std::string fontFile = "DroidSans.ttf";
@@ -106,25 +135,32 @@ class ofApp : public ofBaseApp {
         void drawVisualization();
         void drawPitchLines();
         void drawPositionBar();
+        void drawProfilerOverlay();
 		
         // ofxUI stuff
         ofxUICanvas *topGui;   	
+        ofxUICanvas *tabBar;
         ofxUICanvas *midGui;
         ofxUICanvas *metadataTable;
+        ofxUICanvas *markTableGui;
+        ofxUICanvas *markTableHeader;
         ofxUIScrollableCanvas *markTable;
         float midGuiY;
         ofxUILabelButton *openFileButton;
+        ofxUILabelButton *compareFileButton;
         ofxUIImageButton *playButton;
         ofxUIImageButton *forwardButton;
         ofxUIImageButton *backButton;
         ofxUIRadio *playModeRadio;
         std::vector<ofxUIToggle *> playModeToggles;
+        ofxUISlider *playbackDelaySlider;
         ofxUISlider *zoomSlider;
         ofxUIRangeSlider *pitchRangeSlider;
         ofxUIIntSlider *speedSlider;
         ofxUIIntSlider *transposeSlider;
         ofxUIIntSlider *tuningSlider;
         ofxUILabelButton *addMarkButton;
+        ofxUILabelButton *findSimilarButton;
         ofxUILabelButton *lastMarkPositionButton;
         std::set<ofxUITextInput *> metadataInputs;
         void clearMetadata();
@@ -137,8 +173,20 @@ class ofApp : public ofBaseApp {
 
         std::string filePath;
         std::string fileName;
+        std::string fileHash;
+        std::string loadedFilePath; // filePath may already name the next file
         bool openFile();
 
+        // Open tunes, kept in memory so that switching between them is quick
+        const size_t maxTabNameLength = 24;
+        TuneTutor::SessionCache sessions;
+        TuneTutor::TuneSession *session; // the current tune, or NULL
+        TuneTutor::TuneSession *loadSession(std::string path);
+        void updateTabs();
+
+        /** Tune whose tab was clicked, opened by the next update() */
+        std::string requestedTabPath;
+
         float playbackDelay;
         float zoom;
         int speed;
@@ -146,27 +194,28 @@ class ofApp : public ofBaseApp {
         int tuning;
         PlayMode playMode;
 
-        int displayStartSample;
-        int displayEndSample;
-        float getDisplayXFromSampleIndex(int sampleIndex);
-        int getSampleIndexFromDisplayX(float displayX);
+        int64_t displayStartSample;
+        int64_t displayEndSample;
+        float getDisplayXFromSampleIndex(int64_t sampleIndex);
+        int64_t getSampleIndexFromDisplayX(float displayX);
+        int64_t getSnappedSampleIndex(float displayX);
 
         float markStripTop;
         float markStripBottom;
         std::set<Mark*, MarkCompare> marks;
         Mark *markBeingDragged;
         Mark *getMarkAtDisplayX(int x);
-        Mark *insertMark(int position, std::string label = "");
+        Mark *insertMark(int64_t position, std::string label = "");
         void deleteMark(Mark *mark);
         void clearMarks();
-        void updateMarkPosition(Mark *mark, int position);
+        void updateMarkPosition(Mark *mark, int64_t position);
 
         bool drawSelection;
         float selectionStripTop;
         float selectionStripHeight;
         float selectionStripBottom;
-        int selectionStart;
-        int selectionEnd;
+        int64_t selectionStart;
+        int64_t selectionEnd;
         float selectionStartX;
         float selectionEndX;
         bool draggingSelectionStart;
@@ -193,27 +242,58 @@ class ofApp : public ofBaseApp {
 
         // Audio setup
         bool playing;
-        bool playbackDelayed; // true if in a playback delay state
         int bufferSize;
         void playPause();
 
-        /** Number of samples of silence played since playback delay started */
-        int silentSamplesPlayed;
+        /** Sample rate of the output device, whatever the sound file's */
+        int outputRate;
+
+        /** Output rate given on the command line, or 0 to use the device's */
+        int requestedOutputRate = 0;
+
+        static int getNativeOutputRate();
+
+        // Real-time hardening: the open tune's audio is locked in memory, and
+        // the audio thread asks for SCHED_FIFO on its first callback. The
+        // audio thread sets realtimePriority to 1 if it got it and -1 if not.
+        bool realtimeMode = false;
+        std::atomic<int> realtimePriority;
+        bool realtimePriorityReported;
+        TuneTutor::RealtimeViolations reportedViolations;
+        void lockSessionMemory(bool lock);
+        void reportRealtimeStatus();
 
         // Sound file
-        TuneTutor::SoundFile soundFile;
-        std::vector<float> inputSamples;
+        int64_t numFrames;
         int sampleRate;
         int channels;
 
         // Playhead
-        int prevPlayheadPos; // Position of playhead when dragging started
-        int playheadPos;
-        void seek(int position); // Set playhead position
+        int64_t prevPlayheadPos; // Position of playhead when dragging started
+        int64_t playheadPos;
+        void seek(int64_t position); // Set playhead position
         void seekToNextMark(bool backward);
 
-        // Time stretcher
+        // Time stretcher, the governor that sets its quality tier, and the
+        // engine that plays it with the cues
         TuneTutor::TimeStretcher *stretcher;
+        TuneTutor::QualityGovernor qualityGovernor;
+        TuneTutor::StretchBackend stretchBackend =
+            TuneTutor::STRETCH_RUBBERBAND;
+        TuneTutor::PlaybackEngine playback;
+
+        // Plays the audio around the playhead while it is dragged, in place
+        // of the time stretcher
+        TuneTutor::Scrubber *scrubber;
+        std::atomic<bool> scrubbing;
+        bool scrubbed; // Used only by the audio thread
+        void startScrubbing();
+        void stopScrubbing();
+
+        // Lead-ins stretched in advance at the marks and the selection start,
+        // played when the playhead jumps to one of them
+        TuneTutor::CueCache *cueCache;
+        void updateCues();
 
         // Pitch detection
         TuneTutor::PitchDetector *pitchDetector;
@@ -228,7 +308,73 @@ class ofApp : public ofBaseApp {
 
         std::string getSettingsPath();
         void loadSettings();
+        void loadLegacySettings();
         void saveSettings();
-
-        std::string formatTime(int sample);
+        const uint64_t autosaveInterval = 500; // milliseconds
+        uint64_t lastAutosaveTime;
+        TuneTutor::Autosaver autosaver;
+        TuneTutor::TuneState getTuneState();
+        void applyTuneState(const TuneTutor::TuneState &state);
+
+        std::string formatTime(int64_t sample);
+
+        // Library
+        const int maxLibraryResults = 100;
+        TuneTutor::LibraryIndex library;
+        TuneTutor::LibraryScanner libraryScanner;
+        bool libraryScanning;
+        ofxUICanvas *libraryGui;
+        ofxUIScrollableCanvas *libraryResults;
+        ofxUILabelButton *scanFolderButton;
+        ofxUILabelButton *findPhraseButton;
+        ofxUILabel *libraryStatusLabel;
+        ofxUITextInput *librarySearchInput;
+        std::vector<std::string> libraryResultPaths;
+        std::vector<int> libraryResultOffsets; // ms, or -1 for tune start
+        void searchLibrary();
+        void updateLibraryEntry();
+        std::string getFileHash(std::string path, FileInfo &info);
+
+        // Finding repeats of the selection
+        TuneTutor::RepeatFinder repeatFinder;
+        bool findingRepeats;
+        std::string repeatSearchHash; // the tune being searched
+        std::string repeatLabel;
+        void findRepeats();
+        void insertRepeatMarks();
+
+        // Comparing with another recording of the same tune
+        const int switchRecordingKey = OF_KEY_F2;
+        TuneTutor::TrackAligner trackAligner;
+        bool aligning;
+        std::string alignedHash; // the tune the alignment was started from
+        std::string aligningPath;
+        std::string compareFilePath;
+        TuneTutor::WarpMap warpMap; // from the open recording to the other
+        void startComparison(std::string otherPath);
+        void finishComparison();
+        bool loadWarpMap(std::string otherHash);
+        void switchRecording();
+
+        // Phrase search
+        TuneTutor::PhraseIndex phraseIndex;
+        void findPhrase();
+        std::string getPhraseIndexPath();
+
+        // Frame profiling
+        const int profilerToggleKey = OF_KEY_F12;
+        TuneTutor::FrameProfiler profiler;
+        bool showProfiler;
+
+        // Spans of the last openFile(), written to opentrace.json
+        TuneTutor::SpanTracer openTracer;
+        void finishOpenTrace();
+
+        /**
+         * The canvases, with the profiler scope names under which they are
+         * drawn. They are drawn by draw() rather than by ofxUI itself so that
+         * they can be timed.
+         */
+        std::vector<std::pair<ofxUICanvas *, const char *> > canvases;
+        void addCanvas(ofxUICanvas *canvas, const char *scopeName);
 };
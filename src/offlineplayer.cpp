@@ -0,0 +1,439 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include "binaryio.h"
+#include "offlineplayer.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/** Output sample rate and buffer size used by renderScript() */
+const int renderRate = 48000;
+const int renderBufferSize = 512;
+
+/** The script commands */
+const char *commands[] = {
+    "seek", "speed", "transpose", "tuning", "mark", "loop", "delay",
+    "stretcher", "quality", "stop"
+};
+const int numCommands = sizeof(commands) / sizeof(*commands);
+
+/** @return true if the whole of the string is a number, such as "12.5" */
+bool isNumber(const std::string &s) {
+    char *end;
+    strtod(s.c_str(), &end);
+    return !s.empty() && *end == '\0';
+}
+
+/**
+ * Check that an event of a known command has the arguments it needs, so that
+ * a bad script is rejected before any of it is played.
+ */
+bool checkArgs(const PlaybackEvent &event) {
+    const std::string &command = event.command;
+    const std::vector<std::string> &args = event.args;
+    if (command == "stop") {
+        return args.empty();
+    } else if (command == "stretcher") {
+        return args.size() == 1
+            && (args[0] == "native" || args[0] == "rubberband");
+    } else if (command == "quality") {
+        return args.size() == 1 && (args[0] == "low" || args[0] == "medium"
+                || args[0] == "high");
+    } else if (command == "loop" && args.size() == 1) {
+        return args[0] == "off";
+    } else if (command == "loop") {
+        return args.size() == 2 && isNumber(args[0]) && isNumber(args[1])
+            && atof(args[0].c_str()) < atof(args[1].c_str());
+    } else if (command == "speed") {
+        return args.size() == 1 && isNumber(args[0])
+            && atof(args[0].c_str()) > 0;
+    } else if (command == "delay") {
+        return args.size() == 1 && isNumber(args[0])
+            && atof(args[0].c_str()) >= 0;
+    }
+
+    // seek, transpose, tuning and mark take one number
+    return args.size() == 1 && isNumber(args[0]);
+}
+
+/** Length of the header of the WAV files written */
+const size_t wavHeaderBytes = 44;
+
+/** Append an integer to a buffer in little-endian byte order, as in WAV */
+void putLittleEndian(std::vector<char> &buf, uint32_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        buf.push_back((char) ((value >> (8 * i)) & 0xff));
+    }
+}
+
+}
+
+OfflinePlayer::OfflinePlayer(const SoundFile &soundFile, int outputRate,
+        int bufferSize) : stretcher(soundFile), cueCache(soundFile) {
+    this->soundFile = &soundFile;
+    this->outputRate = outputRate;
+    this->bufferSize = bufferSize;
+    paced = false;
+    stretcher.setOutputRate(outputRate);
+    cueCache.setOutputRate(outputRate);
+    playback.setSource(&stretcher, &cueCache, soundFile.getLength());
+    playback.setOutputRate(outputRate);
+    playback.setWaitForCues(true);
+    selectionStart = 0;
+    selectionEnd = 0;
+    looping = false;
+    loopDelay = 0;
+    stopped = false;
+    seeked = false;
+    seekPosition = 0;
+    quality = QUALITY_MEDIUM;
+    transpose = 0;
+    tuning = 0;
+    stretchSeconds = 0;
+    maxLoad = 0;
+}
+
+bool OfflinePlayer::loadScript(std::string path) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        std::cout << "OfflinePlayer: can't open " << path << std::endl;
+        return false;
+    }
+    events.clear();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        std::stringstream words(line);
+        PlaybackEvent event;
+        if (!(words >> event.time)) {
+            if (line.find_first_not_of(" \t\r") != std::string::npos) {
+                std::cout << "OfflinePlayer: " << path << ":" << lineNumber
+                    << ": expected a time" << std::endl;
+                return false;
+            }
+            continue;
+        }
+        words >> event.command;
+        if (std::find(commands, commands + numCommands, event.command)
+                == commands + numCommands) {
+            std::cout << "OfflinePlayer: " << path << ":" << lineNumber
+                << ": unknown command " << event.command << std::endl;
+            return false;
+        }
+        std::string arg;
+        while (words >> arg) {
+            event.args.push_back(arg);
+        }
+        if (!checkArgs(event)) {
+            std::cout << "OfflinePlayer: " << path << ":" << lineNumber
+                << ": bad arguments for " << event.command << std::endl;
+            return false;
+        }
+        events.push_back(event);
+    }
+
+    // Events at the same time keep the order they were written in
+    std::stable_sort(events.begin(), events.end(),
+            [](const PlaybackEvent &a, const PlaybackEvent &b) {
+                return a.time < b.time;
+            });
+
+    // A loop plays until it is turned off, so a script that leaves one on
+    // would never end without a stop
+    bool loopLeftOn = false;
+    bool stops = false;
+    for (const PlaybackEvent &event : events) {
+        if (event.command == "loop") {
+            loopLeftOn = event.args.size() == 2;
+        } else if (event.command == "stop") {
+            stops = true;
+        }
+    }
+    if (loopLeftOn && !stops) {
+        std::cout << "OfflinePlayer: " << path
+            << ": the loop is never turned off, so the script needs a stop"
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void OfflinePlayer::setRealTimePace(bool paced) {
+    this->paced = paced;
+}
+
+/**
+ * Convert a position in seconds to a frame of the sound file.
+ */
+int64_t OfflinePlayer::getFrame(const std::string &seconds) const {
+    int64_t frame = (int64_t) (atof(seconds.c_str())
+            * soundFile->getSampleRate());
+    return std::max<int64_t>(0,
+            std::min<int64_t>(frame, soundFile->getLength() - 1));
+}
+
+/**
+ * Make the change for one event.
+ *
+ * @return false if the event isn't understood
+ */
+bool OfflinePlayer::apply(const PlaybackEvent &event) {
+    const std::string &command = event.command;
+    const std::vector<std::string> &args = event.args;
+    std::string arg = args.empty() ? "" : args[0];
+    if (command == "seek" && args.size() == 1) {
+        seekPosition = getFrame(arg);
+        seeked = true;
+    } else if (command == "speed" && args.size() == 1) {
+        settings.speed = atof(arg.c_str()) / 100.0;
+    } else if (command == "transpose" && args.size() == 1) {
+        transpose = atof(arg.c_str());
+    } else if (command == "tuning" && args.size() == 1) {
+        tuning = atof(arg.c_str());
+    } else if (command == "mark" && args.size() == 1) {
+        marks.push_back(getFrame(arg));
+    } else if (command == "loop" && args.size() == 1 && arg == "off") {
+        looping = false;
+    } else if (command == "loop" && args.size() == 2) {
+        selectionStart = getFrame(args[0]);
+        selectionEnd = getFrame(args[1]);
+        looping = true;
+    } else if (command == "delay" && args.size() == 1) {
+        loopDelay = atof(arg.c_str());
+    } else if (command == "stretcher" && arg == "native") {
+        settings.backend = STRETCH_NATIVE;
+    } else if (command == "stretcher" && arg == "rubberband") {
+        settings.backend = STRETCH_RUBBERBAND;
+    } else if (command == "quality" && arg == "low") {
+        quality = QUALITY_LOW;
+    } else if (command == "quality" && arg == "medium") {
+        quality = QUALITY_MEDIUM;
+    } else if (command == "quality" && arg == "high") {
+        quality = QUALITY_HIGH;
+    } else if (command == "stop") {
+        stopped = true;
+    } else {
+        std::cout << "OfflinePlayer: bad arguments for " << command
+            << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Each buffer is made by a PlaybackEngine, as in ofApp::audioOut(), with
+ * events applied between buffers.
+ */
+bool OfflinePlayer::run() {
+    output.clear();
+    settings = CueSettings();
+    quality = QUALITY_MEDIUM;
+    transpose = 0;
+    tuning = 0;
+    marks.clear();
+    selectionStart = 0;
+    selectionEnd = soundFile->getLength();
+    looping = false;
+    loopDelay = 0;
+    stopped = false;
+    stretchSeconds = 0;
+    maxLoad = 0;
+    stretcher.seek(0);
+    stretcher.reset();
+    playback.setDelay(0);
+    playback.setSelection(selectionStart, selectionEnd, SELECTION_CONTINUE);
+    playback.startDelay();
+
+    std::vector<float> buffer(bufferSize * outputChannels);
+    double bufferSeconds = bufferSize / (double) outputRate;
+    size_t nextEvent = 0;
+    int64_t framesPlayed = 0;
+    std::chrono::steady_clock::time_point startTime =
+        std::chrono::steady_clock::now();
+
+    while (!stopped) {
+        double now = framesPlayed / (double) outputRate;
+        if (nextEvent < events.size() && events[nextEvent].time <= now) {
+            seeked = false;
+            while (nextEvent < events.size()
+                    && events[nextEvent].time <= now) {
+                if (!apply(events[nextEvent++])) {
+                    return false;
+                }
+            }
+            if (stopped) {
+                break;
+            }
+            settings.semitones = transpose + tuning / 100.0;
+            stretcher.setSpeed(settings.speed);
+            stretcher.setPitch(settings.semitones);
+            playback.setBackend(settings.backend);
+            playback.setQuality(quality);
+            playback.setDelay(loopDelay);
+            playback.setSelection(selectionStart, selectionEnd,
+                    looping ? SELECTION_LOOP : SELECTION_CONTINUE);
+
+            // Jumps are made once the cues of the new marks are ready
+            std::vector<int64_t> positions(marks);
+            positions.push_back(selectionStart);
+            cueCache.setQuality(quality);
+            cueCache.update(positions, settings);
+            cueCache.wait();
+            if (seeked) {
+                playback.seek(seekPosition);
+            }
+        }
+
+        if (paced) {
+            std::this_thread::sleep_until(startTime
+                    + std::chrono::duration_cast<
+                        std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(now)));
+        }
+
+        if (!playback.process(&buffer[0], bufferSize, outputChannels)) {
+            stopped = true;
+        }
+        double seconds = playback.getStretchTime();
+        stretchSeconds += seconds;
+        maxLoad = std::max(maxLoad, seconds / bufferSeconds);
+        output.insert(output.end(), buffer.begin(), buffer.end());
+        framesPlayed += bufferSize;
+    }
+    return true;
+}
+
+const std::vector<float> &OfflinePlayer::getOutput() const {
+    return output;
+}
+
+/**
+ * Encode the output as a 32-bit float WAV file.
+ */
+void OfflinePlayer::getWav(std::vector<char> &buf) const {
+    const int bytesPerFrame = outputChannels * sizeof(float);
+    uint32_t dataBytes = output.size() * sizeof(float);
+    buf.clear();
+    buf.reserve(wavHeaderBytes + dataBytes);
+    buf.insert(buf.end(), "RIFF", "RIFF" + 4);
+    putLittleEndian(buf, 36 + dataBytes, 4);
+    buf.insert(buf.end(), "WAVE", "WAVE" + 4);
+    buf.insert(buf.end(), "fmt ", "fmt " + 4);
+    putLittleEndian(buf, 16, 4);
+    putLittleEndian(buf, 3, 2); // IEEE float
+    putLittleEndian(buf, outputChannels, 2);
+    putLittleEndian(buf, outputRate, 4);
+    putLittleEndian(buf, outputRate * bytesPerFrame, 4);
+    putLittleEndian(buf, bytesPerFrame, 2);
+    putLittleEndian(buf, 32, 2);
+    buf.insert(buf.end(), "data", "data" + 4);
+    putLittleEndian(buf, dataBytes, 4);
+    for (float sample : output) {
+        uint32_t bits;
+        memcpy(&bits, &sample, sizeof(bits));
+        putLittleEndian(buf, bits, 4);
+    }
+}
+
+bool OfflinePlayer::writeWav(std::string path) const {
+    std::vector<char> buf;
+    getWav(buf);
+    if (!replaceFile(path, buf)) {
+        std::cout << "OfflinePlayer: error writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Both files are compared byte for byte, header and all, so any difference in
+ * length or in a single sample counts.
+ */
+bool OfflinePlayer::matchesWav(std::string path) const {
+    std::vector<char> reference;
+    if (!readFile(path, reference)) {
+        std::cout << "OfflinePlayer: can't read " << path << std::endl;
+        return false;
+    }
+    std::vector<char> buf;
+    getWav(buf);
+    size_t common = std::min(reference.size(), buf.size());
+    size_t offset = std::mismatch(buf.begin(), buf.begin() + common,
+            reference.begin()).first - buf.begin();
+    if (offset == common && reference.size() == buf.size()) {
+        return true;
+    }
+    std::cout << "OfflinePlayer: output differs from " << path;
+    if (offset < wavHeaderBytes) {
+        std::cout << " in the header";
+    } else {
+        size_t frame = (offset - wavHeaderBytes)
+            / (outputChannels * sizeof(float));
+        std::cout << " from " << frame / (double) outputRate << " seconds";
+    }
+    std::cout << std::endl;
+    return false;
+}
+
+double OfflinePlayer::getRealTimeFactor() const {
+    double seconds = output.size() / outputChannels / (double) outputRate;
+    return stretchSeconds > 0 ? seconds / stretchSeconds : 0;
+}
+
+double OfflinePlayer::getMaxLoad() const {
+    return maxLoad;
+}
+
+int renderScript(std::string soundPath, std::string scriptPath,
+        std::string outputPath, bool paced, std::string referencePath) {
+    SoundFile soundFile;
+    if (!soundFile.load(soundPath)) {
+        return 1;
+    }
+    OfflinePlayer player(soundFile, renderRate, renderBufferSize);
+    if (!player.loadScript(scriptPath)) {
+        return 1;
+    }
+    player.setRealTimePace(paced);
+    if (!player.run() || !player.writeWav(outputPath)) {
+        return 1;
+    }
+    std::cout << "Wrote " << outputPath << "\nReal-time factor: "
+        << player.getRealTimeFactor() << "\nLongest buffer: "
+        << player.getMaxLoad() * 100 << "% of its duration" << std::endl;
+    if (referencePath != "") {
+        if (!player.matchesWav(referencePath)) {
+            return 1;
+        }
+        std::cout << "Matches " << referencePath << std::endl;
+    }
+    return 0;
+}
+
+}
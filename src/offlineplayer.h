@@ -0,0 +1,182 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cuecache.h"
+#include "playbackengine.h"
+#include "soundfile.h"
+#include "timestretcher.h"
+
+namespace TuneTutor {
+
+/**
+ * A change to playback made by an OfflinePlayer script when the output
+ * reaches a given time.
+ */
+struct PlaybackEvent {
+
+    /** Output time at which to make the change, in seconds */
+    double time;
+
+    /** The command and its arguments, as written in the script */
+    std::string command;
+    std::vector<std::string> args;
+
+    PlaybackEvent() {
+        time = 0;
+        command = "";
+    }
+};
+
+/**
+ * The OfflinePlayer class plays a tune through the same PlaybackEngine as
+ * ofApp::audioOut(), but driven by a virtual clock instead of a sound card.
+ * The output is kept in memory and can be written to a WAV file, so that
+ * playback can be checked on machines without audio hardware, and compared
+ * bit for bit from one build to the next. It runs as fast as possible, or at
+ * the pace of real time, and measures how much faster than real time the
+ * stretching runs.
+ *
+ * What happens during playback is given by a script, one event per line:
+ *
+ *     # time command arguments; times are output seconds, and positions
+ *     # are seconds into the tune
+ *     0    speed 50
+ *     0    transpose -2
+ *     0    mark 12.5
+ *     0    seek 12.5
+ *     2.5  loop 10 12
+ *     2.5  delay 0.5
+ *     9    stop
+ *
+ * The other commands are `tuning <cents>`, `loop off`,
+ * `stretcher native|rubberband` and `quality low|medium|high`. Playback ends
+ * at `stop` or at the end of the tune; a script that leaves a loop on must
+ * have a `stop`. Events take effect at the start of the
+ * first buffer at or after their time. The quality is fixed, rather than
+ * adapted to the load, and cues are brought up to date before each buffer
+ * that follows an event, so that the output doesn't depend on the machine.
+ */
+class OfflinePlayer {
+
+    public:
+        /**
+         * @param soundFile Must already have a sound loaded via load(), and
+         *        must outlive the OfflinePlayer
+         * @param outputRate the sample rate of the output in Hz
+         * @param bufferSize the number of frames in each buffer
+         */
+        OfflinePlayer(const SoundFile &soundFile, int outputRate,
+                int bufferSize);
+
+        /**
+         * @param path the full path to a script file
+         * @return false if the file couldn't be read or has an error
+         */
+        bool loadScript(std::string path);
+
+        /** @param paced true to play at the pace of real time */
+        void setRealTimePace(bool paced);
+
+        /**
+         * Play the script from the beginning.
+         * @return false if an event couldn't be applied
+         */
+        bool run();
+
+        /** @return the stereo output, interleaved by channel */
+        const std::vector<float> &getOutput() const;
+
+        /**
+         * Write the output as a 32-bit float WAV file.
+         * @return false if the file couldn't be written
+         */
+        bool writeWav(std::string path) const;
+
+        /**
+         * Compare the output with a WAV file written by writeWav(), such as a
+         * render of the same script by an earlier build, and print where
+         * they first differ.
+         *
+         * @return true if the file is identical to the output
+         */
+        bool matchesWav(std::string path) const;
+
+        /** @return seconds of output per second spent stretching */
+        double getRealTimeFactor() const;
+
+        /**
+         * @return the longest time spent stretching one buffer, as a
+         *         fraction of the buffer's duration
+         */
+        double getMaxLoad() const;
+
+    private:
+        static const int outputChannels = 2;
+
+        const SoundFile *soundFile;
+        TimeStretcher stretcher;
+        CueCache cueCache;
+        PlaybackEngine playback;
+        int outputRate;
+        int bufferSize;
+        bool paced;
+        std::vector<PlaybackEvent> events;
+
+        // Playback state, changed by the events
+        CueSettings settings;
+        StretchQuality quality;
+        double transpose;
+        double tuning;
+        std::vector<int64_t> marks;
+        int64_t selectionStart;
+        int64_t selectionEnd;
+        bool looping;
+        double loopDelay;
+        bool stopped;
+        bool seeked;
+        int64_t seekPosition;
+
+        std::vector<float> output;
+        double stretchSeconds;
+        double maxLoad;
+
+        bool apply(const PlaybackEvent &event);
+        void getWav(std::vector<char> &buf) const;
+        int64_t getFrame(const std::string &seconds) const;
+};
+
+/**
+ * Play a tune offline according to a script, write the output to a WAV file,
+ * and print the real-time factor.
+ *
+ * @param soundPath the full path to the sound file
+ * @param scriptPath the full path to the script; see OfflinePlayer
+ * @param outputPath the full path of the WAV file to write
+ * @param paced true to play at the pace of real time
+ * @param referencePath the full path of a WAV file that the output must match
+ *        exactly, or "" for none
+ * @return 0 on success, or 1 on failure or if the output doesn't match
+ */
+int renderScript(std::string soundPath, std::string scriptPath,
+        std::string outputPath, bool paced, std::string referencePath = "");
+
+}
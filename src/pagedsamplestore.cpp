@@ -0,0 +1,251 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "pagedsamplestore.h"
+
+namespace TuneTutor {
+
+PagedSampleStore::PagedSampleStore(Decoder decoder, int channels,
+        int64_t length, size_t maxBytes, SampleFormat format) {
+    this->decoder = decoder;
+    this->channels = channels;
+    this->length = length;
+    this->format = format;
+
+    // Leave room for the prefetched pages, the page being played, and the one
+    // before it, however small the limit
+    size_t pageBytes = (size_t) pageFrames * channels
+        * SampleBuffer::getBytesPerSample(format);
+    maxPages = std::max(maxBytes / pageBytes, (size_t) prefetchPages + 2);
+
+    useCount = 0;
+    prefetchPage = 0;
+    prefetchPending = false;
+    stopping = false;
+    lastPrefetchPage = -1;
+    prefetchThread = std::thread(&PagedSampleStore::runPrefetch, this);
+}
+
+void PagedSampleStore::read(int64_t start, size_t count, float *out,
+        bool wait) {
+    size_t done = 0;
+    while (done < count) {
+        int64_t frame = start + done;
+        size_t n;
+        if (frame < 0) {
+            n = std::min((int64_t) (count - done), -frame);
+            memset(out + done * channels, 0, n * channels * sizeof(float));
+        } else if (frame >= length) {
+            n = count - done;
+            memset(out + done * channels, 0, n * channels * sizeof(float));
+        } else {
+            // The page stays alive while it is copied from, even if another
+            // thread evicts it meanwhile
+            int64_t index = frame / pageFrames;
+            std::shared_ptr<Page> page = wait ? getPage(index)
+                : tryGetPage(index);
+            size_t offset = frame % pageFrames;
+            if (page) {
+                n = std::min(count - done,
+                        page->samples.size() / channels - offset);
+                page->samples.load(offset * channels, n * channels,
+                        out + done * channels);
+            } else {
+                n = std::min(count - done, (size_t) pageFrames - offset);
+                memset(out + done * channels, 0,
+                        n * channels * sizeof(float));
+            }
+        }
+        done += n;
+    }
+}
+
+/**
+ * Get a page from the cache and mark it as used, or NULL if it isn't there.
+ * Called with the mutex held.
+ */
+std::shared_ptr<PagedSampleStore::Page> PagedSampleStore::findPage(
+        int64_t index) {
+    std::map<int64_t, std::shared_ptr<Page> >::iterator it =
+        pages.find(index);
+    if (it == pages.end()) {
+        return std::shared_ptr<Page>();
+    }
+    it->second->lastUsed = ++useCount;
+    return it->second;
+}
+
+/**
+ * Get a page from the cache, or decode it if it isn't there. A page that
+ * can't be decoded in full is returned padded with silence, but isn't cached,
+ * so that it is decoded again next time.
+ */
+std::shared_ptr<PagedSampleStore::Page> PagedSampleStore::getPage(
+        int64_t index) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Page> page = findPage(index);
+        if (page) {
+            return page;
+        }
+    }
+
+    std::lock_guard<std::mutex> decodeLock(decodeMutex);
+
+    // Another thread may have decoded the page while this one waited
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Page> page = findPage(index);
+        if (page) {
+            return page;
+        }
+    }
+
+    std::shared_ptr<Page> page(new Page());
+    int64_t first = index * pageFrames;
+    size_t frames = std::min((int64_t) pageFrames, length - first);
+    decodeBuffer.resize(frames * channels);
+    size_t decoded = decoder(first, frames, &decodeBuffer[0]);
+    if (decoded < frames) {
+        std::fill(decodeBuffer.begin() + decoded * channels,
+                decodeBuffer.end(), 0.0f);
+    }
+    page->samples.reset(format, frames * channels);
+    page->samples.store(0, &decodeBuffer[0], frames * channels);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    page->lastUsed = ++useCount;
+    if (decoded < frames) {
+        std::cout << "PagedSampleStore: can't decode page " << index
+            << std::endl;
+        return page;
+    }
+    pages[index] = page;
+    evict();
+    return page;
+}
+
+/**
+ * Get a page from the cache without waiting for the mutex or the decoder, or
+ * NULL if it isn't ready. A page that isn't cached is asked for from the
+ * prefetch thread.
+ */
+std::shared_ptr<PagedSampleStore::Page> PagedSampleStore::tryGetPage(
+        int64_t index) {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return std::shared_ptr<Page>();
+    }
+    std::shared_ptr<Page> page = findPage(index);
+    lock.unlock();
+    if (!page && lastPrefetchPage.exchange(index) != index) {
+        requestPages(index);
+    }
+    return page;
+}
+
+/**
+ * Remove the least recently used pages until there are no more than maxPages.
+ * Called with the mutex held.
+ */
+void PagedSampleStore::evict() {
+    while (pages.size() > maxPages) {
+        std::map<int64_t, std::shared_ptr<Page> >::iterator oldest =
+            pages.begin();
+        for (std::map<int64_t, std::shared_ptr<Page> >::iterator it =
+                    pages.begin(); it != pages.end(); ++it) {
+            if (it->second->lastUsed < oldest->second->lastUsed) {
+                oldest = it;
+            }
+        }
+        pages.erase(oldest);
+    }
+}
+
+void PagedSampleStore::prefetch(int64_t position) {
+    if (position < 0 || position >= length) {
+        return;
+    }
+    int64_t index = position / pageFrames;
+    if (lastPrefetchPage.exchange(index) == index) {
+        return;
+    }
+    requestPages(index);
+}
+
+/**
+ * Wake the prefetch thread to decode the pages from the given one on. Since
+ * it is called from the audio thread, it doesn't wait for the mutex; if the
+ * mutex is busy, the request is left for the next call to prefetch().
+ */
+void PagedSampleStore::requestPages(int64_t index) {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        lastPrefetchPage = -1;
+        return;
+    }
+    prefetchPage = index;
+    prefetchPending = true;
+    wake.notify_one();
+}
+
+void PagedSampleStore::runPrefetch() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return prefetchPending || stopping; });
+        if (stopping) {
+            break;
+        }
+        prefetchPending = false;
+        int64_t first = prefetchPage;
+
+        // Give up on this run as soon as there is a newer position
+        for (int64_t index = first; index <= first + prefetchPages
+                && index * pageFrames < length; index++) {
+            if (stopping || prefetchPending) {
+                break;
+            }
+            lock.unlock();
+            getPage(index);
+            lock.lock();
+        }
+    }
+}
+
+size_t PagedSampleStore::getMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const std::pair<const int64_t, std::shared_ptr<Page> > &page
+            : pages) {
+        bytes += page.second->samples.getMemoryUsage();
+    }
+    return bytes;
+}
+
+PagedSampleStore::~PagedSampleStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        wake.notify_one();
+    }
+    prefetchThread.join();
+}
+
+}
@@ -0,0 +1,140 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "samplebuffer.h"
+
+namespace TuneTutor {
+
+/**
+ * The PagedSampleStore class provides the sample data of a recording that is
+ * too long to keep in memory all at once. The recording is divided into pages
+ * of a fixed number of frames, which are decoded on demand and kept in a
+ * least-recently-used cache of bounded size. A background thread decodes the
+ * pages following the position passed to prefetch(), so that playback rarely
+ * has to wait for the decoder. Pages may be kept in a compact SampleFormat,
+ * so that more of them fit in the same memory.
+ *
+ * The audio thread reads with wait set to false, so that it never decodes a
+ * page or blocks on the cache: a page that isn't ready yet is read as
+ * silence, and left to the background thread.
+ */
+class PagedSampleStore {
+
+    public:
+
+        /**
+         * Decodes the given number of frames starting at the given frame into
+         * a buffer of interleaved samples, and returns the number of frames
+         * decoded. It is only ever called by one thread at a time.
+         */
+        typedef std::function<size_t(int64_t, size_t, float *)> Decoder;
+
+        /** The number of frames in each page */
+        static const int pageFrames = 65536;
+
+        /**
+         * @param decoder the function that decodes the recording
+         * @param channels the number of interleaved channels
+         * @param length the length of the recording in frames
+         * @param maxBytes the most memory to use for decoded pages
+         * @param format the format in which to keep decoded pages
+         */
+        PagedSampleStore(Decoder decoder, int channels, int64_t length,
+                size_t maxBytes, SampleFormat format = SAMPLE_FLOAT32);
+        ~PagedSampleStore();
+
+        /**
+         * Get frames of interleaved samples. Frames outside the recording are
+         * zero. May be called from any thread.
+         *
+         * @param start the first frame to get
+         * @param count the number of frames to get
+         * @param out the buffer for count * channels samples
+         * @param wait true to decode any pages that aren't cached, or false
+         *        to read them as silence and have them decoded in the
+         *        background, so that the call never blocks
+         */
+        void read(int64_t start, size_t count, float *out, bool wait = true);
+
+        /**
+         * Start decoding the pages following the given position in the
+         * background. Returns immediately.
+         *
+         * @param position the frame that playback has reached
+         */
+        void prefetch(int64_t position);
+
+        /** @return the number of bytes used by cached pages */
+        size_t getMemoryUsage() const;
+
+    private:
+        // Pages decoded ahead of the prefetch position
+        const int prefetchPages = 4;
+
+        struct Page {
+            SampleBuffer samples;
+            uint64_t lastUsed;
+        };
+
+        Decoder decoder;
+        int channels;
+        int64_t length;
+        size_t maxPages;
+        SampleFormat format;
+
+        // Guards pages and useCount. Pages are decoded without holding it,
+        // so that cached pages can be read while another is being decoded.
+        mutable std::mutex mutex;
+        std::map<int64_t, std::shared_ptr<Page> > pages;
+        uint64_t useCount;
+
+        // Held while decoding, since the decoder isn't thread-safe, and while
+        // using the buffer that pages are decoded into before conversion
+        std::mutex decodeMutex;
+        std::vector<float> decodeBuffer;
+
+        std::thread prefetchThread;
+        std::condition_variable wake;
+        int64_t prefetchPage;
+        bool prefetchPending;
+        bool stopping;
+
+        // The page last passed to prefetch(), to avoid waking the thread on
+        // every call
+        std::atomic<int64_t> lastPrefetchPage;
+
+        std::shared_ptr<Page> findPage(int64_t index);
+        std::shared_ptr<Page> getPage(int64_t index);
+        std::shared_ptr<Page> tryGetPage(int64_t index);
+        void requestPages(int64_t index);
+        void evict();
+        void runPrefetch();
+};
+
+}
@@ -0,0 +1,286 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "binaryio.h"
+#include "phraseindex.h"
+#include "util.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Version 2 follows the smoothed pitch track, whose notes differ from those of
+// the raw pitches, so that older indexes are rebuilt
+const char fileMagic[4] = {'T', 'T', 'N', 2};
+
+/** Shortest run of pitch values that counts as a note, in milliseconds */
+const double minNoteMs = 60;
+
+/** Intervals are clamped to this many semitones so that they fit in 6 bits */
+const int maxInterval = 31;
+
+/**
+ * Pack phraseLength intervals, starting at the given one, into an n-gram key.
+ */
+uint32_t getKey(const std::vector<int> &intervals, size_t start) {
+    uint32_t key = 0;
+    for (int i = 0; i < PhraseIndex::phraseLength; i++) {
+        int interval = std::max(-maxInterval,
+                std::min(maxInterval, intervals[start + i]));
+        key = (key << 6) | (uint32_t) (interval + 32);
+    }
+    return key;
+}
+
+}
+
+std::vector<PhraseNote> getPhraseNotes(const std::vector<float> &pitches,
+        int sampleInterval, int sampleRate, int startFrame) {
+    std::vector<PhraseNote> notes;
+    if (sampleRate <= 0 || sampleInterval <= 0) {
+        return notes;
+    }
+    size_t minRun = std::max(1.0, std::ceil(minNoteMs / 1000 * sampleRate
+                / sampleInterval));
+
+    size_t runStart = 0;
+    while (runStart < pitches.size()) {
+        int pitch = std::lround(pitches[runStart]);
+        size_t runEnd = runStart + 1;
+        while (runEnd < pitches.size()
+                && std::lround(pitches[runEnd]) == pitch) {
+            runEnd++;
+        }
+
+        // The pitch detector reports 0 where it finds no pitch
+        if (pitch > 0 && pitch < 128 && runEnd - runStart >= minRun
+                && (notes.empty() || notes.back().pitch != pitch)) {
+            PhraseNote note;
+            note.pitch = pitch;
+            note.startMs = (startFrame + (double) runStart * sampleInterval)
+                * 1000 / sampleRate;
+            notes.push_back(note);
+        }
+        runStart = runEnd;
+    }
+    return notes;
+}
+
+std::vector<int> getPhraseIntervals(const std::vector<PhraseNote> &notes) {
+    std::vector<int> intervals;
+    for (size_t i = 1; i < notes.size(); i++) {
+        intervals.push_back(notes[i].pitch - notes[i - 1].pitch);
+    }
+    return intervals;
+}
+
+PhraseIndex::PhraseIndex() {
+    path = "";
+    fileStarted = false;
+    readableLength = 0;
+}
+
+bool PhraseIndex::load(std::string path) {
+    this->path = path;
+    fileStarted = false;
+    readableLength = 0;
+    tunes.clear();
+    tunesByHash.clear();
+    postings.clear();
+
+    std::vector<char> data;
+    if (!readFile(path, data)) {
+        return false;
+    }
+    if (data.size() < sizeof(fileMagic)
+            || memcmp(&data[0], fileMagic, sizeof(fileMagic)) != 0) {
+        std::cout << "PhraseIndex: " << path << " is not a phrase index"
+            << std::endl;
+        return false;
+    }
+    fileStarted = true;
+
+    BinaryReader r(&data[sizeof(fileMagic)], data.size() - sizeof(fileMagic));
+    size_t recordStart = 0;
+    while (!r.atEnd()) {
+        recordStart = r.getPosition();
+        std::string hash;
+        uint32_t count;
+        if (!r.getString(hash) || !r.get(count)) {
+            break;
+        }
+        std::vector<PhraseNote> notes(count);
+        bool ok = true;
+        for (uint32_t i = 0; ok && i < count; i++) {
+            int8_t pitch;
+            ok = r.get(notes[i].startMs) && r.get(pitch);
+            notes[i].pitch = pitch;
+        }
+        if (!ok) {
+            break;
+        }
+        addToIndex(hash, notes);
+    }
+    if (!r.atEnd()) {
+        std::cout << "PhraseIndex: ignoring truncated record in " << path
+            << std::endl;
+        readableLength = sizeof(fileMagic) + recordStart;
+    }
+    return true;
+}
+
+bool PhraseIndex::contains(std::string hash) const {
+    return tunesByHash.count(hash) > 0;
+}
+
+bool PhraseIndex::add(std::string hash, const std::vector<PhraseNote> &notes) {
+    if (contains(hash)) {
+        return true;
+    }
+
+    std::vector<char> buf;
+    if (!fileStarted) {
+        buf.insert(buf.end(), fileMagic, fileMagic + sizeof(fileMagic));
+    }
+    putString(buf, hash);
+    put<uint32_t>(buf, notes.size());
+    for (const PhraseNote &note : notes) {
+        put(buf, note.startMs);
+        put<int8_t>(buf, note.pitch);
+    }
+
+    // The whole file is rewritten when it is started, in case there was an
+    // unreadable file there, and when it ends in a torn record, which would
+    // hide anything appended after it
+    bool ok;
+    if (path == "") {
+        ok = false;
+    } else if (!fileStarted) {
+        ok = replaceFile(path, buf);
+    } else if (readableLength > 0) {
+        std::vector<char> data;
+        ok = readFile(path, data) && data.size() >= readableLength;
+        if (ok) {
+            data.resize(readableLength);
+            data.insert(data.end(), buf.begin(), buf.end());
+            ok = replaceFile(path, data);
+        }
+    } else {
+        // An append that fails partway may leave a torn record, which the
+        // next add() cuts off; if the file has gone, it is started again
+        FileInfo info;
+        if (!getFileInfo(path, info)) {
+            fileStarted = false;
+            ok = false;
+        } else if (!writeFile(path, buf, "ab")) {
+            readableLength = info.size;
+            ok = false;
+        } else {
+            ok = true;
+        }
+    }
+    if (!ok) {
+        std::cout << "PhraseIndex: error writing " << path << std::endl;
+        return false;
+    }
+    fileStarted = true;
+    readableLength = 0;
+    addToIndex(hash, notes);
+    return true;
+}
+
+void PhraseIndex::addToIndex(const std::string &hash,
+        const std::vector<PhraseNote> &notes) {
+    if (contains(hash)) {
+        return;
+    }
+    uint32_t tuneIndex = tunes.size();
+    tunesByHash[hash] = tuneIndex;
+    tunes.push_back(Tune());
+    tunes.back().hash = hash;
+    for (const PhraseNote &note : notes) {
+        tunes.back().noteStarts.push_back(note.startMs);
+    }
+
+    std::vector<int> intervals = getPhraseIntervals(notes);
+    for (size_t i = 0; i + phraseLength <= intervals.size(); i++) {
+        Posting posting;
+        posting.tune = tuneIndex;
+        posting.note = i;
+        postings[getKey(intervals, i)].push_back(posting);
+    }
+}
+
+int PhraseIndex::size() const {
+    return tunes.size();
+}
+
+std::vector<PhraseMatch> PhraseIndex::search(
+        const std::vector<int> &intervals, int maxResults) const {
+    std::vector<PhraseMatch> matches;
+    if (intervals.size() < (size_t) phraseLength) {
+        return matches;
+    }
+
+    // Each hit votes for the note where the phrase would start, keyed by tune
+    // and note index
+    std::unordered_map<uint64_t, int> votes;
+    int ngrams = intervals.size() - phraseLength + 1;
+    for (int i = 0; i < ngrams; i++) {
+        std::unordered_map<uint32_t, std::vector<Posting> >::const_iterator
+            it = postings.find(getKey(intervals, i));
+        if (it == postings.end()) {
+            continue;
+        }
+        for (const Posting &posting : it->second) {
+            if (posting.note >= (uint32_t) i) {
+                votes[((uint64_t) posting.tune << 32)
+                    | (posting.note - i)]++;
+            }
+        }
+    }
+
+    int minScore = (ngrams + 1) / 2;
+    for (const std::pair<const uint64_t, int> &vote : votes) {
+        if (vote.second >= minScore) {
+            const Tune &tune = tunes[vote.first >> 32];
+            PhraseMatch match;
+            match.hash = tune.hash;
+            match.offsetMs = tune.noteStarts[vote.first & 0xffffffff];
+            match.score = vote.second;
+            matches.push_back(match);
+        }
+    }
+    std::sort(matches.begin(), matches.end(),
+            [](const PhraseMatch &a, const PhraseMatch &b) {
+                if (a.score != b.score) {
+                    return a.score > b.score;
+                }
+                return a.hash != b.hash ? a.hash < b.hash
+                    : a.offsetMs < b.offsetMs;
+            });
+    if ((int) matches.size() > maxResults) {
+        matches.resize(maxResults);
+    }
+    return matches;
+}
+
+}
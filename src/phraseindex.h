@@ -0,0 +1,161 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * A note found in a pitch track.
+ */
+struct PhraseNote {
+
+    /** MIDI note number */
+    int pitch;
+
+    /** Start time in milliseconds from the beginning of the tune */
+    uint32_t startMs;
+};
+
+/**
+ * Turn a pitch track into a sequence of notes. A note is a run of pitch
+ * values that round to the same semitone and last long enough to be heard as
+ * a note. Shorter runs, such as slides and ornaments, are ignored, and a run
+ * at the same pitch as the previous note is taken to be part of it, so
+ * consecutive notes always differ in pitch.
+ *
+ * @param pitches pitch values as returned by PitchDetector::getPitches()
+ * @param sampleInterval the number of sample frames per pitch value
+ * @param sampleRate the sample rate of the audio
+ * @param startFrame the sample frame of the first pitch value
+ */
+std::vector<PhraseNote> getPhraseNotes(const std::vector<float> &pitches,
+        int sampleInterval, int sampleRate, int startFrame = 0);
+
+/**
+ * @return the interval in semitones from each note to the next
+ */
+std::vector<int> getPhraseIntervals(const std::vector<PhraseNote> &notes);
+
+/**
+ * A place where a phrase was found.
+ */
+struct PhraseMatch {
+
+    /** Content hash of the tune */
+    std::string hash;
+
+    /** Time in milliseconds from the beginning of the tune */
+    uint32_t offsetMs;
+
+    /** The number of n-grams of the phrase found at this place */
+    int score;
+};
+
+/**
+ * The PhraseIndex class finds tunes containing a phrase, regardless of the key
+ * it is played in. It holds the note sequence of every tune added to it, and
+ * an inverted index from each run of phraseLength consecutive intervals
+ * (interval n-gram) to the places in the tunes where it occurs. A phrase is
+ * looked up by its own n-grams, and each hit votes for a place where the
+ * phrase would start; the places with the most votes are the matches, so a
+ * phrase with a wrong note still matches on its other n-grams.
+ *
+ * The note sequences are kept in an append-only file, with one record per tune
+ * so that adding a tune doesn't rewrite the file. The inverted index is rebuilt
+ * in memory when the file is loaded. A record torn by an interrupted write is
+ * ignored, and cut off before the next tune is appended.
+ */
+class PhraseIndex {
+
+    public:
+        /** The number of intervals in each n-gram */
+        static const int phraseLength = 4;
+
+        PhraseIndex();
+
+        /**
+         * @param path the full path to the index file
+         * @return true if the file existed and was loaded
+         */
+        bool load(std::string path);
+
+        /** @return true if the tune with the given hash has been added */
+        bool contains(std::string hash) const;
+
+        /**
+         * Add a tune and append it to the index file. Does nothing if the tune
+         * has already been added.
+         *
+         * @param hash the content hash of the tune
+         * @param notes the notes of the whole tune, from getPhraseNotes()
+         * @return false if the index file couldn't be written
+         */
+        bool add(std::string hash, const std::vector<PhraseNote> &notes);
+
+        /** @return the number of tunes */
+        int size() const;
+
+        /**
+         * Find the places where a phrase occurs.
+         *
+         * @param intervals the intervals of the phrase in semitones; there
+         *        must be at least phraseLength of them
+         * @param maxResults the maximum number of matches to return
+         * @return matches where at least half of the phrase's n-grams were
+         *         found, best first
+         */
+        std::vector<PhraseMatch> search(const std::vector<int> &intervals,
+                int maxResults) const;
+
+    private:
+        std::string path;
+
+        /** Whether the file has been started with the magic number */
+        bool fileStarted;
+
+        /**
+         * The length of the readable part of the file if it ends in a torn
+         * record, or may after a failed append, which the next add() cuts
+         * off; otherwise 0
+         */
+        size_t readableLength;
+
+        struct Tune {
+            std::string hash;
+            std::vector<uint32_t> noteStarts;
+        };
+        std::vector<Tune> tunes;
+        std::map<std::string, int> tunesByHash;
+
+        /** An occurrence of an n-gram: the tune and the index of its note */
+        struct Posting {
+            uint32_t tune;
+            uint32_t note;
+        };
+        std::unordered_map<uint32_t, std::vector<Posting> > postings;
+
+        void addToIndex(const std::string &hash,
+                const std::vector<PhraseNote> &notes);
+};
+
+}
@@ -0,0 +1,295 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "pitchbenchmark.h"
+#include "pitchdetector.h"
+#include "pitchsmoother.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const int sampleRate = 44100;
+const int numMelodies = 20;
+const double melodySeconds = 8;
+
+/** Pitches of the melodies: D major from D4 to D6 */
+const int scale[] = {62, 64, 66, 67, 69, 71, 73, 74, 76, 78, 79, 81, 83, 86};
+
+/** Truth of a hop that straddles a note boundary, which isn't scored */
+const float unscored = -1;
+
+struct Note {
+    int64_t start;
+    int64_t end;
+    int pitch;
+};
+
+/**
+ * A synthetic melody, its notes, and the pitch each hop should be given, or
+ * 0 for none.
+ */
+struct Melody {
+    std::vector<float> audio;
+    std::vector<Note> notes;
+    std::vector<float> truth;
+};
+
+/**
+ * @param noise the level of white noise, from 0 to 1
+ * @param clicks if true, some notes start with a percussive click
+ */
+Melody synthesize(std::mt19937 &generator, float noise, bool clicks) {
+    std::uniform_real_distribution<double> uniform(0, 1);
+    std::normal_distribution<float> gaussian(0, 1);
+    Melody melody;
+    int64_t length = melodySeconds * sampleRate;
+    melody.audio.assign(length, 0);
+
+    int64_t pos = 0;
+    while (pos < length) {
+        if (uniform(generator) < 0.2) {
+            pos += (0.05 + 0.15 * uniform(generator)) * sampleRate;
+        }
+        Note note;
+        note.start = pos;
+        double seconds = 0.08 + 0.32 * uniform(generator);
+        note.end = std::min(length, pos + (int64_t) (seconds * sampleRate));
+        note.pitch = scale[generator() % (sizeof(scale) / sizeof(scale[0]))];
+        melody.notes.push_back(note);
+        pos = note.end;
+    }
+
+    const double harmonics[] = {1, 0.6, 0.4, 0.25, 0.15};
+    for (const Note &note : melody.notes) {
+        int64_t frames = note.end - note.start;
+        bool vibrato = frames > 0.25 * sampleRate;
+        double phase = 0;
+        for (int64_t i = 0; i < frames; i++) {
+            double t = i / (double) sampleRate;
+            double pitch = note.pitch
+                + (vibrato ? 0.15 * std::sin(2 * M_PI * 5.5 * t) : 0);
+            phase += 2 * M_PI * 440 * std::pow(2, (pitch - 69) / 12)
+                / sampleRate;
+            double envelope = std::min(1.0, std::min(t / 0.005,
+                        (frames - i) / (0.02 * sampleRate)));
+            double sample = 0;
+            for (int h = 0; h < 5; h++) {
+                sample += harmonics[h] * std::sin((h + 1) * phase);
+            }
+            melody.audio[note.start + i] = 0.2 * envelope * sample;
+        }
+        if (clicks && uniform(generator) < 0.5) {
+            for (int64_t i = 0; i < 0.04 * sampleRate
+                    && note.start + i < length; i++) {
+                melody.audio[note.start + i] += gaussian(generator)
+                    * std::exp(-i / (0.005 * sampleRate));
+            }
+        }
+    }
+    for (float &sample : melody.audio) {
+        sample += noise * gaussian(generator);
+    }
+
+    // The estimate for a hop comes from the buffer that ends with it, so it
+    // is scored against the middle of that buffer, unless the buffer spans
+    // the start or end of a note
+    int hop = PitchTracker::hopSize;
+    int window = PitchTracker::bufferSize / 2;
+    size_t hops = length / hop;
+    melody.truth.assign(hops, 0);
+    size_t n = 0;
+    for (size_t i = 0; i < hops; i++) {
+        int64_t centre = (int64_t) (i + 1) * hop - window;
+        while (n < melody.notes.size() && melody.notes[n].end <= centre) {
+            n++;
+        }
+        for (size_t m = n > 0 ? n - 1 : 0; m < n + 2
+                && m < melody.notes.size(); m++) {
+            const Note &note = melody.notes[m];
+            if (std::abs(note.start - centre) < window
+                    || std::abs(note.end - centre) < window) {
+                melody.truth[i] = unscored;
+            }
+        }
+        if (melody.truth[i] != unscored && n < melody.notes.size()
+                && melody.notes[n].start <= centre) {
+            melody.truth[i] = melody.notes[n].pitch;
+        }
+    }
+    return melody;
+}
+
+/**
+ * The post-processing that PitchTracker did before PitchSmoother: hold the
+ * last pitch for up to ten hops over a doubtful estimate.
+ */
+std::vector<float> holdSpurious(const std::vector<PitchEstimate> &raw) {
+    std::vector<float> pitches;
+    float lastPitch = 0;
+    int spuriousHold = 0;
+    for (size_t i = 0; i < raw.size(); i++) {
+        float pitch = raw[i].pitch;
+        if (i > 0 && spuriousHold < 10 && (raw[i].confidence < 0.50
+                    || (lastPitch - pitch) > 7)) {
+            pitch = lastPitch;
+            spuriousHold++;
+        } else {
+            spuriousHold = 0;
+        }
+        lastPitch = pitch;
+        pitches.push_back(pitch);
+    }
+    return pitches;
+}
+
+std::vector<float> smooth(const std::vector<PitchEstimate> &raw,
+        int binsPerSemitone, int lag) {
+    std::vector<float> pitches;
+    PitchSmoother smoother(binsPerSemitone, lag);
+    PitchEstimate smoothed;
+    for (const PitchEstimate &estimate : raw) {
+        smoother.push(estimate);
+        while (smoother.pop(smoothed)) {
+            pitches.push_back(smoothed.pitch);
+        }
+    }
+    smoother.finish();
+    while (smoother.pop(smoothed)) {
+        pitches.push_back(smoothed.pitch);
+    }
+    return pitches;
+}
+
+/** Totals for one way of post-processing over all the melodies */
+struct Score {
+    const char *name;
+    int binsPerSemitone;
+    int lag;
+    int64_t pitched;
+    int64_t correct;
+    int64_t unpitched;
+    int64_t falsePitches;
+    double seconds;
+};
+
+void tally(Score &score, const std::vector<float> &pitches,
+        const std::vector<float> &truth) {
+    for (size_t i = 0; i < truth.size(); i++) {
+        if (truth[i] > 0) {
+            score.pitched++;
+            if (pitches[i] > 0 && std::fabs(pitches[i] - truth[i]) <= 0.5) {
+                score.correct++;
+            }
+        } else if (truth[i] == 0) {
+            score.unpitched++;
+            if (pitches[i] > 0) {
+                score.falsePitches++;
+            }
+        }
+    }
+}
+
+double getSeconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+void runCondition(const char *title, float noise, bool clicks) {
+    Score scores[] = {
+        {"raw", 0, 0, 0, 0, 0, 0, 0},
+        {"hold", 0, 0, 0, 0, 0, 0, 0},
+        {"viterbi", 2, 16, 0, 0, 0, 0, 0},
+        {"viterbi", 2, 48, 0, 0, 0, 0, 0},
+        {"viterbi", 4, 48, 0, 0, 0, 0, 0},
+        {"viterbi", 8, 48, 0, 0, 0, 0, 0}
+    };
+    const int numScores = sizeof(scores) / sizeof(scores[0]);
+    double detectionSeconds = 0;
+    int64_t hops = 0;
+
+    std::mt19937 generator(1);
+    for (int m = 0; m < numMelodies; m++) {
+        Melody melody = synthesize(generator, noise, clicks);
+
+        std::vector<PitchEstimate> raw;
+        PitchTracker tracker(sampleRate);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (size_t i = 0; i < melody.truth.size(); i++) {
+            raw.push_back(tracker.process(
+                        &melody.audio[i * PitchTracker::hopSize]));
+        }
+        detectionSeconds += getSeconds(start);
+        hops += raw.size();
+
+        for (int s = 0; s < numScores; s++) {
+            std::vector<float> pitches;
+            start = std::chrono::steady_clock::now();
+            if (s == 0) {
+                for (const PitchEstimate &estimate : raw) {
+                    pitches.push_back(estimate.pitch);
+                }
+            } else if (s == 1) {
+                pitches = holdSpurious(raw);
+            } else {
+                pitches = smooth(raw, scores[s].binsPerSemitone,
+                        scores[s].lag);
+            }
+            scores[s].seconds += getSeconds(start);
+            tally(scores[s], pitches, melody.truth);
+        }
+    }
+
+    std::cout << title << ": " << hops << " hops, detection "
+        << detectionSeconds * 1e6 / hops << " us per hop" << std::endl;
+    std::cout << "  method    bins  lag  accuracy     false    us/hop"
+        "  of detection" << std::endl;
+    char line[100];
+    for (const Score &score : scores) {
+        snprintf(line, sizeof(line),
+                "  %-8s %5d %4d %8.1f%% %8.1f%% %9.3f %12.2f%%", score.name,
+                score.binsPerSemitone, score.lag,
+                100.0 * score.correct / std::max<int64_t>(1, score.pitched),
+                100.0 * score.falsePitches
+                    / std::max<int64_t>(1, score.unpitched),
+                score.seconds * 1e6 / hops,
+                100 * score.seconds / detectionSeconds);
+        std::cout << line << std::endl;
+    }
+}
+
+}
+
+int benchmarkPitchSmoothing() {
+    std::cout << "Accuracy is the share of pitched hops within half a "
+        "semitone; false is the share of unpitched hops given a pitch"
+        << std::endl;
+    runCondition("Clean", 0.002, false);
+    runCondition("Noisy", 0.03, true);
+    runCondition("Very noisy", 0.1, true);
+    return 0;
+}
+
+}
@@ -0,0 +1,35 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace TuneTutor {
+
+/**
+ * Measure how accurately and how quickly the pitch track is smoothed, on
+ * synthetic melodies whose notes are known. Each melody is a run of notes
+ * from a scale with harmonics, vibrato on the longer notes, and rests between
+ * some of them, played cleanly and then with two levels of noise and
+ * percussive clicks. The raw PitchTracker estimates are compared with the
+ * old heuristic that held the last pitch over doubtful hops, and with
+ * PitchSmoother at several resolutions and lags. The results are printed to
+ * standard output.
+ *
+ * @return 0
+ */
+int benchmarkPitchSmoothing();
+
+}
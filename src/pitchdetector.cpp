@@ -14,55 +14,263 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+#include "binaryio.h"
 #include "pitchdetector.h"
+#include "pitchsmoother.h"
 
 namespace TuneTutor {
 
-PitchDetector::PitchDetector(const SoundFile &soundFile) {
+namespace {
+
+const char fileMagic[4] = {'T', 'T', 'P', 3};
+
+// Aubio's FFT setup is not safe to run on several threads at once
+std::mutex aubioMutex;
+
+/**
+ * Look in a sorted vector for a value nearer to a position than the given
+ * distance, and if there is one, set best to it.
+ *
+ * @return the distance from the position to best
+ */
+int64_t findNearest(const std::vector<int64_t> &sorted, int64_t position,
+        int64_t distance, int64_t &best) {
+    std::vector<int64_t>::const_iterator it =
+        std::lower_bound(sorted.begin(), sorted.end(), position);
+    if (it != sorted.end() && *it - position < distance) {
+        distance = *it - position;
+        best = *it;
+    }
+    if (it != sorted.begin() && position - *(it - 1) < distance) {
+        distance = position - *(it - 1);
+        best = *(it - 1);
+    }
+    return distance;
+}
+
+bool getPositions(BinaryReader &r, std::vector<int64_t> &positions) {
+    uint32_t count;
+    if (!r.get(count)) {
+        return false;
+    }
+    positions.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!r.get(positions[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void putPositions(std::vector<char> &buf,
+        const std::vector<int64_t> &positions) {
+    put<uint32_t>(buf, positions.size());
+    for (int64_t position : positions) {
+        put(buf, position);
+    }
+}
+
+}
+
+const int PitchTracker::bufferSize;
+const int PitchTracker::hopSize;
+
+PitchTracker::PitchTracker(int sampleRate) {
+    std::lock_guard<std::mutex> lock(aubioMutex);
     aubioPitchDetector = new_aubio_pitch(const_cast<char *>("yinfft"),
-            bufferSize, hopSize, soundFile.getSampleRate()); 
+            bufferSize, hopSize, sampleRate);
     aubio_pitch_set_unit(aubioPitchDetector, const_cast<char *>("midi"));
     inputBuffer = new_fvec(hopSize);
     outputBuffer = new_fvec(1);
-    inputSamples = soundFile.getSamples();
+}
+
+PitchEstimate PitchTracker::process(const float *hop) {
+    for (int j = 0; j < hopSize; j++) {
+        inputBuffer->data[j] = hop[j];
+    }
+    aubio_pitch_do(aubioPitchDetector, inputBuffer, outputBuffer);
+
+    PitchEstimate estimate;
+    estimate.pitch = outputBuffer->data[0];
+    estimate.confidence = aubio_pitch_get_confidence(aubioPitchDetector);
+    return estimate;
+}
+
+PitchTracker::~PitchTracker() {
+    std::lock_guard<std::mutex> lock(aubioMutex);
+    del_aubio_pitch(aubioPitchDetector);
+    del_fvec(inputBuffer);
+    del_fvec(outputBuffer);
+}
+
+PitchDetector::PitchDetector(const SoundFile &soundFile) {
+    tracker = new PitchTracker(soundFile.getSampleRate());
+    this->soundFile = &soundFile;
     channels = soundFile.getChannels();
+    sampleRate = soundFile.getSampleRate();
+    tempo = 0;
+}
+
+size_t PitchDetector::getHopCount() const {
+    if (channels <= 0) {
+        return 0;
+    }
+    return soundFile->getLength() / hopSize;
 }
 
 void PitchDetector::detectPitches() {
-    pitches.resize(inputSamples.size() / hopSize);
+    pitches.resize(getHopCount());
+    onsets.clear();
+    beats.clear();
+    tempo = 0;
+
+    aubio_onset_t *onsetDetector;
+    aubio_tempo_t *beatTracker;
+    {
+        std::lock_guard<std::mutex> lock(aubioMutex);
+        onsetDetector = new_aubio_onset(const_cast<char *>("default"),
+                bufferSize, hopSize, sampleRate);
+        beatTracker = new_aubio_tempo(const_cast<char *>("default"),
+                bufferSize, hopSize, sampleRate);
+    }
+    fvec_t *hopBuffer = new_fvec(hopSize);
+    fvec_t *detected = new_fvec(1);
 
-    static int spuriousHold = 0;
+    // The audio is read a hop at a time, so that a long recording doesn't
+    // need to be in memory all at once
+    std::vector<float> samples(hopSize * channels);
+    std::vector<float> mono(hopSize);
+    PitchSmoother smoother;
+    PitchEstimate smoothed;
+    size_t done = 0;
 
     // Hop
     for (size_t i = 0; i < pitches.size(); i++) {
 
         // Fill input buffer by summing the channels of a chunk of the audio
-        for (size_t j = 0; j < hopSize; j++) {
-            if ((i * hopSize + j) * channels + 1 > inputSamples.size()) {
-                break;
+        soundFile->readFrames((int64_t) i * hopSize, hopSize, &samples[0]);
+        for (int j = 0; j < hopSize; j++) {
+            size_t frame = j * channels;
+            mono[j] = samples[frame];
+            if (channels > 1) {
+                mono[j] += samples[frame + 1];
             }
-            inputBuffer->data[j] =
-                    inputSamples[(i * hopSize + j) * channels] +
-                    inputSamples[(i * hopSize + j) * channels + 1];
         }
 
-        // Detect the pitch for this hop
-        aubio_pitch_do(aubioPitchDetector, inputBuffer, outputBuffer);
-
-        float pitch = outputBuffer->data[0];
-        
-        // Post-process to remove spurious pitch estimates
-        // TODO: is this helpful? Needs to be tweaked
-        if (i > 0 && spuriousHold < 10 &&
-                (aubio_pitch_get_confidence(aubioPitchDetector) < 0.50
-                 || (pitches[i - 1] - pitch) > 7)) {
-            pitches[i] = pitches[i - 1];
-            spuriousHold++;
-        } else {
-            spuriousHold = 0;
-            pitches[i] = pitch;
+        smoother.push(tracker->process(&mono[0]));
+        while (smoother.pop(smoothed)) {
+            pitches[done++] = smoothed.pitch;
         }
+
+        // Aubio gives the position of each onset and beat in frames from the
+        // start; it may place one slightly before the previous hop, but never
+        // before the one it gave last
+        for (int j = 0; j < hopSize; j++) {
+            hopBuffer->data[j] = mono[j];
+        }
+        aubio_onset_do(onsetDetector, hopBuffer, detected);
+        if (detected->data[0] != 0) {
+            int64_t position = aubio_onset_get_last(onsetDetector);
+            if (onsets.empty() || position > onsets.back()) {
+                onsets.push_back(position);
+            }
+        }
+        aubio_tempo_do(beatTracker, hopBuffer, detected);
+        if (detected->data[0] != 0) {
+            int64_t position = aubio_tempo_get_last(beatTracker);
+            if (beats.empty() || position > beats.back()) {
+                beats.push_back(position);
+            }
+        }
+    }
+
+    smoother.finish();
+    while (smoother.pop(smoothed)) {
+        pitches[done++] = smoothed.pitch;
+    }
+
+    // The median beat interval is steadier than Aubio's latest estimate,
+    // which follows the end of the tune
+    if (beats.size() > 2) {
+        std::vector<int64_t> intervals;
+        for (size_t i = 1; i < beats.size(); i++) {
+            intervals.push_back(beats[i] - beats[i - 1]);
+        }
+        std::nth_element(intervals.begin(),
+                intervals.begin() + intervals.size() / 2, intervals.end());
+        tempo = 60.0 * sampleRate / intervals[intervals.size() / 2];
+    } else {
+        tempo = aubio_tempo_get_bpm(beatTracker);
+    }
+
+    del_fvec(hopBuffer);
+    del_fvec(detected);
+    std::lock_guard<std::mutex> lock(aubioMutex);
+    del_aubio_onset(onsetDetector);
+    del_aubio_tempo(beatTracker);
+}
+
+bool PitchDetector::load(std::string path) {
+    std::vector<char> data;
+    if (!readFile(path, data) || data.size() < sizeof(fileMagic)
+            || memcmp(&data[0], fileMagic, sizeof(fileMagic)) != 0) {
+        return false;
+    }
+
+    BinaryReader r(&data[sizeof(fileMagic)], data.size() - sizeof(fileMagic));
+    uint32_t savedSampleRate, savedHopSize, savedBufferSize, count;
+    if (!r.get(savedSampleRate) || !r.get(savedHopSize)
+            || !r.get(savedBufferSize) || !r.get(count)) {
+        return false;
+    }
+    if ((int) savedSampleRate != sampleRate || (int) savedHopSize != hopSize
+            || (int) savedBufferSize != bufferSize || count != getHopCount()) {
+        return false;
+    }
+
+    std::vector<float> saved(count);
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < count; i++) {
+        ok = r.get(saved[i]);
+    }
+    std::vector<int64_t> savedOnsets, savedBeats;
+    float savedTempo;
+    if (!ok || !getPositions(r, savedOnsets) || !getPositions(r, savedBeats)
+            || !r.get(savedTempo)) {
+        std::cout << "PitchDetector: " << path << " is truncated"
+            << std::endl;
+        return false;
+    }
+    std::swap(pitches, saved);
+    std::swap(onsets, savedOnsets);
+    std::swap(beats, savedBeats);
+    tempo = savedTempo;
+    return true;
+}
+
+bool PitchDetector::save(std::string path) const {
+    std::vector<char> buf(fileMagic, fileMagic + sizeof(fileMagic));
+    put<uint32_t>(buf, sampleRate);
+    put<uint32_t>(buf, hopSize);
+    put<uint32_t>(buf, bufferSize);
+    put<uint32_t>(buf, pitches.size());
+    for (float pitch : pitches) {
+        put(buf, pitch);
     }
+    putPositions(buf, onsets);
+    putPositions(buf, beats);
+    put(buf, tempo);
+    if (!replaceFile(path, buf)) {
+        std::cout << "PitchDetector: error writing " << path << std::endl;
+        return false;
+    }
+    return true;
 }
 
 int PitchDetector::getSampleInterval() const {
@@ -73,10 +281,32 @@ const std::vector<float> & PitchDetector::getPitches() const {
     return pitches;
 }
 
+const std::vector<int64_t> & PitchDetector::getOnsets() const {
+    return onsets;
+}
+
+const std::vector<int64_t> & PitchDetector::getBeats() const {
+    return beats;
+}
+
+float PitchDetector::getTempo() const {
+    return tempo;
+}
+
+int64_t PitchDetector::snap(int64_t position, int64_t maxDistance) const {
+    int64_t nearest = position;
+    int64_t distance = findNearest(onsets, position, maxDistance + 1, nearest);
+    findNearest(beats, position, distance, nearest);
+    return nearest;
+}
+
+size_t PitchDetector::getMemoryUsage() const {
+    return pitches.capacity() * sizeof(float)
+        + (onsets.capacity() + beats.capacity()) * sizeof(int64_t);
+}
+
 PitchDetector::~PitchDetector() {
-    del_aubio_pitch(aubioPitchDetector);
-    del_fvec(inputBuffer);
-    del_fvec(outputBuffer);
+    delete tracker;
 }
 
 }
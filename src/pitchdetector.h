@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <string>
 #include <vector>
 
 extern "C" {
@@ -26,27 +28,97 @@ extern "C" {
 
 namespace TuneTutor {
 
+/**
+ * A pitch estimate for one hop of audio.
+ */
+struct PitchEstimate {
+
+    /** The pitch as a MIDI note value */
+    float pitch;
+
+    /** Aubio's confidence in the pitch, from 0 to 1 */
+    float confidence;
+
+    PitchEstimate() {
+        pitch = 0;
+        confidence = 0;
+    }
+};
+
+/**
+ * The PitchTracker class runs the Aubio pitch detector over mono audio one hop
+ * at a time. It keeps only a few hops of state, so it can follow a stream of
+ * any length. Its raw estimates include spurious pitches resulting from
+ * non-melodic elements in the audio, which a PitchSmoother removes.
+ */
+class PitchTracker {
+
+    public:
+        static const int bufferSize = 2048;
+        static const int hopSize = 512;
+
+        /** @param sampleRate the sample rate of the audio in Hz */
+        PitchTracker(int sampleRate);
+        ~PitchTracker();
+
+        /**
+         * @param hop the next hopSize samples of mono audio
+         * @return the raw estimate for the hop
+         */
+        PitchEstimate process(const float *hop);
+
+    private:
+        aubio_pitch_t *aubioPitchDetector;
+        fvec_t *inputBuffer;
+        fvec_t *outputBuffer;
+
+        PitchTracker(const PitchTracker &other);
+        PitchTracker &operator=(const PitchTracker &other);
+};
+
 /**
  * The PitchDetector class does pitch detection for the melodic visualization
- * using the Aubio pitch detector. It instantiates and configures the Aubio
- * pitch detector, passes the entire audio file through the pitch detector, and
- * provides the pitch estimates to the ofApp. The pitch estimates are
- * represented as a vector of floating point values whose units are MIDI
- * pitches, with one pitch estimate for every 512 input sample frames. It also
- * does some post-processing to the output of the Aubio pitch detector in an
- * attempt to reduce spurious pitch jumps resulting from non-melodic elements in
- * the audio.
+ * using a PitchTracker and a PitchSmoother. It passes the entire audio file
+ * through them, and provides the pitch estimates to the ofApp. The pitch
+ * estimates are represented as a vector of floating point values whose units
+ * are MIDI pitches, with one pitch estimate for every 512 input sample frames,
+ * and 0 where there is no pitch.
+ *
+ * The same hops are also passed through Aubio's onset detector and beat
+ * tracker, so that note onsets, beats and the tempo come from the one pass
+ * over the audio.
  */
 class PitchDetector {
 
     public:
 
-        /** @param soundFile Must already have a sound loaded via load() */
+        /**
+         * @param soundFile Must already have a sound loaded via load(), and
+         *        must outlive the PitchDetector
+         */
         PitchDetector(const SoundFile &soundFile);
         ~PitchDetector();
 
         /** Run the pitch detection */
         void detectPitches();
+
+        /**
+         * Load pitches saved by save() instead of running the pitch detection.
+         * The saved pitches are only used if they were detected with the same
+         * parameters from audio of the same sample rate and length.
+         *
+         * @param path the full path to the pitch cache file
+         * @return true if the pitches were loaded
+         */
+        bool load(std::string path);
+
+        /**
+         * Save the detected pitches so that they can be loaded by load().
+         *
+         * @param path the full path to the pitch cache file
+         * @return true if the pitches were saved
+         */
+        bool save(std::string path) const;
         
         /** @return the number of input audio frames per output pitch value */
         int getSampleInterval() const;
@@ -58,16 +130,43 @@ class PitchDetector {
          */
         const std::vector<float> & getPitches() const;
 
+        /** @return the frame positions of the detected onsets, in order */
+        const std::vector<int64_t> & getOnsets() const;
+
+        /** @return the frame positions of the detected beats, in order */
+        const std::vector<int64_t> & getBeats() const;
+
+        /** @return the estimated tempo in beats per minute, or 0 if unknown */
+        float getTempo() const;
+
+        /**
+         * Find the onset or beat nearest to a position.
+         *
+         * @param position a frame position
+         * @param maxDistance the furthest in frames to look from the position
+         * @return the nearest onset or beat, or the position itself if there
+         *         is none within maxDistance
+         */
+        int64_t snap(int64_t position, int64_t maxDistance) const;
+
+        /** @return the bytes used by the pitches, onsets and beats */
+        size_t getMemoryUsage() const;
+
     private:
-        const int bufferSize = 2048;
-        const int hopSize = 512;
+        const int bufferSize = PitchTracker::bufferSize;
+        const int hopSize = PitchTracker::hopSize;
 
-        aubio_pitch_t *aubioPitchDetector;
-        fvec_t *inputBuffer;
-        fvec_t *outputBuffer;
-        std::vector<float> inputSamples;
+        PitchTracker *tracker;
+        const SoundFile *soundFile;
         std::vector<float> pitches;
+        std::vector<int64_t> onsets;
+        std::vector<int64_t> beats;
+        float tempo;
         int channels;
+        int sampleRate;
+
+        /** @return the number of pitch values for the input audio */
+        size_t getHopCount() const;
 };
 
 }
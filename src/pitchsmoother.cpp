@@ -0,0 +1,250 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "pitchsmoother.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Scores are natural logs of probabilities. The penalties were tuned with
+// --pitch-benchmark.
+
+/** 1 / (2 sigma^2) for an estimate's spread of half a semitone */
+const float pitchSpread = 2.0f;
+
+/** Weight of an estimate being wrong however confident it is */
+const float logOutlier = std::log(0.2f);
+
+/** Penalty for each semitone moved between adjacent hops */
+const float stepPenalty = 0.5f;
+
+/** Semitones that can be moved between adjacent hops without a leap */
+const float bandWidth = 0.5f;
+
+/** Penalty for a leap of more than bandWidth between adjacent hops */
+const float jumpPenalty = 6.0f;
+
+/** Penalty for starting or stopping a pitch */
+const float voicingPenalty = 2.0f;
+
+/** Estimates further than this from the decided bin are replaced by it */
+const float outputTolerance = 1.0f;
+
+const float minConfidence = 1e-4f;
+
+/**
+ * @return the index of the highest of the values, like std::max_element, but
+ *         without branching on every comparison and with four comparisons in
+ *         flight at once
+ */
+int findMax(const float *values, int count) {
+    float lanes[4] = {values[0], values[0], values[0], values[0]};
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int k = 0; k < 4; k++) {
+            lanes[k] = std::max(lanes[k], values[i + k]);
+        }
+    }
+    float best = std::max(std::max(lanes[0], lanes[1]),
+            std::max(lanes[2], lanes[3]));
+    for (; i < count; i++) {
+        best = std::max(best, values[i]);
+    }
+    int index = 0;
+    while (index < count - 1 && values[index] != best) {
+        index++;
+    }
+    return index;
+}
+
+}
+
+const int PitchSmoother::minPitch;
+const int PitchSmoother::maxPitch;
+
+PitchSmoother::PitchSmoother(int binsPerSemitone, int lag) {
+    this->binsPerSemitone = std::max(1, binsPerSemitone);
+    this->lag = std::max(0, lag);
+    numBins = (maxPitch - minPitch) * this->binsPerSemitone;
+    scores.assign(numBins + 1, 0);
+    nextScores.assign(numBins + 1, 0);
+    nextFrom.assign(numBins + 1, 0);
+    centres.resize(numBins);
+    for (int i = 0; i < numBins; i++) {
+        centres[i] = minPitch + (i + 0.5f) / this->binsPerSemitone;
+    }
+    raw.resize(this->lag + 1);
+    from.resize((this->lag + 1) * (numBins + 1));
+    bestVoiced = 0;
+    pushed = 0;
+    decided = 0;
+}
+
+void PitchSmoother::push(const PitchEstimate &estimate) {
+    int ringSize = lag + 1;
+    int slot = pushed % ringSize;
+    raw[slot] = estimate;
+
+    // Copied so that the compiler knows that storing the scores doesn't
+    // change them, and can vectorize the loops
+    const int bins = numBins;
+    const int band = std::max(1, (int) (bandWidth * binsPerSemitone));
+    const int unvoiced = bins;
+    const float *prev = &scores[0];
+    float *next = &nextScores[0];
+    int *nextBin = &nextFrom[0];
+
+    if (pushed == 0) {
+        for (int j = 0; j <= bins; j++) {
+            next[j] = 0;
+            nextBin[j] = j;
+        }
+    } else {
+        const int bestVoiced = this->bestVoiced;
+
+        // Staying in the same bin, or moving within the band. The bins are
+        // chosen with bit masks rather than by branching, so that the
+        // compiler can vectorize the loops.
+        for (int j = 0; j < bins; j++) {
+            next[j] = prev[j];
+            nextBin[j] = j;
+        }
+        for (int d = 1; d <= band; d++) {
+            float step = -stepPenalty * d / binsPerSemitone;
+            for (int j = d; j < bins; j++) {
+                float s = prev[j - d] + step;
+                float n = next[j];
+                int better = s > n;
+                next[j] = better ? s : n;
+                nextBin[j] ^= (nextBin[j] ^ (j - d)) & -better;
+            }
+            for (int j = 0; j < bins - d; j++) {
+                float s = prev[j + d] + step;
+                float n = next[j];
+                int better = s > n;
+                next[j] = better ? s : n;
+                nextBin[j] ^= (nextBin[j] ^ (j + d)) & -better;
+            }
+        }
+
+        // Leaping from the best bin, or starting a pitch after none
+        float leap = prev[bestVoiced] - jumpPenalty;
+        float start = prev[unvoiced] - voicingPenalty;
+        for (int j = 0; j < bins; j++) {
+            float n = next[j];
+            int better = leap > n;
+            n = better ? leap : n;
+            nextBin[j] ^= (nextBin[j] ^ (bestVoiced)) & -better;
+            better = start > n;
+            next[j] = better ? start : n;
+            nextBin[j] ^= (nextBin[j] ^ (unvoiced)) & -better;
+        }
+
+        float stop = prev[bestVoiced] - voicingPenalty;
+        next[unvoiced] = std::max(prev[unvoiced], stop);
+        nextBin[unvoiced] = prev[unvoiced] >= stop ? unvoiced : bestVoiced;
+    }
+
+    int16_t *back = &from[slot * (bins + 1)];
+    for (int j = 0; j <= bins; j++) {
+        back[j] = nextBin[j];
+    }
+
+    // Weigh the estimate by its confidence. Far from the estimate, every
+    // bin scores the same as the chance that it is wrong.
+    float confidence = estimate.pitch > 0 ? estimate.confidence : 0;
+    if (!(confidence >= minConfidence)) {
+        confidence = minConfidence;
+    }
+    confidence = std::min(confidence, 1 - minConfidence);
+    float logVoiced = std::log(confidence);
+    float logUnvoiced = std::log(1 - confidence);
+    float outlier = logUnvoiced + logOutlier;
+    float pitch = estimate.pitch;
+    const float *centre = &centres[0];
+    for (int j = 0; j < bins; j++) {
+        float d = centre[j] - pitch;
+        float e = logVoiced - d * d * pitchSpread;
+        next[j] += e > outlier ? e : outlier;
+    }
+    next[unvoiced] += logUnvoiced;
+
+    // Keep the scores near 0 so that they don't lose precision
+    this->bestVoiced = findMax(next, bins);
+    float best = std::max(next[this->bestVoiced], next[unvoiced]);
+    for (int j = 0; j <= bins; j++) {
+        next[j] -= best;
+    }
+    std::swap(scores, nextScores);
+    pushed++;
+
+    if (pushed - decided > lag) {
+        int state = getBestState();
+        for (int64_t hop = pushed - 1; hop > decided; hop--) {
+            state = from[slot * (bins + 1) + state];
+            slot = slot == 0 ? lag : slot - 1;
+        }
+        decide(decided, state);
+    }
+}
+
+void PitchSmoother::finish() {
+    int ringSize = lag + 1;
+    std::vector<int> states(pushed - decided);
+    int state = getBestState();
+    for (int64_t hop = pushed - 1; hop >= decided; hop--) {
+        states[hop - decided] = state;
+        state = from[(hop % ringSize) * (numBins + 1) + state];
+    }
+    for (int s : states) {
+        decide(decided, s);
+    }
+}
+
+bool PitchSmoother::pop(PitchEstimate &smoothed) {
+    if (output.empty()) {
+        return false;
+    }
+    smoothed = output.front();
+    output.pop_front();
+    return true;
+}
+
+int PitchSmoother::getBestState() const {
+    return scores[numBins] > scores[bestVoiced] ? numBins : bestVoiced;
+}
+
+/**
+ * Give the smoothed estimate for a hop, which must be the next undecided one.
+ */
+void PitchSmoother::decide(int64_t hop, int state) {
+    const PitchEstimate &estimate = raw[hop % (lag + 1)];
+    PitchEstimate smoothed;
+    smoothed.confidence = estimate.confidence;
+    if (state < numBins) {
+        float centre = centres[state];
+        smoothed.pitch = std::fabs(estimate.pitch - centre) <= outputTolerance
+            ? estimate.pitch : centre;
+    }
+    output.push_back(smoothed);
+    decided++;
+}
+
+}
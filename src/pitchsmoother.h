@@ -0,0 +1,108 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "pitchdetector.h"
+
+namespace TuneTutor {
+
+/**
+ * The PitchSmoother class cleans up the raw estimates of a PitchTracker with
+ * a hidden Markov model of the melody, decoded by the Viterbi algorithm. The
+ * hidden states are pitch bins a fraction of a semitone wide, plus one state
+ * for no pitch. Each hop's estimate is weighted by its confidence: a confident
+ * estimate favours the bins near it, and an unconfident one favours the state
+ * for no pitch. Moving to a nearby bin is cheap and jumping to a distant one
+ * costs a fixed penalty, so a leap to a new note that lasts is followed from
+ * the hop where it starts, while an excursion of a few hops is passed over.
+ *
+ * Only transitions within half a semitone are scored individually, and the
+ * leap penalty is taken from the best previous state, so each hop costs time
+ * in proportion to the number of bins times the width of that band rather
+ * than the number of bins squared. Pitches outside the range of the bins are
+ * treated as no pitch. Decisions are made a fixed number of hops behind the
+ * latest estimate by tracing back from the best current state, so that
+ * streams of any length are smoothed in constant memory.
+ */
+class PitchSmoother {
+
+    public:
+        /** Lowest and highest MIDI pitches that the bins cover */
+        static const int minPitch = 36;
+        static const int maxPitch = 100;
+
+        /**
+         * @param binsPerSemitone the resolution of the pitch bins
+         * @param lag the number of hops to wait before deciding on a hop
+         */
+        PitchSmoother(int binsPerSemitone = 2, int lag = 48);
+
+        /** @param raw the estimate of the PitchTracker for the next hop */
+        void push(const PitchEstimate &raw);
+
+        /**
+         * Decide on all the hops that are still waiting, once there are no
+         * more estimates to push.
+         */
+        void finish();
+
+        /**
+         * Take the smoothed estimate for the next hop, if it has been decided.
+         * A hop without a pitch is given a pitch of 0.
+         *
+         * @param smoothed set to the estimate
+         * @return true if there was an estimate to take
+         */
+        bool pop(PitchEstimate &smoothed);
+
+    private:
+        int numBins;
+        int binsPerSemitone;
+        int lag;
+
+        // Scores of the voiced bins and then the unvoiced state for the
+        // latest hop, and space for the next hop's
+        std::vector<float> scores;
+        std::vector<float> nextScores;
+        std::vector<int> nextFrom;
+
+        // The voiced bin with the highest score for the latest hop
+        int bestVoiced;
+
+        // Pitch at the centre of each bin
+        std::vector<float> centres;
+
+        // Ring buffers of the raw estimates and the best previous state of
+        // each state, for the last lag + 1 hops
+        std::vector<PitchEstimate> raw;
+        std::vector<int16_t> from;
+
+        // Hops pushed, and hops decided
+        int64_t pushed;
+        int64_t decided;
+
+        std::deque<PitchEstimate> output;
+
+        int getBestState() const;
+        void decide(int64_t hop, int state);
+};
+
+}
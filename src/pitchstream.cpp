@@ -0,0 +1,180 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "mp3decoder.h"
+#include "pitchdetector.h"
+#include "pitchsmoother.h"
+#include "pitchstream.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/** Bytes read from the input at a time */
+const size_t readSize = 1 << 16;
+
+/**
+ * Sums the first two channels of incoming frames into hops of mono audio,
+ * and writes a record for each hop as soon as the PitchSmoother has decided
+ * on it.
+ */
+class HopWriter {
+
+    public:
+        HopWriter(FILE *out, bool binary) {
+            this->out = out;
+            this->binary = binary;
+            sampleRate = 0;
+            hop.resize(PitchTracker::hopSize);
+            filled = 0;
+            time = 0;
+            if (!binary) {
+                fprintf(out, "time,pitch,confidence\n");
+            }
+        }
+
+        /**
+         * @param frames samples interleaved by channel
+         * @param count the number of frames
+         * @param channels the number of channels
+         * @param rate the sample rate, which restarts the tracker if it
+         *        changes
+         */
+        void add(const float *frames, size_t count, int channels, int rate) {
+            if (rate != sampleRate) {
+                finish();
+                tracker.reset(new PitchTracker(rate));
+                smoother.reset(new PitchSmoother());
+                sampleRate = rate;
+            }
+            for (size_t i = 0; i < count; i++) {
+                const float *frame = frames + i * channels;
+                hop[filled++] = channels > 1 ? frame[0] + frame[1] : frame[0];
+                if (filled == PitchTracker::hopSize) {
+                    smoother->push(tracker->process(&hop[0]));
+                    filled = 0;
+                }
+            }
+            writeDecided();
+        }
+
+        /** Write the hops that the smoother is still waiting on */
+        void finish() {
+            if (smoother) {
+                smoother->finish();
+                writeDecided();
+            }
+        }
+
+    private:
+        FILE *out;
+        bool binary;
+        int sampleRate;
+        std::unique_ptr<PitchTracker> tracker;
+        std::unique_ptr<PitchSmoother> smoother;
+        std::vector<float> hop;
+        int filled;
+
+        // Time of the start of the next hop to be written, in seconds
+        double time;
+
+        void writeDecided() {
+            PitchEstimate estimate;
+            while (smoother->pop(estimate)) {
+                if (binary) {
+                    float record[3] = {(float) time, estimate.pitch,
+                        estimate.confidence};
+                    fwrite(record, sizeof(float), 3, out);
+                } else {
+                    fprintf(out, "%.4f,%.3f,%.3f\n", time, estimate.pitch,
+                            estimate.confidence);
+                }
+                time += PitchTracker::hopSize / (double) sampleRate;
+            }
+        }
+};
+
+}
+
+int streamPitches(FILE *in, FILE *out, const PitchStreamOptions &options) {
+    HopWriter writer(out, options.binary);
+    std::vector<unsigned char> bytes(readSize);
+    std::vector<float> frames(readSize);
+    Mp3StreamDecoder mp3;
+    if (options.format == STREAM_MP3 && !mp3.open()) {
+        std::cerr << "streamPitches: can't start the MP3 decoder" << std::endl;
+        return 1;
+    }
+    if (options.format != STREAM_MP3
+            && (options.sampleRate <= 0 || options.channels <= 0)) {
+        std::cerr << "streamPitches: bad sample rate or channels" << std::endl;
+        return 1;
+    }
+
+    // Raw samples may be split across reads, so the leftover bytes of a
+    // partial frame are kept for the next read
+    size_t kept = 0;
+    while (true) {
+        size_t n = fread(&bytes[kept], 1, readSize - kept, in);
+        if (n == 0) {
+            break;
+        }
+        n += kept;
+        kept = 0;
+
+        if (options.format == STREAM_MP3) {
+            if (!mp3.feed(&bytes[0], n)) {
+                std::cerr << "streamPitches: error decoding MP3" << std::endl;
+                return 1;
+            }
+            size_t count;
+            while ((count = mp3.read(&frames[0], frames.size() / 2)) > 0) {
+                writer.add(&frames[0], count, mp3.getChannels(),
+                        mp3.getSampleRate());
+            }
+        } else {
+            size_t sampleBytes = options.format == STREAM_PCM16 ? 2 : 4;
+            size_t frameBytes = sampleBytes * options.channels;
+            size_t count = n / frameBytes;
+            size_t samples = count * options.channels;
+            if (options.format == STREAM_PCM16) {
+                for (size_t i = 0; i < samples; i++) {
+                    int16_t value = (int16_t) (bytes[2 * i]
+                            | (bytes[2 * i + 1] << 8));
+                    frames[i] = value / 32768.0f;
+                }
+            } else {
+                memcpy(&frames[0], &bytes[0], samples * sizeof(float));
+            }
+            writer.add(&frames[0], count, options.channels,
+                    options.sampleRate);
+            kept = n - count * frameBytes;
+            memmove(&bytes[0], &bytes[count * frameBytes], kept);
+        }
+        fflush(out);
+    }
+    writer.finish();
+    fflush(out);
+    return 0;
+}
+
+}
@@ -0,0 +1,77 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdio>
+
+namespace TuneTutor {
+
+/**
+ * Formats of the audio read by streamPitches().
+ */
+enum StreamFormat {
+    /** Raw 16-bit signed little-endian samples, interleaved by channel */
+    STREAM_PCM16,
+
+    /** Raw 32-bit floats in native byte order, interleaved by channel */
+    STREAM_FLOAT32,
+
+    /** An MP3 stream, which gives its own sample rate and channels */
+    STREAM_MP3
+};
+
+/**
+ * Options for streamPitches().
+ */
+struct PitchStreamOptions {
+    StreamFormat format;
+
+    /** Sample rate and channels of raw input; ignored for MP3 */
+    int sampleRate;
+    int channels;
+
+    /**
+     * If true, each record is written as three 32-bit floats in native
+     * byte order instead of a line of CSV
+     */
+    bool binary;
+
+    PitchStreamOptions() {
+        format = STREAM_PCM16;
+        sampleRate = 44100;
+        channels = 2;
+        binary = false;
+    }
+};
+
+/**
+ * Detect the pitch of audio read from a stream, one hop at a time, with the
+ * same PitchTracker and PitchSmoother as the PitchDetector, and write a record
+ * for each hop as soon as the smoother has decided on it: the time of the
+ * start of the hop in seconds, the MIDI pitch, and the confidence. Hops
+ * without a pitch have a pitch of 0. CSV output has a header line. The audio is
+ * never held in memory beyond the current read, so memory use doesn't grow
+ * with the length of the stream.
+ *
+ * @param in the audio to read, until the end of the stream
+ * @param out where to write the records
+ * @param options the format of the input and output
+ * @return 0 on success, or 1 if the input couldn't be decoded
+ */
+int streamPitches(FILE *in, FILE *out, const PitchStreamOptions &options);
+
+}
@@ -0,0 +1,139 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <chrono>
+#include <cstring>
+
+#include "playbackengine.h"
+
+namespace TuneTutor {
+
+PlaybackEngine::PlaybackEngine() {
+    stretcher = NULL;
+    cueCache = NULL;
+    length = 0;
+    outputRate = 44100;
+    waitForCues = false;
+    backend = STRETCH_RUBBERBAND;
+    quality = QUALITY_MEDIUM;
+    selectionStart = 0;
+    selectionEnd = 0;
+    atEnd = SELECTION_CONTINUE;
+    delay = 0;
+    delayed = false;
+    silentFrames = 0;
+    stretchTime = 0;
+}
+
+void PlaybackEngine::setSource(TimeStretcher *stretcher, CueCache *cueCache,
+        int64_t length) {
+    this->stretcher = stretcher;
+    this->cueCache = cueCache;
+    this->length = length;
+}
+
+void PlaybackEngine::setOutputRate(int rate) {
+    outputRate = rate;
+}
+
+void PlaybackEngine::setWaitForCues(bool wait) {
+    waitForCues = wait;
+}
+
+void PlaybackEngine::setBackend(StretchBackend backend) {
+    this->backend = backend;
+}
+
+void PlaybackEngine::setQuality(StretchQuality quality) {
+    this->quality = quality;
+}
+
+void PlaybackEngine::setDelay(double seconds) {
+    delay = seconds;
+}
+
+void PlaybackEngine::setSelection(int64_t start, int64_t end,
+        SelectionEnd atEnd) {
+    selectionStart = start;
+    selectionEnd = end;
+    this->atEnd = atEnd;
+}
+
+void PlaybackEngine::startDelay() {
+    delayed = true;
+    silentFrames = 0;
+}
+
+void PlaybackEngine::seek(int64_t position) {
+    if (stretcher == NULL) {
+        return;
+    }
+    stretcher->seek(position);
+
+    // A jump to a mark or the selection start plays its cue
+    cueCache->start(position, waitForCues);
+}
+
+bool PlaybackEngine::process(float *output, int bufferSize,
+        int outputChannels) {
+    stretchTime = 0;
+
+    // While the delay lasts, output silence without advancing the playhead
+    if (delayed || stretcher == NULL) {
+        memset(output, 0, bufferSize * outputChannels * sizeof(float));
+        silentFrames += bufferSize;
+        if (silentFrames / (double) outputRate >= delay) {
+            delayed = false;
+        }
+        return true;
+    }
+
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    stretcher->setBackend(backend);
+    stretcher->setQuality(quality);
+    if (cueCache->beginCue()) {
+        // Start the stretcher afresh behind the cue, to be crossfaded in at
+        // the end of it
+        stretcher->reset();
+    }
+    stretcher->getOutput(output, bufferSize, outputChannels);
+    cueCache->mix(output, bufferSize, outputChannels);
+    stretchTime = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    int64_t position = stretcher->getPosition();
+    if (position > selectionEnd && atEnd == SELECTION_LOOP) {
+        seek(selectionStart);
+        startDelay();
+    } else if (position > selectionEnd && atEnd == SELECTION_STOP) {
+        seek(selectionStart);
+        return false;
+    } else if (position >= length) {
+        return false;
+    }
+    return true;
+}
+
+int64_t PlaybackEngine::getPosition() const {
+    return stretcher != NULL ? stretcher->getPosition() : 0;
+}
+
+double PlaybackEngine::getStretchTime() const {
+    return stretchTime;
+}
+
+}
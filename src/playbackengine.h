@@ -0,0 +1,141 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "cuecache.h"
+#include "timestretcher.h"
+
+namespace TuneTutor {
+
+/**
+ * What playback does when the playhead passes the end of the selection.
+ */
+enum SelectionEnd {
+    SELECTION_CONTINUE,
+    SELECTION_STOP,
+    SELECTION_LOOP
+};
+
+/**
+ * The PlaybackEngine class makes each buffer of playback output from a tune's
+ * TimeStretcher and CueCache: silence while the delay before playback lasts,
+ * and otherwise the stretched audio with any cue crossfaded in. It follows
+ * the playhead past the end of the selection and of the tune. Both
+ * ofApp::audioOut() and OfflinePlayer play through it, so that an offline
+ * render is what the sound card would have played.
+ */
+class PlaybackEngine {
+
+    public:
+        PlaybackEngine();
+
+        /**
+         * Set the tune to play. Must not be called while process() may be
+         * running.
+         *
+         * @param stretcher the tune's live stretcher, or NULL for silence
+         * @param cueCache the tune's cues, or NULL if stretcher is NULL
+         * @param length the length of the tune in frames
+         */
+        void setSource(TimeStretcher *stretcher, CueCache *cueCache,
+                int64_t length);
+
+        /** @param rate the sample rate of the output in Hz */
+        void setOutputRate(int rate);
+
+        /**
+         * Choose whether a jump to a cued position may wait for the cue
+         * cache, so that the cue is never missed. It doesn't until this is
+         * called, since the audio thread must not wait; offline playback
+         * does.
+         *
+         * @param wait true if seek() may wait for the cue cache
+         */
+        void setWaitForCues(bool wait);
+
+        /** The engine and tier that the stretcher uses from the next buffer */
+        void setBackend(StretchBackend backend);
+        void setQuality(StretchQuality quality);
+
+        /** @param seconds the silence to play before playback starts */
+        void setDelay(double seconds);
+
+        /**
+         * @param start the first frame of the selection
+         * @param end the last frame of the selection
+         * @param atEnd what to do when the playhead passes the end
+         */
+        void setSelection(int64_t start, int64_t end, SelectionEnd atEnd);
+
+        /** Play the delay before the next buffer of audio */
+        void startDelay();
+
+        /**
+         * Move the playhead, and play the cue at the new position if there is
+         * one.
+         *
+         * @param position the frame to play from
+         */
+        void seek(int64_t position);
+
+        /**
+         * Make the next buffer of output. When the playhead passes the end of
+         * the selection, it goes back to the start of the selection, and
+         * then either plays the delay or stops, as set by setSelection().
+         *
+         * @param output the buffer for the frames, interleaved by channel
+         * @param bufferSize the number of frames in the buffer
+         * @param outputChannels the number of channels in each frame
+         * @return false if playback should stop, having reached the end of
+         *         the tune or of the selection
+         */
+        bool process(float *output, int bufferSize, int outputChannels);
+
+        /** @return the frame that the playhead has reached */
+        int64_t getPosition() const;
+
+        /**
+         * @return the seconds spent stretching the last buffer, or 0 if it
+         *         was silence
+         */
+        double getStretchTime() const;
+
+    private:
+        TimeStretcher *stretcher;
+        CueCache *cueCache;
+        int64_t length;
+        int outputRate;
+        bool waitForCues;
+        StretchBackend backend;
+        StretchQuality quality;
+
+        int64_t selectionStart;
+        int64_t selectionEnd;
+        SelectionEnd atEnd;
+
+        double delay;
+        bool delayed;
+
+        /** Frames of silence played since the delay started */
+        int64_t silentFrames;
+
+        double stretchTime;
+};
+
+}
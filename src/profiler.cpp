@@ -0,0 +1,368 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <map>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+#include "profiler.h"
+
+namespace TuneTutor {
+
+namespace {
+
+int64_t getMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** @return the processor time used by the process, in microseconds */
+int64_t getCpuMicroseconds() {
+    return (int64_t) std::clock() * 1000000 / CLOCKS_PER_SEC;
+}
+
+/** @return the bytes of heap memory in use, or 0 if unknown */
+int64_t getHeapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 \
+        || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#elif defined(__GLIBC__)
+    // The older fields are ints, which wrap around past 2 GB
+    struct mallinfo info = mallinfo();
+    return (unsigned) info.uordblks + (unsigned) info.hblkhd;
+#elif defined(__APPLE__)
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    return stats.size_in_use;
+#else
+    return 0;
+#endif
+}
+
+/** @return the bytes of resident memory, or 0 if unknown */
+int64_t getResidentBytes() {
+#if defined(__GLIBC__)
+    std::ifstream statm("/proc/self/statm");
+    int64_t pages = 0;
+    int64_t resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                (task_info_t) &info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return info.resident_size;
+#else
+    return 0;
+#endif
+}
+
+}
+
+const int FrameProfiler::maxFrames;
+const int FrameProfiler::maxScopesPerFrame;
+
+FrameProfiler::FrameProfiler() {
+    frames.resize(maxFrames);
+    currentFrame = 0;
+    completeFrames = 0;
+    inFrame = false;
+    depth = 0;
+    excessDepth = 0;
+}
+
+int64_t FrameProfiler::now() const {
+    return getMicroseconds();
+}
+
+void FrameProfiler::beginFrame() {
+    if (inFrame) {
+        endFrame();
+    }
+    Frame &frame = frames[currentFrame];
+    frame.start = now();
+    frame.duration = 0;
+    frame.numScopes = 0;
+    depth = 0;
+    excessDepth = 0;
+    inFrame = true;
+}
+
+void FrameProfiler::endFrame() {
+    if (!inFrame) {
+        return;
+    }
+    int64_t end = now();
+    Frame &frame = frames[currentFrame];
+
+    // Close any scopes left open, e.g. by an early return
+    while (depth > 0) {
+        Scope &scope = frame.scopes[openScopes[--depth]];
+        scope.duration = end - scope.start;
+    }
+    frame.duration = end - frame.start;
+    excessDepth = 0;
+
+    inFrame = false;
+    currentFrame = (currentFrame + 1) % maxFrames;
+    if (completeFrames < maxFrames) {
+        completeFrames++;
+    }
+}
+
+void FrameProfiler::beginScope(const char *name) {
+    if (!inFrame) {
+        return;
+    }
+    if (depth == maxScopesPerFrame) {
+        excessDepth++;
+        return;
+    }
+    Frame &frame = frames[currentFrame];
+    if (frame.numScopes == maxScopesPerFrame) {
+        // Still count the depth so that endScope() stays balanced
+        openScopes[depth++] = -1;
+        return;
+    }
+    Scope &scope = frame.scopes[frame.numScopes];
+    scope.name = name;
+    scope.start = now();
+    scope.duration = 0;
+    openScopes[depth++] = frame.numScopes;
+    frame.numScopes++;
+}
+
+void FrameProfiler::endScope() {
+    if (!inFrame) {
+        return;
+    }
+    if (excessDepth > 0) {
+        excessDepth--;
+        return;
+    }
+    if (depth == 0) {
+        return;
+    }
+    int index = openScopes[--depth];
+    if (index >= 0) {
+        Scope &scope = frames[currentFrame].scopes[index];
+        scope.duration = now() - scope.start;
+    }
+}
+
+int FrameProfiler::getFrameCount() const {
+    return completeFrames;
+}
+
+float FrameProfiler::getFrameTimePercentile(float percentile) const {
+    if (completeFrames == 0) {
+        return 0;
+    }
+
+    // The complete frames are the ones before currentFrame in the ring, which
+    // is all of them once the ring has filled up.
+    std::vector<int64_t> durations;
+    durations.reserve(completeFrames);
+    for (int i = 0; i < completeFrames; i++) {
+        int index = (currentFrame - 1 - i + maxFrames) % maxFrames;
+        durations.push_back(frames[index].duration);
+    }
+
+    size_t n = std::min(durations.size() - 1,
+            (size_t) (percentile / 100.0 * durations.size()));
+    std::nth_element(durations.begin(), durations.begin() + n,
+            durations.end());
+    return durations[n] / 1000.0;
+}
+
+std::vector<ScopeSummary> FrameProfiler::getTopScopes(int count) const {
+    std::map<std::string, ScopeSummary> summaries;
+    for (int i = 0; i < completeFrames; i++) {
+        const Frame &frame = frames[(currentFrame - 1 - i + maxFrames)
+            % maxFrames];
+        for (int j = 0; j < frame.numScopes; j++) {
+            const Scope &scope = frame.scopes[j];
+            ScopeSummary &summary = summaries[scope.name];
+            summary.name = scope.name;
+            summary.meanMs += scope.duration / 1000.0;
+            summary.maxMs = std::max(summary.maxMs,
+                    (float) (scope.duration / 1000.0));
+        }
+    }
+
+    std::vector<ScopeSummary> result;
+    for (auto &entry : summaries) {
+        entry.second.meanMs /= completeFrames;
+        result.push_back(entry.second);
+    }
+    std::sort(result.begin(), result.end(),
+            [](const ScopeSummary &a, const ScopeSummary &b) {
+                return a.meanMs > b.meanMs;
+            });
+    if ((int) result.size() > count) {
+        result.resize(count);
+    }
+    return result;
+}
+
+bool FrameProfiler::writeTrace(std::string path) const {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+
+    // Oldest frame first, so that the events are in chronological order
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (int i = completeFrames - 1; i >= 0; i--) {
+        const Frame &frame = frames[(currentFrame - 1 - i + maxFrames)
+            % maxFrames];
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+            << ",\"ts\":" << frame.start
+            << ",\"dur\":" << frame.duration << "}";
+        first = false;
+        for (int j = 0; j < frame.numScopes; j++) {
+            const Scope &scope = frame.scopes[j];
+            out << ",\n{\"name\":\"" << scope.name
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+                << ",\"ts\":" << scope.start
+                << ",\"dur\":" << scope.duration << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    return out.good();
+}
+
+SpanTracer::SpanTracer() {
+    recording = false;
+    end = 0;
+}
+
+void SpanTracer::start() {
+    spans.clear();
+    openSpans.clear();
+    memory.clear();
+    recording = true;
+}
+
+void SpanTracer::stop() {
+    while (!openSpans.empty()) {
+        endSpan();
+    }
+    end = getMicroseconds();
+    recording = false;
+}
+
+void SpanTracer::beginSpan(const char *name) {
+    if (!recording) {
+        return;
+    }
+    TraceSpan span;
+    span.name = name;
+    span.depth = openSpans.size();
+    span.start = getMicroseconds();
+
+    OpenSpan open;
+    open.index = spans.size();
+    open.cpuStart = getCpuMicroseconds();
+    open.heapStart = getHeapInUse();
+    open.residentStart = getResidentBytes();
+    spans.push_back(span);
+    openSpans.push_back(open);
+}
+
+void SpanTracer::endSpan() {
+    if (!recording || openSpans.empty()) {
+        return;
+    }
+    const OpenSpan &open = openSpans.back();
+    TraceSpan &span = spans[open.index];
+    span.duration = getMicroseconds() - span.start;
+    span.cpuTime = getCpuMicroseconds() - open.cpuStart;
+    span.heapBytes = getHeapInUse() - open.heapStart;
+    span.residentBytes = getResidentBytes() - open.residentStart;
+    openSpans.pop_back();
+}
+
+void SpanTracer::setMemory(const char *component, int64_t bytes) {
+    memory.push_back(std::make_pair(component, bytes));
+}
+
+const std::vector<TraceSpan> &SpanTracer::getSpans() const {
+    return spans;
+}
+
+int64_t SpanTracer::getHeapBytes(const char *name) const {
+    int64_t bytes = 0;
+    for (const TraceSpan &span : spans) {
+        if (std::string(span.name) == name) {
+            bytes += span.heapBytes;
+        }
+    }
+    return bytes;
+}
+
+bool SpanTracer::writeTrace(std::string path) const {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        return false;
+    }
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const TraceSpan &span : spans) {
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"" << span.name
+            << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+            << ",\"ts\":" << span.start
+            << ",\"dur\":" << span.duration
+            << ",\"args\":{\"cpu_ms\":" << span.cpuTime / 1000.0
+            << ",\"heap_bytes\":" << span.heapBytes
+            << ",\"resident_bytes\":" << span.residentBytes << "}}";
+        first = false;
+    }
+    if (!memory.empty()) {
+        out << (first ? "\n" : ",\n")
+            << "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":1"
+            << ",\"ts\":" << end << ",\"args\":{";
+        for (size_t i = 0; i < memory.size(); i++) {
+            out << (i == 0 ? "" : ",") << "\"" << memory[i].first << "\":"
+                << memory[i].second;
+        }
+        out << "}}";
+    }
+    out << "\n]}\n";
+
+    return out.good();
+}
+
+}
@@ -0,0 +1,270 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * Timing summary of one named scope over all recorded frames.
+ */
+struct ScopeSummary {
+    std::string name;
+
+    /** Mean time spent in the scope per frame, in milliseconds */
+    float meanMs;
+
+    /** Longest single time spent in the scope, in milliseconds */
+    float maxMs;
+
+    ScopeSummary() {
+        name = "";
+        meanMs = 0;
+        maxMs = 0;
+    }
+};
+
+/**
+ * The FrameProfiler class records the time spent in named scopes of the render
+ * thread. Scopes are grouped by frame and kept in a fixed-size ring buffer, so
+ * recording never allocates memory once the profiler has been constructed. The
+ * most recent frames can be summarized for display, or written out as a trace
+ * file in the Chrome trace event format (viewable in chrome://tracing).
+ *
+ * Scope names must be string literals or otherwise outlive the profiler, since
+ * only the pointers are stored.
+ */
+class FrameProfiler {
+
+    public:
+        FrameProfiler();
+
+        /** Start recording a new frame, overwriting the oldest if full */
+        void beginFrame();
+
+        /** Finish recording the current frame */
+        void endFrame();
+
+        /** @param name the name of the scope being entered */
+        void beginScope(const char *name);
+
+        /** Leave the most recently entered scope */
+        void endScope();
+
+        /** @return the number of complete frames in the ring buffer */
+        int getFrameCount() const;
+
+        /**
+         * @param percentile the percentile to compute, from 0 to 100
+         * @return the frame time at the given percentile, in milliseconds
+         */
+        float getFrameTimePercentile(float percentile) const;
+
+        /**
+         * @param count the maximum number of scopes to return
+         * @return the scopes with the highest mean time per frame, most
+         *         expensive first
+         */
+        std::vector<ScopeSummary> getTopScopes(int count) const;
+
+        /**
+         * Write the recorded frames as a Chrome trace event JSON file.
+         *
+         * @param path the full path to the file to write
+         * @return true if the file was written successfully
+         */
+        bool writeTrace(std::string path) const;
+
+    private:
+        static const int maxFrames = 600;
+        static const int maxScopesPerFrame = 32;
+
+        struct Scope {
+            const char *name;
+            int64_t start;
+            int64_t duration;
+        };
+
+        struct Frame {
+            int64_t start;
+            int64_t duration;
+            int numScopes;
+            Scope scopes[maxScopesPerFrame];
+        };
+
+        std::vector<Frame> frames;
+        int currentFrame;
+        int completeFrames;
+        bool inFrame;
+
+        // Indices into the current frame's scopes of the scopes not yet ended
+        int openScopes[maxScopesPerFrame];
+        int depth;
+
+        // Scopes nested too deeply to fit in openScopes, which are only
+        // counted so that endScope() stays balanced
+        int excessDepth;
+
+        int64_t now() const;
+};
+
+/**
+ * One span recorded by a SpanTracer.
+ */
+struct TraceSpan {
+    const char *name;
+
+    /** Number of spans enclosing this one */
+    int depth;
+
+    /** Start time and wall time taken, in microseconds */
+    int64_t start;
+    int64_t duration;
+
+    /** Processor time used by all threads of the process, in microseconds */
+    int64_t cpuTime;
+
+    /**
+     * Change in the bytes of heap memory in use, i.e. the memory allocated
+     * during the span and still retained at its end
+     */
+    int64_t heapBytes;
+
+    /** Change in the bytes of resident memory, including mapped files */
+    int64_t residentBytes;
+
+    TraceSpan() {
+        name = "";
+        depth = 0;
+        start = 0;
+        duration = 0;
+        cpuTime = 0;
+        heapBytes = 0;
+        residentBytes = 0;
+    }
+};
+
+/**
+ * The SpanTracer class records nested spans of a one-off operation, such as
+ * opening a tune, with the wall time, processor time and memory taken by each.
+ * Unlike the FrameProfiler, it is meant for operations that run rarely and
+ * take long enough that measuring memory is cheap by comparison. Spans are
+ * only recorded between start() and stop(), so that code which also runs at
+ * other times can be traced without cost. The spans, and the memory used by
+ * each component of the result, can be written out in the same Chrome trace
+ * event format as the FrameProfiler's.
+ *
+ * Span and component names must be string literals or otherwise outlive the
+ * tracer, since only the pointers are stored.
+ */
+class SpanTracer {
+
+    public:
+        SpanTracer();
+
+        /** Discard what was recorded before, and start recording */
+        void start();
+
+        /** End any spans still open, and stop recording */
+        void stop();
+
+        /** @param name the name of the span being entered */
+        void beginSpan(const char *name);
+
+        /** Leave the most recently entered span */
+        void endSpan();
+
+        /**
+         * Record the memory used by one component of the result.
+         *
+         * @param component the name of the component
+         * @param bytes the number of bytes it uses
+         */
+        void setMemory(const char *component, int64_t bytes);
+
+        /** @return the spans recorded, in the order they were entered */
+        const std::vector<TraceSpan> &getSpans() const;
+
+        /** @return the heap bytes retained by all spans with a name */
+        int64_t getHeapBytes(const char *name) const;
+
+        /**
+         * Write the spans as a Chrome trace event JSON file, with the memory
+         * of each component as a counter at the end.
+         *
+         * @param path the full path to the file to write
+         * @return true if the file was written successfully
+         */
+        bool writeTrace(std::string path) const;
+
+    private:
+        struct OpenSpan {
+            int index;
+            int64_t cpuStart;
+            int64_t heapStart;
+            int64_t residentStart;
+        };
+
+        bool recording;
+        std::vector<TraceSpan> spans;
+        std::vector<OpenSpan> openSpans;
+        std::vector<std::pair<const char *, int64_t> > memory;
+        int64_t end;
+};
+
+/**
+ * Records the lifetime of a block as a span of a SpanTracer.
+ */
+class TraceScope {
+
+    public:
+        TraceScope(SpanTracer &tracer, const char *name) : tracer(tracer) {
+            tracer.beginSpan(name);
+        }
+
+        ~TraceScope() {
+            tracer.endSpan();
+        }
+
+    private:
+        SpanTracer &tracer;
+};
+
+/**
+ * Records the lifetime of a block as a scope of a FrameProfiler.
+ */
+class ProfileScope {
+
+    public:
+        ProfileScope(FrameProfiler &profiler, const char *name)
+                : profiler(profiler) {
+            profiler.beginScope(name);
+        }
+
+        ~ProfileScope() {
+            profiler.endScope();
+        }
+
+    private:
+        FrameProfiler &profiler;
+};
+
+}
@@ -0,0 +1,95 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "qualitygovernor.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Weight of each callback in the moving average of the load; at 512 frames
+// per callback, the average covers about a quarter of a second
+const double smoothing = 0.05;
+
+// Average load above which to drop a tier, and below which to try the next
+const double downgradeLoad = 0.6;
+const double upgradeLoad = 0.25;
+
+// Seconds to let the load settle after a change before judging it again
+const double settleTime = 0.5;
+
+// Initial and greatest wait before trying the next tier up, in seconds
+const double initialUpgradeDelay = 4;
+const double maxUpgradeDelay = 120;
+
+}
+
+QualityGovernor::QualityGovernor() {
+    quality = QUALITY_MEDIUM;
+    load = 0;
+    adaptive = true;
+    sinceChange = 0;
+    quietTime = 0;
+    upgradeDelay = initialUpgradeDelay;
+}
+
+void QualityGovernor::fixQuality(StretchQuality quality) {
+    this->quality = quality;
+    adaptive = false;
+}
+
+void QualityGovernor::update(double seconds, double deadline) {
+    if (deadline <= 0) {
+        return;
+    }
+    double used = seconds / deadline;
+    float average = load + (used - load) * smoothing;
+    load = average;
+    if (!adaptive) {
+        return;
+    }
+
+    sinceChange += deadline;
+    quietTime = average < upgradeLoad ? quietTime + deadline : 0;
+    if (sinceChange < settleTime) {
+        return;
+    }
+
+    if ((average > downgradeLoad || used > 1) && quality > QUALITY_LOW) {
+        change(quality - 1);
+        upgradeDelay = std::min(upgradeDelay * 2, maxUpgradeDelay);
+    } else if (quietTime >= upgradeDelay && quality < QUALITY_HIGH) {
+        change(quality + 1);
+    }
+}
+
+void QualityGovernor::change(int tier) {
+    quality = tier;
+    sinceChange = 0;
+    quietTime = 0;
+}
+
+StretchQuality QualityGovernor::getQuality() const {
+    return (StretchQuality) quality.load();
+}
+
+float QualityGovernor::getLoad() const {
+    return load;
+}
+
+}
@@ -0,0 +1,81 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include "timestretcher.h"
+
+namespace TuneTutor {
+
+/**
+ * The QualityGovernor class chooses the time stretching quality tier that the
+ * machine can sustain. It is told how long each audio callback took and how
+ * long it had, and keeps a moving average of the fraction of the deadline
+ * used. When the average gets high, or a callback misses its deadline, it
+ * drops a tier; after the average has stayed low for a while, it tries the
+ * next tier up. Each drop doubles the wait before the next try, so that a
+ * machine on the edge of a tier doesn't keep switching.
+ */
+class QualityGovernor {
+
+    public:
+        /** Starts at QUALITY_MEDIUM, adapting to the load */
+        QualityGovernor();
+
+        /**
+         * Keep the given tier whatever the load, instead of adapting.
+         * @param quality the tier to use
+         */
+        void fixQuality(StretchQuality quality);
+
+        /**
+         * Record the time taken by an audio callback. Called from the audio
+         * thread.
+         *
+         * @param seconds the time the callback took
+         * @param deadline the time the callback had, which is the duration
+         *        of the audio it produced
+         */
+        void update(double seconds, double deadline);
+
+        /** @return the tier to use now. May be called from any thread. */
+        StretchQuality getQuality() const;
+
+        /**
+         * @return the moving average of the fraction of the deadline used.
+         *         May be called from any thread.
+         */
+        float getLoad() const;
+
+    private:
+        std::atomic<int> quality;
+        std::atomic<float> load;
+        bool adaptive;
+
+        // Seconds of audio since the last change of tier, and since the load
+        // was last above the upgrade threshold
+        double sinceChange;
+        double quietTime;
+
+        // Seconds the load must stay low before trying the next tier up
+        double upgradeDelay;
+
+        void change(int tier);
+};
+
+}
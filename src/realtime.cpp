@@ -0,0 +1,215 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "realtime.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/** The SCHED_FIFO priority to ask for, as JACK does by default */
+const int realtimePriority = 70;
+
+std::atomic<unsigned> allocations(0);
+std::atomic<unsigned> locks(0);
+
+// Whether the calling thread is inside a RealtimeScope
+thread_local bool realtimeThread = false;
+
+/**
+ * Read one byte of each page of a range, so that the pages are faulted in.
+ */
+void touchPages(const void *data, size_t bytes) {
+    const volatile char *p = (const volatile char *) data;
+    size_t pageSize = 4096;
+#ifdef __linux__
+    pageSize = sysconf(_SC_PAGESIZE);
+#endif
+    for (size_t i = 0; i < bytes; i += pageSize) {
+        (void) p[i];
+    }
+    if (bytes > 0) {
+        (void) p[bytes - 1];
+    }
+}
+
+}
+
+bool lockMemory(const void *data, size_t bytes) {
+    if (bytes == 0) {
+        return true;
+    }
+#ifdef __linux__
+    if (mlock(data, bytes) == 0) {
+        return true;
+    }
+    std::cout << "lockMemory: error locking " << bytes << " bytes: "
+        << strerror(errno) << std::endl;
+#endif
+    touchPages(data, bytes);
+    return false;
+}
+
+void unlockMemory(const void *data, size_t bytes) {
+#ifdef __linux__
+    if (bytes > 0) {
+        munlock(data, bytes);
+    }
+#endif
+}
+
+bool setRealtimePriority() {
+#ifdef __linux__
+    int priority = std::min(realtimePriority,
+            sched_get_priority_max(SCHED_FIFO));
+    rlimit limit;
+    if (getuid() != 0 && getrlimit(RLIMIT_RTPRIO, &limit) == 0
+            && limit.rlim_cur != RLIM_INFINITY) {
+        priority = std::min(priority, (int) limit.rlim_cur);
+    }
+    if (priority < sched_get_priority_min(SCHED_FIFO)) {
+        return false;
+    }
+    sched_param param;
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    return false;
+#endif
+}
+
+RealtimeScope::RealtimeScope() {
+    outer = !realtimeThread;
+    realtimeThread = true;
+}
+
+RealtimeScope::~RealtimeScope() {
+    if (outer) {
+        realtimeThread = false;
+    }
+}
+
+RealtimeViolations getRealtimeViolations() {
+    RealtimeViolations violations;
+    violations.allocations = allocations;
+    violations.locks = locks;
+    return violations;
+}
+
+}
+
+#if defined(TUNETUTOR_RT_CHECK) && defined(__linux__)
+
+// These definitions take the place of the C library's for the whole program.
+// They count the calls made from real-time threads, and pass every call on to
+// the C library's own implementation.
+
+extern "C" {
+
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+
+}
+
+namespace {
+
+typedef int (*MutexLockFunction)(pthread_mutex_t *);
+
+MutexLockFunction findMutexLock() {
+    return (MutexLockFunction) dlsym(RTLD_NEXT, "pthread_mutex_lock");
+}
+
+// Looked up before main() runs, while there is only one thread
+MutexLockFunction libcMutexLock = findMutexLock();
+
+inline void countAllocation() {
+    if (TuneTutor::realtimeThread) {
+        TuneTutor::allocations++;
+    }
+}
+
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    countAllocation();
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (ptr != NULL) {
+        countAllocation();
+    }
+    __libc_free(ptr);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+    countAllocation();
+    if (alignment % sizeof(void *) != 0
+            || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void *p = __libc_memalign(alignment, size);
+    if (p == NULL) {
+        return ENOMEM;
+    }
+    *ptr = p;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    if (TuneTutor::realtimeThread) {
+        TuneTutor::locks++;
+    }
+    if (libcMutexLock == NULL) {
+        // Called by a static constructor that ran before the lookup
+        libcMutexLock = findMutexLock();
+    }
+    return libcMutexLock(mutex);
+}
+
+}
+
+#endif
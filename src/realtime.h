@@ -0,0 +1,99 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * Lock a range of memory in RAM, so that reading it from the audio thread
+ * never waits for it to be paged in. Locking faults in every page of it. If
+ * the range can't be locked, usually because it is more than the limit set by
+ * `ulimit -l`, every page is touched instead, so that at least it starts out
+ * resident. Only does anything on Linux.
+ *
+ * @param data the start of the range
+ * @param bytes the length of the range
+ * @return true if the range was locked
+ */
+bool lockMemory(const void *data, size_t bytes);
+
+/** Undo lockMemory() for the same range */
+void unlockMemory(const void *data, size_t bytes);
+
+/** Lock all the memory allocated for a vector, including unused capacity */
+template <typename T>
+bool lockMemory(const std::vector<T> &v) {
+    return lockMemory(v.data(), v.capacity() * sizeof(T));
+}
+
+template <typename T>
+void unlockMemory(const std::vector<T> &v) {
+    unlockMemory(v.data(), v.capacity() * sizeof(T));
+}
+
+/**
+ * Ask for the calling thread to be scheduled SCHED_FIFO, so that it isn't
+ * preempted by ordinary threads. Permitted for root, or a user with an
+ * rtprio limit in /etc/security/limits.conf; the priority is lowered to fit
+ * the limit. Only does anything on Linux.
+ *
+ * @return true if the thread is now real-time
+ */
+bool setRealtimePriority();
+
+/**
+ * Calls made by real-time threads that can block them, counted since the
+ * program started.
+ */
+struct RealtimeViolations {
+
+    /** Calls to malloc(), free() and their relatives */
+    unsigned allocations;
+
+    /** Calls to pthread_mutex_lock(), which std::mutex uses */
+    unsigned locks;
+
+    RealtimeViolations() {
+        allocations = 0;
+        locks = 0;
+    }
+};
+
+/**
+ * Marks the calling thread as real-time for as long as it exists. When
+ * TuneTutor is built with TUNETUTOR_RT_CHECK defined on Linux, every call the
+ * thread makes to the allocator or to lock a mutex is counted, so that code
+ * which shouldn't run on the audio thread can be found. Otherwise it does
+ * nothing.
+ */
+class RealtimeScope {
+
+    public:
+        RealtimeScope();
+        ~RealtimeScope();
+
+    private:
+        bool outer;
+};
+
+/** @return the violations counted so far; always zero without the check */
+RealtimeViolations getRealtimeViolations();
+
+}
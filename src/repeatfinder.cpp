@@ -0,0 +1,248 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "jobscheduler.h"
+#include "repeatfinder.h"
+
+namespace TuneTutor {
+
+RepeatFinder::RepeatFinder() {
+    running = false;
+    stopping = false;
+    queryStart = 0;
+    queryLength = 0;
+}
+
+void RepeatFinder::start(const std::vector<float> &pitches, size_t start,
+        size_t end) {
+    if (running || thread.joinable()) {
+        return;
+    }
+    end = std::min(end, pitches.size());
+    this->pitches = pitches;
+    queryStart = start;
+    queryLength = end > start ? end - start : 0;
+    matches.clear();
+
+    // Where no pitch was detected, carry the last detected pitch forward so
+    // that silences don't count as large jumps
+    float last = 0;
+    for (float &pitch : this->pitches) {
+        if (pitch > 0) {
+            last = pitch;
+        } else {
+            pitch = last;
+        }
+    }
+
+    running = true;
+    thread = std::thread(&RepeatFinder::run, this);
+}
+
+bool RepeatFinder::isRunning() const {
+    return running;
+}
+
+std::vector<size_t> RepeatFinder::finish() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+    std::vector<size_t> finished;
+    std::swap(finished, matches);
+    return finished;
+}
+
+/**
+ * @return the mean capped pitch difference between the start of the query and
+ *         the part of the track starting at the given offset, or a value
+ *         greater than maxSlidingDistance if it is known to be too large
+ */
+float RepeatFinder::getSlidingDistance(size_t offset) const {
+    const float *query = &pitches[queryStart];
+    const float *target = &pitches[offset];
+    const size_t length = getSlidingLength();
+    const float limit = maxSlidingDistance * length;
+    const size_t blockSize = 64;
+    float sum = 0;
+
+    // Most offsets are far from a match, so give up on an offset as soon as it
+    // can no longer match. The inner loop has no branches so that it can be
+    // vectorized.
+    for (size_t block = 0; block < length; block += blockSize) {
+        size_t blockEnd = std::min(block + blockSize, length);
+        float blockSum = 0;
+        for (size_t i = block; i < blockEnd; i++) {
+            blockSum += std::min(std::fabs(query[i] - target[i]),
+                    maxDifference);
+        }
+        sum += blockSum;
+        if (sum > limit) {
+            return std::numeric_limits<float>::max();
+        }
+    }
+    return sum / length;
+}
+
+/**
+ * Only the start of the query is compared in the first pass, because a repeat
+ * played at a slightly different tempo drifts out of line with the query
+ * towards its end.
+ */
+size_t RepeatFinder::getSlidingLength() const {
+    size_t minLength = 64;
+    return std::min(queryLength,
+            std::max(minLength, (size_t) (queryLength * slidingFraction)));
+}
+
+/**
+ * @return the mean capped pitch difference between the query and the part of
+ *         the track starting at the given offset, after aligning them with
+ *         dynamic time warping within a band around the diagonal
+ */
+float RepeatFinder::getWarpedDistance(size_t offset) const {
+    const float inf = std::numeric_limits<float>::max() / 2;
+    const float *query = &pitches[queryStart];
+    const float *target = &pitches[offset];
+    int n = queryLength;
+    int available = pitches.size() - offset;
+    int band = std::max(1, (int) (bandFraction * n));
+    int width = 2 * band + 1;
+
+    // Row i holds the costs for target indices i - band to i + band
+    std::vector<float> prev(width, inf);
+    std::vector<float> cur(width, inf);
+    for (int i = 0; i < n; i++) {
+        for (int k = 0; k < width; k++) {
+            int j = i - band + k;
+            if (j < 0 || j >= available) {
+                cur[k] = inf;
+                continue;
+            }
+            // Come from (i - 1, j - 1), (i - 1, j) or (i, j - 1)
+            float best;
+            if (i == 0 && j == 0) {
+                best = 0;
+            } else {
+                best = prev[k];
+                if (k + 1 < width) {
+                    best = std::min(best, prev[k + 1]);
+                }
+                if (k > 0) {
+                    best = std::min(best, cur[k - 1]);
+                }
+            }
+            cur[k] = best + std::min(std::fabs(query[i] - target[j]),
+                    maxDifference);
+        }
+        std::swap(prev, cur);
+    }
+
+    // The repeat may end anywhere within the band
+    float best = *std::min_element(prev.begin(), prev.end());
+    return best / n;
+}
+
+void RepeatFinder::run() {
+    size_t n = queryLength;
+    if (n == 0 || n > pitches.size()) {
+        running = false;
+        return;
+    }
+    size_t offsets = pitches.size() - n + 1;
+
+    // First pass: sliding distance at every offset, in chunks
+    std::vector<float> distances(offsets);
+    {
+        JobScheduler scheduler;
+        size_t chunkSize = std::max((size_t) 1024,
+                offsets / (scheduler.getThreadCount() * 8));
+        for (size_t first = 0; first < offsets; first += chunkSize) {
+            size_t last = std::min(first + chunkSize, offsets);
+            scheduler.submit([this, &distances, first, last]() {
+                for (size_t offset = first; offset < last && !stopping;
+                        offset++) {
+                    distances[offset] = getSlidingDistance(offset);
+                }
+            });
+        }
+        scheduler.wait();
+    }
+
+    // Take the best offsets that don't overlap the query or each other by
+    // more than half
+    std::vector<size_t> order;
+    for (size_t offset = 0; offset < offsets; offset++) {
+        if (distances[offset] <= maxSlidingDistance) {
+            order.push_back(offset);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return distances[a] < distances[b];
+    });
+    std::vector<size_t> candidates;
+    candidates.push_back(queryStart);
+    for (size_t i = 0; i < order.size() && candidates.size() <= maxCandidates;
+            i++) {
+        bool overlaps = false;
+        for (size_t candidate : candidates) {
+            size_t gap = order[i] > candidate ? order[i] - candidate
+                : candidate - order[i];
+            if (gap < n / 2) {
+                overlaps = true;
+                break;
+            }
+        }
+        if (!overlaps) {
+            candidates.push_back(order[i]);
+        }
+    }
+    candidates.erase(candidates.begin());
+
+    // Second pass: check each candidate with time warping
+    std::vector<float> warped(candidates.size());
+    {
+        JobScheduler scheduler;
+        for (size_t i = 0; i < candidates.size(); i++) {
+            scheduler.submit([this, &warped, &candidates, i]() {
+                if (!stopping) {
+                    warped[i] = getWarpedDistance(candidates[i]);
+                }
+            });
+        }
+        scheduler.wait();
+    }
+
+    for (size_t i = 0; i < candidates.size() && !stopping; i++) {
+        if (warped[i] <= maxWarpedDistance) {
+            matches.push_back(candidates[i]);
+        }
+    }
+    std::sort(matches.begin(), matches.end());
+    running = false;
+}
+
+RepeatFinder::~RepeatFinder() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+}
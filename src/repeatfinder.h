@@ -0,0 +1,103 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * The RepeatFinder class finds the places in a pitch track that are similar to
+ * one part of it, such as the repeats of a selected part of a tune.
+ *
+ * The search runs in the background in two passes, each spread over all
+ * processor cores with a JobScheduler. The first pass slides the start of the
+ * selected part along the whole track and measures the mean difference in
+ * pitch at each offset. Differences are capped at a few semitones, so that a
+ * wrong pitch estimate or an ornament counts against a match without ruling it
+ * out. The best offsets from the first pass are then checked over the whole
+ * part with dynamic time warping restricted to a narrow band, which allows for
+ * a repeat that is played a little faster or slower.
+ */
+class RepeatFinder {
+
+    public:
+        RepeatFinder();
+        ~RepeatFinder();
+
+        /**
+         * Start searching in the background. Does nothing if a search is
+         * already running.
+         *
+         * @param pitches the pitch track, as returned by
+         *        PitchDetector::getPitches(); it is copied
+         * @param start the index of the first pitch value of the part to find
+         * @param end the index after the last pitch value of the part to find
+         */
+        void start(const std::vector<float> &pitches, size_t start,
+                size_t end);
+
+        /** @return true if a search has been started and not yet finished */
+        bool isRunning() const;
+
+        /**
+         * Wait for the search to finish, and get the matches. Call this once
+         * for each search, after isRunning() returns false.
+         *
+         * @return the index of the first pitch value of each match, in order
+         *         of position, not including the part itself
+         */
+        std::vector<size_t> finish();
+
+    private:
+        /** Largest pitch difference counted, in semitones */
+        const float maxDifference = 3;
+
+        /** Fraction of the part that is compared in the first pass */
+        const float slidingFraction = 0.25;
+
+        /** Largest mean difference of a candidate in the first pass */
+        const float maxSlidingDistance = 1.5;
+
+        /** Largest mean difference of a match after time warping */
+        const float maxWarpedDistance = 0.8;
+
+        /** Largest number of candidates checked with time warping */
+        const size_t maxCandidates = 200;
+
+        /** Half-width of the time warping band, as a fraction of the length */
+        const float bandFraction = 0.1;
+
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<bool> stopping;
+
+        std::vector<float> pitches;
+        size_t queryStart;
+        size_t queryLength;
+        std::vector<size_t> matches;
+
+        void run();
+        float getSlidingDistance(size_t offset) const;
+        size_t getSlidingLength() const;
+        float getWarpedDistance(size_t offset) const;
+};
+
+}
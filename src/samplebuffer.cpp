@@ -0,0 +1,205 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "realtime.h"
+#include "samplebuffer.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Full scale of 16-bit samples, as in WAV files
+const float int16Scale = 32768.0f;
+
+uint32_t floatBits(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+float bitsFloat(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Convert a float to half precision, rounding to nearest even. Values too
+ * large for half precision become infinity. This and halfToFloat() work on
+ * the bits, after Fabian Giesen's conversions, so that they don't need
+ * hardware support.
+ */
+uint16_t floatToHalf(float value) {
+    const uint32_t infinity = 255 << 23;
+    const uint32_t halfMax = (127 + 16) << 23;
+    const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t bits = floatBits(value);
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+
+    uint16_t half;
+    if (bits >= halfMax) {
+        half = bits > infinity ? 0x7e00 : 0x7c00;
+    } else if (bits < (113 << 23)) {
+        // Too small for a normal half; adding the magic number lets the float
+        // hardware do the rounding of the subnormal
+        half = floatBits(bitsFloat(bits) + bitsFloat(denormMagic))
+            - denormMagic;
+    } else {
+        uint32_t mantissaOdd = (bits >> 13) & 1;
+        bits += ((uint32_t) (15 - 127) << 23) + 0xfff;
+        bits += mantissaOdd;
+        half = bits >> 13;
+    }
+    return half | (sign >> 16);
+}
+
+float halfToFloat(uint16_t half) {
+    const uint32_t shiftedExponent = 0x7c00 << 13;
+    const float magic = bitsFloat(113 << 23);
+
+    uint32_t bits = (half & 0x7fff) << 13;
+    uint32_t exponent = bits & shiftedExponent;
+    bits += (127 - 15) << 23;
+
+    // The special cases are selected with masks rather than branches, so
+    // that loops over this can be vectorized
+    bits += (exponent == shiftedExponent) * ((uint32_t) (128 - 16) << 23);
+    uint32_t subnormal = floatBits(bitsFloat(bits + (1 << 23)) - magic);
+    uint32_t mask = -(uint32_t) (exponent == 0);
+    bits = (subnormal & mask) | (bits & ~mask);
+    return bitsFloat(bits | (uint32_t) (half & 0x8000) << 16);
+}
+
+}
+
+SampleBuffer::SampleBuffer() {
+    format = SAMPLE_FLOAT32;
+    floatData = NULL;
+    shortData = NULL;
+    numSamples = 0;
+    locked = false;
+}
+
+size_t SampleBuffer::getBytesPerSample(SampleFormat format) {
+    return format == SAMPLE_FLOAT32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+void SampleBuffer::reset(SampleFormat format, size_t size) {
+    clear();
+    this->format = format;
+    if (format == SAMPLE_FLOAT32) {
+        floats.resize(size);
+        floatData = floats.data();
+    } else {
+        shorts.resize(size);
+        shortData = shorts.data();
+    }
+    numSamples = size;
+}
+
+void SampleBuffer::map(SampleFormat format, const void *data, size_t size) {
+    clear();
+    this->format = format;
+    if (format == SAMPLE_FLOAT32) {
+        floatData = (const float *) data;
+    } else {
+        shortData = (const uint16_t *) data;
+    }
+    numSamples = size;
+}
+
+void SampleBuffer::clear() {
+    unlock();
+    std::vector<float>().swap(floats);
+    std::vector<uint16_t>().swap(shorts);
+    floatData = NULL;
+    shortData = NULL;
+    numSamples = 0;
+}
+
+bool SampleBuffer::lock() {
+    unlock();
+    const void *data = format == SAMPLE_FLOAT32
+        ? (const void *) floatData : (const void *) shortData;
+    locked = lockMemory(data, numSamples * getBytesPerSample(format));
+    return locked;
+}
+
+void SampleBuffer::unlock() {
+    if (locked) {
+        const void *data = format == SAMPLE_FLOAT32
+            ? (const void *) floatData : (const void *) shortData;
+        unlockMemory(data, numSamples * getBytesPerSample(format));
+        locked = false;
+    }
+}
+
+size_t SampleBuffer::size() const {
+    return numSamples;
+}
+
+void SampleBuffer::store(size_t offset, const float *in, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (format == SAMPLE_FLOAT32) {
+        std::copy(in, in + count, floats.begin() + offset);
+    } else if (format == SAMPLE_INT16) {
+        uint16_t *out = &shorts[offset];
+        for (size_t i = 0; i < count; i++) {
+            float scaled = std::min(std::max(in[i] * int16Scale,
+                        -int16Scale), int16Scale - 1);
+            float rounded = scaled + (scaled < 0 ? -0.5f : 0.5f);
+            out[i] = (uint16_t) (int16_t) rounded;
+        }
+    } else {
+        uint16_t *out = &shorts[offset];
+        for (size_t i = 0; i < count; i++) {
+            out[i] = floatToHalf(in[i]);
+        }
+    }
+}
+
+void SampleBuffer::load(size_t offset, size_t count, float *out) const {
+    if (count == 0) {
+        return;
+    }
+    if (format == SAMPLE_FLOAT32) {
+        std::copy(floatData + offset, floatData + offset + count, out);
+    } else if (format == SAMPLE_INT16) {
+        const uint16_t *in = shortData + offset;
+        for (size_t i = 0; i < count; i++) {
+            out[i] = (int16_t) in[i] * (1.0f / int16Scale);
+        }
+    } else {
+        const uint16_t *in = shortData + offset;
+        for (size_t i = 0; i < count; i++) {
+            out[i] = halfToFloat(in[i]);
+        }
+    }
+}
+
+size_t SampleBuffer::getMemoryUsage() const {
+    return floats.capacity() * sizeof(float)
+        + shorts.capacity() * sizeof(uint16_t);
+}
+
+}
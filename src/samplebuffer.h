@@ -0,0 +1,127 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * Formats in which decoded samples can be kept in memory.
+ */
+enum SampleFormat {
+    /** 32-bit float, exactly as decoded */
+    SAMPLE_FLOAT32,
+
+    /** 16-bit signed integer, the resolution of most source material */
+    SAMPLE_INT16,
+
+    /** 16-bit IEEE half-precision float */
+    SAMPLE_FLOAT16
+};
+
+/**
+ * The SampleBuffer class holds interleaved samples in one of the
+ * SampleFormats. Samples are stored and loaded as floats in the range -1.0 to
+ * 1.0, and converted to and from the stored format a block at a time, so that
+ * the compact formats take half the memory of 32-bit float without the
+ * readers needing to know which format is in use. The loops that convert
+ * to float are written so that the compiler can vectorize them, since they
+ * run whenever audio is played or analyzed.
+ */
+class SampleBuffer {
+
+    public:
+        SampleBuffer();
+
+        /** @return the number of bytes each sample takes in a format */
+        static size_t getBytesPerSample(SampleFormat format);
+
+        /**
+         * Discard the contents and make room for the given number of samples,
+         * which are initially zero.
+         */
+        void reset(SampleFormat format, size_t size);
+
+        /**
+         * Use samples that are already in memory in the given format, such
+         * as those of a mapped file, instead of a copy of them. The memory
+         * must remain valid until the buffer is reset or cleared, and the
+         * samples can't be stored to.
+         */
+        void map(SampleFormat format, const void *data, size_t size);
+
+        /** Discard the contents and free the memory */
+        void clear();
+
+        /**
+         * Lock the samples in RAM, with lockMemory(). They stay locked until
+         * unlock() is called or the contents are discarded.
+         *
+         * @return true if the samples were locked
+         */
+        bool lock();
+
+        /** Undo lock() */
+        void unlock();
+
+        /** @return the number of samples */
+        size_t size() const;
+
+        /**
+         * Convert samples into the buffer. Stores to separate parts of the
+         * buffer may be done from several threads at once.
+         *
+         * @param offset the index of the first sample to store
+         * @param in the samples to store
+         * @param count the number of samples to store
+         */
+        void store(size_t offset, const float *in, size_t count);
+
+        /**
+         * Convert samples out of the buffer.
+         *
+         * @param offset the index of the first sample to load
+         * @param count the number of samples to load
+         * @param out the buffer for the samples
+         */
+        void load(size_t offset, size_t count, float *out) const;
+
+        /**
+         * @return the number of bytes of memory allocated, which doesn't
+         *         include mapped samples
+         */
+        size_t getMemoryUsage() const;
+
+    private:
+        SampleFormat format;
+
+        // Only the one for the format in use has any samples. The 16-bit
+        // formats share one vector.
+        std::vector<float> floats;
+        std::vector<uint16_t> shorts;
+
+        // The samples being used, in one of the vectors or mapped
+        const float *floatData;
+        const uint16_t *shortData;
+        size_t numSamples;
+        bool locked;
+};
+
+}
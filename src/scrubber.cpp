@@ -0,0 +1,141 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "scrubber.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const double pi = 3.14159265358979323846;
+
+}
+
+const int Scrubber::grainLength;
+const int Scrubber::grainHop;
+const int Scrubber::holdGrains;
+
+Scrubber::Scrubber(const SoundFile &soundFile) {
+    this->soundFile = &soundFile;
+    fileChannels = std::max(soundFile.getChannels(), 1);
+    inputRate = std::max(soundFile.getSampleRate(), 1);
+    position = 0;
+    starting = false;
+    lastPosition = 0;
+    direction = 1;
+    stillGrains = holdGrains;
+    mix.resize(grainLength * 2);
+    mixPos = 0;
+
+    // A periodic Hann window, so that grains overlapping by half sum to one
+    window.resize(grainLength);
+    for (int i = 0; i < grainLength; i++) {
+        window[i] = 0.5f - 0.5f * std::cos(2 * pi * i / grainLength);
+    }
+
+    setOutputRate(inputRate);
+}
+
+void Scrubber::setOutputRate(int rate) {
+    step = inputRate / (double) std::max(rate, 1);
+
+    // One more frame than the grain spans, to interpolate the last one
+    inputFrames.resize(((int) std::ceil(grainLength * step) + 2)
+            * fileChannels);
+}
+
+void Scrubber::start(int64_t position) {
+    this->position = position;
+    starting = true;
+}
+
+void Scrubber::setPosition(int64_t position) {
+    this->position = position;
+}
+
+/**
+ * Add a grain centred on the latest position to the mix, and shift the part of
+ * the mix already output out of it.
+ */
+void Scrubber::addGrain() {
+    std::copy(mix.begin() + grainHop * 2, mix.end(), mix.begin());
+    std::fill(mix.end() - grainHop * 2, mix.end(), 0.0f);
+    mixPos = 0;
+
+    int64_t target = position;
+    if (target != lastPosition) {
+        direction = target > lastPosition ? 1 : -1;
+        stillGrains = 0;
+        lastPosition = target;
+    } else if (stillGrains < holdGrains) {
+        stillGrains++;
+    }
+    if (stillGrains >= holdGrains) {
+        return;
+    }
+
+    // Read the span of the grain, which runs backward from its end when the
+    // position is moving backward. A page of a long file that isn't decoded
+    // yet is silent until the store has decoded it.
+    int spanFrames = inputFrames.size() / fileChannels;
+    int64_t first = direction > 0
+        ? target - (int64_t) (grainLength * step / 2)
+        : target + (int64_t) (grainLength * step / 2) - spanFrames + 1;
+    soundFile->readFrames(first, spanFrames, &inputFrames[0], false);
+
+    // Fade the grain as the position comes to rest
+    float gain = std::min(1.0f, 2.0f * (holdGrains - stillGrains)
+            / holdGrains);
+    double pos = direction > 0 ? 0 : spanFrames - 1;
+    for (int i = 0; i < grainLength; i++) {
+        int frame = std::min((int) pos, spanFrames - 2);
+        float frac = pos - frame;
+        const float *a = &inputFrames[frame * fileChannels];
+        const float *b = a + fileChannels;
+        float w = window[i] * gain;
+        for (int c = 0; c < 2; c++) {
+            int ch = std::min(c, fileChannels - 1);
+            mix[i * 2 + c] += w * (a[ch] + frac * (b[ch] - a[ch]));
+        }
+        pos += direction * step;
+    }
+}
+
+void Scrubber::getOutput(float *output, int bufferSize, int outputChannels) {
+    if (starting.exchange(false)) {
+        lastPosition = position;
+        stillGrains = holdGrains;
+        std::fill(mix.begin(), mix.end(), 0.0f);
+        mixPos = grainHop;
+    }
+    for (int i = 0; i < bufferSize; i++) {
+        if (mixPos == grainHop) {
+            addGrain();
+        }
+        const float *frame = &mix[mixPos * 2];
+        for (int c = 0; c < outputChannels; c++) {
+            output[i * outputChannels + c] = outputChannels == 1
+                ? 0.5f * (frame[0] + frame[1])
+                : c < 2 ? frame[c] : 0.0f;
+        }
+        mixPos++;
+    }
+}
+
+}
@@ -0,0 +1,121 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "soundfile.h"
+
+namespace TuneTutor {
+
+/**
+ * The Scrubber class plays the audio around a position that is being dragged
+ * with the mouse, so that a place in the tune can be found by ear. It is a
+ * simple granular engine: every few milliseconds it starts a short grain of
+ * audio at the latest position, played forward or backward in the direction
+ * the position is moving, and overlap-adds it to the previous grain under a
+ * Hann window. When the position stops moving, the output fades out.
+ *
+ * It is much cheaper than the TimeStretcher and keeps no state that depends on
+ * the position, so the position can jump anywhere at any time.
+ */
+class Scrubber {
+
+    public:
+        /**
+         * @param soundFile Must already have a sound loaded via load(), and
+         *        must outlive the Scrubber
+         */
+        Scrubber(const SoundFile &soundFile);
+
+        /**
+         * Set the sample rate of the output device. It is the sound file's
+         * sample rate until this is called. Must not be called while
+         * getOutput() may be running.
+         *
+         * @param rate the output sample rate in Hz
+         */
+        void setOutputRate(int rate);
+
+        /**
+         * Start scrubbing at the given position, with silence until it moves.
+         * Any grains still playing from an earlier scrub are dropped on the
+         * next call to getOutput(). May be called from any thread.
+         *
+         * @param position the frame to start at
+         */
+        void start(int64_t position);
+
+        /**
+         * Move the position to scrub around. May be called from any thread.
+         *
+         * @param position the frame the next grain will be centred on
+         */
+        void setPosition(int64_t position);
+
+        /**
+         * Get a block of output frames, interleaved by channel. Called from
+         * the audio thread.
+         *
+         * @param output a pointer to the output buffer
+         * @param bufferSize the number of frames in the output buffer
+         * @param outputChannels the number of channels in each output frame
+         */
+        void getOutput(float *output, int bufferSize, int outputChannels);
+
+    private:
+        // Output frames in each grain, and between the starts of grains
+        static const int grainLength = 512;
+        static const int grainHop = grainLength / 2;
+
+        // Grains to keep playing after the position stops moving, long
+        // enough to bridge the gaps between mouse events; the second half of
+        // them fade out
+        static const int holdGrains = 16;
+
+        const SoundFile *soundFile;
+        int fileChannels;
+        int inputRate;
+
+        // Input frames per output frame
+        double step;
+
+        // Set by the GUI thread, and read by the audio thread
+        std::atomic<int64_t> position;
+        std::atomic<bool> starting;
+
+        // The position and direction of the last grain, and the number of
+        // grains since the position last moved
+        int64_t lastPosition;
+        int direction;
+        int stillGrains;
+
+        // The sum of the grains still playing, with two output channels, and
+        // the next frame of it to output
+        std::vector<float> mix;
+        int mixPos;
+
+        // Input frames read for one grain, and the Hann window
+        std::vector<float> inputFrames;
+        std::vector<float> window;
+
+        void addGrain();
+};
+
+}
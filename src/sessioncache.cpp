@@ -0,0 +1,106 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+
+#include "sessioncache.h"
+
+namespace TuneTutor {
+
+namespace {
+
+/** Rough size of the Rubber Band and native stretchers' buffers */
+const size_t stretcherMemory = (2 << 20) + (512 << 10);
+
+const size_t defaultBudget = 1 << 30;
+
+}
+
+size_t TuneSession::getMemoryUsage() const {
+    size_t bytes = soundFile.getMemoryUsage();
+    if (pitchDetector != NULL) {
+        bytes += pitchDetector->getMemoryUsage();
+    }
+    if (stretcher != NULL) {
+        bytes += stretcherMemory;
+    }
+    if (cueCache != NULL) {
+        bytes += cueCache->getMemoryUsage();
+    }
+    return bytes;
+}
+
+SessionCache::SessionCache() {
+    budget = defaultBudget;
+    useCount = 0;
+}
+
+void SessionCache::setBudget(size_t budget) {
+    this->budget = budget;
+    evict();
+}
+
+TuneSession *SessionCache::find(std::string path) {
+    for (size_t i = 0; i < sessions.size(); i++) {
+        if (sessions[i]->path == path) {
+            lastUsed[i] = ++useCount;
+            return sessions[i];
+        }
+    }
+    return NULL;
+}
+
+void SessionCache::add(TuneSession *session) {
+    sessions.push_back(session);
+    lastUsed.push_back(++useCount);
+    evict();
+}
+
+const std::vector<TuneSession *> &SessionCache::getSessions() const {
+    return sessions;
+}
+
+size_t SessionCache::getMemoryUsage() const {
+    size_t bytes = 0;
+    for (const TuneSession *session : sessions) {
+        bytes += session->getMemoryUsage();
+    }
+    return bytes;
+}
+
+void SessionCache::evict() {
+    while (sessions.size() > 1 && getMemoryUsage() > budget) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < sessions.size(); i++) {
+            if (lastUsed[i] < lastUsed[oldest]) {
+                oldest = i;
+            }
+        }
+        std::cout << "SessionCache: closing " << sessions[oldest]->path
+            << std::endl;
+        delete sessions[oldest];
+        sessions.erase(sessions.begin() + oldest);
+        lastUsed.erase(lastUsed.begin() + oldest);
+    }
+}
+
+SessionCache::~SessionCache() {
+    for (TuneSession *session : sessions) {
+        delete session;
+    }
+}
+
+}
@@ -0,0 +1,137 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cuecache.h"
+#include "pitchdetector.h"
+#include "scrubber.h"
+#include "soundfile.h"
+#include "timestretcher.h"
+
+namespace TuneTutor {
+
+/**
+ * An open tune: its decoded audio, and the objects derived from it that are
+ * expensive to recreate. The saved state of the tune (marks, selection,
+ * parameters) is not kept here, since it is cheap to load from the tune's
+ * state file.
+ */
+struct TuneSession {
+
+    /** Full path to the sound file */
+    std::string path;
+
+    /** Content hash of the sound file, as returned by getContentHash() */
+    std::string hash;
+
+    /** Modification time and size of the sound file when it was hashed */
+    int64_t fileModified;
+    int64_t fileSize;
+
+    SoundFile soundFile;
+
+    /** Owned by the session; created from soundFile */
+    TimeStretcher *stretcher;
+    Scrubber *scrubber;
+    CueCache *cueCache;
+    PitchDetector *pitchDetector;
+
+    /** Playhead position when the tune was last switched away from */
+    int64_t playheadPos;
+
+    TuneSession() {
+        path = "";
+        hash = "";
+        fileModified = 0;
+        fileSize = 0;
+        stretcher = NULL;
+        scrubber = NULL;
+        cueCache = NULL;
+        pitchDetector = NULL;
+        playheadPos = 0;
+    }
+
+    ~TuneSession() {
+        delete stretcher;
+        delete scrubber;
+        delete cueCache;
+        delete pitchDetector;
+    }
+
+    /** @return the approximate number of bytes of memory used */
+    size_t getMemoryUsage() const;
+
+    private:
+        TuneSession(const TuneSession &other);
+        TuneSession &operator=(const TuneSession &other);
+};
+
+/**
+ * The SessionCache class keeps recently used TuneSessions in memory, so that
+ * switching back to one of them doesn't need to decode and analyze it again.
+ * When the sessions together use more memory than the budget, the least
+ * recently used ones are deleted; the tune's pitches and state remain in its
+ * disk caches, so reopening it only needs to decode it again. The most
+ * recently used session is never deleted, however large it is.
+ */
+class SessionCache {
+
+    public:
+        /** The memory budget is 1 GB until setBudget() is called */
+        SessionCache();
+        ~SessionCache();
+
+        /** @param budget the memory budget in bytes */
+        void setBudget(size_t budget);
+
+        /**
+         * @return the session for the given file, now the most recently used,
+         *         or NULL if it isn't cached
+         */
+        TuneSession *find(std::string path);
+
+        /**
+         * Add a session, which becomes the most recently used, and delete
+         * least recently used sessions until the cache fits in the budget.
+         *
+         * @param session a session allocated with new, now owned by the cache
+         */
+        void add(TuneSession *session);
+
+        /** @return the cached sessions, in the order they were added */
+        const std::vector<TuneSession *> &getSessions() const;
+
+        /** @return the approximate number of bytes used by all sessions */
+        size_t getMemoryUsage() const;
+
+    private:
+        size_t budget;
+        std::vector<TuneSession *> sessions;
+
+        // Time of last use of each session, in the same order
+        std::vector<uint64_t> lastUsed;
+        uint64_t useCount;
+
+        void evict();
+};
+
+}
@@ -0,0 +1,81 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+#include <iostream>
+
+#include "sndfiledecoder.h"
+
+namespace TuneTutor {
+
+namespace {
+
+std::string getString(SNDFILE *file, int type) {
+    const char *value = sf_get_string(file, type);
+    return value != NULL ? value : "";
+}
+
+}
+
+SndfileDecoder::SndfileDecoder() {
+    file = NULL;
+    memset(&info, 0, sizeof(info));
+}
+
+bool SndfileDecoder::open(std::string path) {
+    file = sf_open(path.c_str(), SFM_READ, &info);
+    if (file == NULL) {
+        std::cout << "SndfileDecoder: " << sf_strerror(NULL) << std::endl;
+        return false;
+    }
+    metadata.title = getString(file, SF_STR_TITLE);
+    metadata.artist = getString(file, SF_STR_ARTIST);
+    metadata.album = getString(file, SF_STR_ALBUM);
+    return true;
+}
+
+int SndfileDecoder::getSampleRate() const {
+    return info.samplerate;
+}
+
+int SndfileDecoder::getChannels() const {
+    return info.channels;
+}
+
+int64_t SndfileDecoder::getLength() const {
+    return info.frames;
+}
+
+SoundFileMetadata SndfileDecoder::getMetadata() const {
+    return metadata;
+}
+
+bool SndfileDecoder::seek(int64_t frame) {
+    return sf_seek(file, frame, SEEK_SET) >= 0;
+}
+
+size_t SndfileDecoder::read(float *out, size_t frames) {
+    sf_count_t count = sf_readf_float(file, out, frames);
+    return count > 0 ? count : 0;
+}
+
+SndfileDecoder::~SndfileDecoder() {
+    if (file != NULL) {
+        sf_close(file);
+    }
+}
+
+}
@@ -0,0 +1,53 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <sndfile.h>
+
+#include "audiodecoder.h"
+
+namespace TuneTutor {
+
+/**
+ * The SndfileDecoder class decodes the formats supported by libsndfile that
+ * WavDecoder and Mp3Decoder don't handle, namely FLAC and Ogg Vorbis.
+ */
+class SndfileDecoder : public AudioDecoder {
+
+    public:
+        SndfileDecoder();
+        ~SndfileDecoder();
+
+        bool open(std::string path);
+        int getSampleRate() const;
+        int getChannels() const;
+        int64_t getLength() const;
+        SoundFileMetadata getMetadata() const;
+
+    protected:
+        bool seek(int64_t frame);
+        size_t read(float *out, size_t frames);
+
+    private:
+        SNDFILE *file;
+        SF_INFO info;
+        SoundFileMetadata metadata;
+};
+
+}
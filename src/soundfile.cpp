@@ -14,26 +14,102 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
 
-extern "C" {
-#include <mpg123.h>
-}
-
 #include "soundfile.h"
 
 namespace TuneTutor {
 
+namespace {
+
+// Set before any files are loaded, so they aren't guarded
+size_t maxResidentBytes = (size_t) 512 << 20;
+SampleFormat sampleFormat = SAMPLE_FLOAT32;
+
+}
+
 SoundFile::SoundFile() {
     sampleRate = 0;
     channels = 0;
+    length = 0;
+    loaded = false;
 }
 
-bool SoundFile::load(std::string path) {
-    loaded = loadMp3(path);
-    return loaded;
+void SoundFile::setMaxResidentBytes(size_t bytes) {
+    maxResidentBytes = bytes;
+}
+
+void SoundFile::setSampleFormat(SampleFormat format) {
+    sampleFormat = format;
+}
+
+void SoundFile::unload() {
+    samples.clear();
+    pages.reset();
+    source.reset();
+    metadata = SoundFileMetadata();
+    loaded = false;
+}
+
+bool SoundFile::load(std::string path, int numThreads) {
+    unload();
+    std::shared_ptr<AudioDecoder> decoder(createDecoder(path));
+    if (!decoder || !decoder->open(path)) {
+        std::cout << "SoundFile: can't load " << path << std::endl;
+        return false;
+    }
+    sampleRate = decoder->getSampleRate();
+    channels = decoder->getChannels();
+    length = decoder->getLength();
+    metadata = decoder->getMetadata();
+
+    const void *data;
+    SampleFormat format;
+    if (decoder->getMappedSamples(data, format)) {
+        // The mapping lasts as long as the decoder
+        samples.map(format, data, length * channels);
+        source = decoder;
+    } else if (length > 0 && (size_t) length * channels
+            * SampleBuffer::getBytesPerSample(sampleFormat)
+            > maxResidentBytes) {
+        // Index the whole file, so that pages can be decoded from anywhere in
+        // it, and so that the length is exact. The store owns the decoder.
+        decoder->scan();
+        length = decoder->getLength();
+        pages.reset(new PagedSampleStore(
+                    [decoder](int64_t start, size_t frames, float *out) {
+                        return decoder->readAt(start, frames, out);
+                    },
+                    channels, length, maxResidentBytes, sampleFormat));
+    } else {
+        if (!decoder->decodeAll(samples, sampleFormat, numThreads)) {
+            std::cout << "SoundFile: can't decode " << path << std::endl;
+            return false;
+        }
+        length = samples.size() / channels;
+    }
+    loaded = true;
+    return true;
+}
+
+bool SoundFile::loadInfo(std::string path) {
+    unload();
+    std::unique_ptr<AudioDecoder> decoder(createDecoder(path));
+    if (!decoder || !decoder->open(path)) {
+        return false;
+    }
+    sampleRate = decoder->getSampleRate();
+    channels = decoder->getChannels();
+    length = decoder->getLength();
+    metadata = decoder->getMetadata();
+    loaded = true;
+    return true;
 }
 
 bool SoundFile::isLoaded() const {
@@ -48,61 +124,130 @@ int SoundFile::getChannels() const {
     return channels;
 }
 
-std::vector<float> SoundFile::getSamples() const {
-    return samples;
+int64_t SoundFile::getLength() const {
+    return length;
+}
+
+void SoundFile::readFrames(int64_t start, size_t count, float *out,
+        bool wait) const {
+    if (pages) {
+        pages->read(start, count, out, wait);
+        return;
+    }
+    int64_t available = samples.size() / std::max(channels, 1);
+    size_t done = 0;
+    if (start < 0) {
+        done = std::min((int64_t) count, -start);
+        std::fill(out, out + done * channels, 0.0f);
+    }
+    int64_t frame = start + (int64_t) done;
+    if (frame < available) {
+        size_t n = std::min((int64_t) (count - done), available - frame);
+        samples.load(frame * channels, n * channels, out + done * channels);
+        done += n;
+    }
+    std::fill(out + done * channels, out + count * channels, 0.0f);
+}
+
+void SoundFile::prefetch(int64_t position) const {
+    if (pages) {
+        pages->prefetch(position);
+    }
+}
+
+bool SoundFile::lockMemory() {
+    if (pages) {
+        std::cout << "SoundFile: a paged file can't be locked in memory"
+            << std::endl;
+        return false;
+    }
+    return samples.lock();
+}
+
+void SoundFile::unlockMemory() {
+    samples.unlock();
+}
+
+size_t SoundFile::getMemoryUsage() const {
+    size_t bytes = samples.getMemoryUsage();
+    if (pages) {
+        bytes += pages->getMemoryUsage();
+    }
+    return bytes;
 }
 
 SoundFileMetadata SoundFile::getMetadata() const {
     return metadata;
 }
 
-bool SoundFile::loadMp3(std::string path) {
-	int err = MPG123_OK;
-    mpg123_init();
-	mpg123_handle *f = mpg123_new(NULL, &err);
-    mpg123_param(f, MPG123_ADD_FLAGS, MPG123_FORCE_FLOAT, 0.);
-	if ((err = mpg123_open(f, path.c_str())) != MPG123_OK) {
-        std::cout << "loadMp3(): mpg123_open() returned " << err << "\n";
-		return false;
-	}
-
-	mpg123_enc_enum encoding;
-    long rate;
-	mpg123_getformat(f, &rate, &channels, (int*) &encoding);
-    sampleRate = rate;
-
-	size_t done=0;
-    samples.resize(mpg123_length(f) * channels);
-    mpg123_read(f, (unsigned char *) &(samples[0]),
-            samples.size() * sizeof(float), &done);
-
-    // Get the metadata
-    mpg123_id3v1 *id3v1;
-    mpg123_id3v2 *id3v2;
-    mpg123_id3(f, &id3v1, &id3v2);
-    if (id3v1 != NULL) {
-        std::cout << "id3v1 data found" << std::endl;
-        metadata.title = std::string(id3v1->title, 30);
-        metadata.artist = std::string(id3v1->artist, 30);
-        metadata.album = std::string(id3v1->album, 30);
+std::string getContentHash(std::string path) {
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL) {
+        return "";
     }
-    if (id3v2 != NULL) {
-        std::cout << "id3v2 data found" << std::endl;
-        if (id3v2->title != NULL) {
-            metadata.title = id3v2->title->p;
+
+    // Find the audio data between any ID3v2 tag at the start of the file and
+    // any ID3v1 tag at the end
+    fseek(f, 0, SEEK_END);
+    long end = ftell(f);
+    long start = 0;
+    unsigned char header[10];
+    fseek(f, 0, SEEK_SET);
+    if (fread(header, 1, 10, f) == 10 && memcmp(header, "ID3", 3) == 0) {
+        // The tag size is a 28-bit "syncsafe" integer excluding the header
+        start = 10 + ((header[6] & 0x7f) << 21 | (header[7] & 0x7f) << 14
+                | (header[8] & 0x7f) << 7 | (header[9] & 0x7f));
+        if (header[5] & 0x10) {
+            start += 10; // footer
         }
-        if (id3v2->artist != NULL) {
-            metadata.artist = id3v2->artist->p;
+    }
+    char tag[3];
+    if (end - start >= 128 && fseek(f, end - 128, SEEK_SET) == 0
+            && fread(tag, 1, 3, f) == 3 && memcmp(tag, "TAG", 3) == 0) {
+        end -= 128;
+    }
+    if (start > end) {
+        start = end;
+    }
+
+    // 64-bit multiply-rotate hash over 8-byte words, with any trailing bytes
+    // zero-padded into a final word
+    const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t hash = prime1 ^ (uint64_t) (end - start);
+    std::vector<uint64_t> buf(1 << 16);
+    long remaining = end - start;
+    fseek(f, start, SEEK_SET);
+    while (remaining > 0) {
+        size_t want = std::min((long) (buf.size() * sizeof(uint64_t)),
+                remaining);
+        size_t got = fread(&buf[0], 1, want, f);
+        if (got == 0) {
+            break;
+        }
+        remaining -= got;
+        size_t words = (got + 7) / 8;
+        if (got % 8 != 0) {
+            memset((char *) &buf[0] + got, 0, words * 8 - got);
         }
-        if (id3v2->album != NULL) {
-            metadata.album = id3v2->album->p;
+        for (size_t i = 0; i < words; i++) {
+            hash ^= buf[i] * prime2;
+            hash = (hash << 31 | hash >> 33) * prime1;
         }
     }
+    fclose(f);
+
+    hash ^= hash >> 29;
+    hash *= prime2;
+    hash ^= hash >> 32;
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+    return std::string(hex);
+}
 
-	mpg123_close(f);
-	mpg123_delete(f);
-    
-    return true;
+bool isSoundFilePath(std::string path) {
+    std::unique_ptr<AudioDecoder> decoder(createDecoder(path));
+    return decoder != NULL;
 }
 
 }
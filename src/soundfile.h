@@ -16,33 +16,30 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
-namespace TuneTutor {
+#include "audiodecoder.h"
+#include "pagedsamplestore.h"
+#include "samplebuffer.h"
 
-/**
- * Simple container for metadata fields extracted from a sound file.
- */
-struct SoundFileMetadata {
-    std::string title;
-    std::string artist;
-    std::string album;
-
-    SoundFileMetadata() {
-        title = "";
-        artist = "";
-        album = "";
-    }
-};
+namespace TuneTutor {
 
 /**
  * The SoundFile class is responsible for loading audio from a local file,
  * providing access to the sample data, and providing access to metadata
- * embedded in the audio file. Currently, only MP3 files are supported, but
- * support for additional formats could be implemented fairly easily and
- * transparently to the rest of the application. MP3 decoding is provided by
- * libmpg123, and libsndfile is a likely choice for additional formats.
+ * embedded in the audio file. The decoding itself is done by an AudioDecoder
+ * for the file's format: MP3 files are decoded by libmpg123, WAV files are
+ * read directly, and FLAC and Ogg Vorbis files are decoded by libsndfile.
+ * The samples of a 16-bit or float WAV file are used in place from the
+ * mapped file rather than being copied.
+ *
+ * A file that would take more memory than the resident limit when fully
+ * decoded, such as a recording of a whole workshop, is instead decoded a page
+ * at a time as it is read, through a PagedSampleStore.
  */
 class SoundFile {
 
@@ -50,30 +47,123 @@ class SoundFile {
         SoundFile();
 
         /**
-         * Load the given file's metadata and sample data into memory.
+         * Set the most memory to use for the sample data of one file. It
+         * applies to files loaded after it is set.
+         *
+         * @param bytes the limit in bytes
+         */
+        static void setMaxResidentBytes(size_t bytes);
+
+        /**
+         * Set the format in which to keep sample data in memory. The 16-bit
+         * formats halve the memory used, and are converted back to float as
+         * the samples are read. It applies to files loaded after it is set.
+         *
+         * @param format the format to use
+         */
+        static void setSampleFormat(SampleFormat format);
+
+        /**
+         * Load the given file's metadata and sample data into memory, or
+         * prepare to decode the sample data as it is read if it is too long.
+         * A long MP3 file is split into ranges that are decoded on separate
+         * threads.
+         *
          * @param path the full path to the file
+         * @param numThreads the most threads to decode with, or 0 for one per
+         *        processor core
          */
-        bool load(std::string path);
+        bool load(std::string path, int numThreads = 0);
+
+        /**
+         * Load only the given file's metadata, format, and length, without
+         * decoding the sample data. The length of an MP3 file comes from its
+         * Xing/Info header if it has one, and is otherwise estimated from the
+         * file size and bitrate.
+         * @param path the full path to the file
+         */
+        bool loadInfo(std::string path);
 
         int getSampleRate() const;
         int getChannels() const;
+
+        /** @return the length of the loaded file in sample frames */
+        int64_t getLength() const;
+
         bool isLoaded() const;
         SoundFileMetadata getMetadata() const;
 
         /**
-         * Get the sample data of the loaded file. The data is a vector of
-         * floats in the range -1.0 to 1.0, and the channels are interleaved.
-         * @return the sample data of the loaded file
+         * Get sample frames of the loaded file, as floats in the range -1.0 to
+         * 1.0 with the channels interleaved. Frames before the start or past
+         * the end of the file are zero. May be called from any thread.
+         *
+         * @param start the first frame to get
+         * @param count the number of frames to get
+         * @param out the buffer for count * getChannels() samples
+         * @param wait false to read the pages of a paged file that aren't
+         *        decoded yet as silence, so that the call never waits for the
+         *        decoder, as on the audio thread
          */
-        std::vector<float> getSamples() const;
+        void readFrames(int64_t start, size_t count, float *out,
+                bool wait = true) const;
+
+        /**
+         * Let the file know that playback has reached the given frame, so
+         * that a paged file can decode what follows in advance. Returns
+         * immediately.
+         *
+         * @param position the frame that playback has reached
+         */
+        void prefetch(int64_t position) const;
+
+        /**
+         * Lock the sample data in RAM, so that reading it never waits for the
+         * disk; see lockMemory() in realtime.h. A paged file can't be locked,
+         * since its pages come and go as it plays.
+         *
+         * @return true if the samples were locked
+         */
+        bool lockMemory();
+
+        /** Undo lockMemory() */
+        void unlockMemory();
+
+        /** @return the number of bytes of sample data held in memory */
+        size_t getMemoryUsage() const;
 
     private:
         int sampleRate;
         int channels;
         SoundFileMetadata metadata;
-        std::vector<float> samples;
-        bool loadMp3(std::string path);
+
+        // All of the sample data, or NULL pages and empty samples
+        SampleBuffer samples;
+        std::unique_ptr<PagedSampleStore> pages;
+
+        // Kept open while its mapped samples are in use
+        std::shared_ptr<AudioDecoder> source;
+
+        int64_t length;
         bool loaded;
+
+        void unload();
 };
 
+/**
+ * Compute a hash of the audio content of a file, ignoring any ID3 tags, so
+ * that the same recording can be recognized after it has been renamed, moved,
+ * or retagged.
+ *
+ * @param path the full path to the file
+ * @return the hash as a hexadecimal string, or "" if the file can't be read
+ */
+std::string getContentHash(std::string path);
+
+/**
+ * @param path the path or name of a file
+ * @return true if the file's extension is that of a supported format
+ */
+bool isSoundFilePath(std::string path);
+
 }
@@ -17,91 +17,322 @@
 #include <algorithm>
 #include <cmath>
 
+#include "realtime.h"
 #include "timestretcher.h"
 
 namespace TuneTutor {
 
+namespace {
+
+/**
+ * Split interleaved frames into one buffer per channel. The channel count is
+ * a template parameter so that the inner loop is unrolled and the compiler
+ * can vectorize the loads.
+ */
+template <int channels>
+void deinterleave(const float *in, float *const *out, size_t frames) {
+    for (int c = 0; c < channels; c++) {
+        float *dest = out[c];
+        for (size_t i = 0; i < frames; i++) {
+            dest[i] = in[i * channels + c];
+        }
+    }
+}
+
+/**
+ * Mix interleaved frames of any number of channels down to two buffers, with
+ * the even channels on the left and the odd channels on the right.
+ */
+void downmixToStereo(const float *in, int inChannels, float *const *out,
+        size_t frames) {
+    float gain = 1.0f / ((inChannels + 1) / 2);
+    for (size_t i = 0; i < frames; i++) {
+        float left = 0;
+        float right = 0;
+        const float *frame = in + i * inChannels;
+        for (int c = 0; c + 1 < inChannels; c += 2) {
+            left += frame[c];
+            right += frame[c + 1];
+        }
+        if (inChannels % 2 == 1) {
+            left += frame[inChannels - 1];
+        }
+        out[0][i] = left * gain;
+        out[1][i] = right * gain;
+    }
+}
+
+/**
+ * Interleave one buffer per channel into frames of outChannels channels. Each
+ * output channel takes input channel c % inChannels, so a mono input is
+ * copied to every output channel.
+ */
+template <int inChannels, int outChannels>
+void interleave(float *const *in, float *out, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        for (int c = 0; c < outChannels; c++) {
+            out[i * outChannels + c] = in[c % inChannels][i];
+        }
+    }
+}
+
+/**
+ * Interleave for any channel counts not specialized above. Output channels
+ * beyond the input channels are silent, except that a mono input is copied to
+ * all of them, and a stereo input is mixed down to a mono output.
+ */
+void interleaveAny(float *const *in, int inChannels, float *out,
+        int outChannels, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        float *frame = out + i * outChannels;
+        if (outChannels == 1) {
+            frame[0] = inChannels == 1 ? in[0][i]
+                : 0.5f * (in[0][i] + in[1][i]);
+            continue;
+        }
+        for (int c = 0; c < outChannels; c++) {
+            frame[c] = inChannels == 1 ? in[0][i]
+                : c < inChannels ? in[c][i] : 0.0f;
+        }
+    }
+}
+
+}
+
 TimeStretcher::TimeStretcher(const SoundFile &soundFile) {
-    this->soundFile = soundFile;
-    channels = soundFile.getChannels();
-    inputSamples = soundFile.getSamples();
-
-    stretchInBufL.resize(maxProcessSize);
-    stretchInBufR.resize(maxProcessSize);
-    stretchInBuf.resize(channels);
-    stretchInBuf[0] = &(stretchInBufL[0]);
-    stretchInBuf[1] = &(stretchInBufR[0]);
-
-    stretchOutBufL.resize(maxProcessSize);
-    stretchOutBufR.resize(maxProcessSize);
-    stretchOutBuf.resize(channels);
-    stretchOutBuf[0] = &(stretchOutBufL[0]);
-    stretchOutBuf[1] = &(stretchOutBufR[0]);
+    fileChannels = std::max(soundFile.getChannels(), 1);
+    channels = std::min(fileChannels, 2);
+    this->soundFile = &soundFile;
+    inputFrames.resize(maxProcessSize * fileChannels);
+
+    stretchInData.resize(maxProcessSize * channels);
+    stretchOutData.resize(maxProcessSize * channels);
+    for (int c = 0; c < channels; c++) {
+        stretchInBuf.push_back(&stretchInData[c * maxProcessSize]);
+        stretchOutBuf.push_back(&stretchOutData[c * maxProcessSize]);
+    }
+
+    inputRate = std::max(soundFile.getSampleRate(), 1);
+    outputRate = inputRate;
+    speed = 1;
+    semitones = 0;
+    quality = QUALITY_MEDIUM;
+    waitForPages = true;
 
     rubberband = new RubberBand::RubberBandStretcher(
-            soundFile.getSampleRate(), channels,
+            inputRate, channels,
             RubberBand::RubberBandStretcher::DefaultOptions |
             RubberBand::RubberBandStretcher::OptionProcessRealTime);
     rubberband->setMaxProcessSize(maxProcessSize);
+    native = new NativeStretcher(channels);
+    backend = STRETCH_RUBBERBAND;
 
     playheadPos = 0;
 }
 
-void TimeStretcher::seek(int position) {
+void TimeStretcher::seek(int64_t position) {
     playheadPos = position;
 }
 
-int TimeStretcher::getPosition() const {
+void TimeStretcher::reset() {
+    rubberband->reset();
+    native->reset();
+}
+
+int64_t TimeStretcher::getPosition() const {
     return playheadPos;
 }
 
 void TimeStretcher::setSpeed(double ratio) {
-    rubberband->setTimeRatio(1.0 / std::max(ratio, minSpeedRatio));
+    speed = std::max(ratio, minSpeedRatio);
+    updateRatios();
 }
 
 void TimeStretcher::setPitch(double semitones) {
-    rubberband->setPitchScale(std::pow(2.0, semitones / 12.0));
-}
-
-void TimeStretcher::getOutput(float *output, int bufferSize) {
- 
-    // While there are fewer than bufferSize output samples available, feed more
-    // input samples into the time rubberband
-    while (rubberband->available() < bufferSize) {
-    
-        // Deinterleave into the rubberband input buffers
-        int i, j;
-        for (i = 0, j = (playheadPos + i) * channels;
-                i < maxProcessSize && j < inputSamples.size();
-                i++, j += channels) {
-            stretchInBufL[i] = inputSamples[j];
-            stretchInBufR[i] = inputSamples[j + 1];
-        }
-        while (i < maxProcessSize) {
-            stretchInBufL[i] = 0;
-            stretchInBufR[i] = 0;
-            i++;
-        }
+    this->semitones = semitones;
+    updateRatios();
+}
 
+/**
+ * The medium tier is Rubber Band's defaults. The low tier adjusts phases
+ * independently in each frequency bin, which is cheaper but more phasey. The
+ * high tier smooths transients, preserves formants when shifting pitch, and
+ * resamples at higher quality.
+ */
+void TimeStretcher::setQuality(StretchQuality quality) {
+    if (quality == this->quality) {
+        return;
+    }
+    this->quality = quality;
+    bool high = quality == QUALITY_HIGH;
+    rubberband->setPhaseOption(quality == QUALITY_LOW
+            ? RubberBand::RubberBandStretcher::OptionPhaseIndependent
+            : RubberBand::RubberBandStretcher::OptionPhaseLaminar);
+    rubberband->setTransientsOption(high
+            ? RubberBand::RubberBandStretcher::OptionTransientsSmooth
+            : RubberBand::RubberBandStretcher::OptionTransientsCrisp);
+    rubberband->setFormantOption(high
+            ? RubberBand::RubberBandStretcher::OptionFormantPreserved
+            : RubberBand::RubberBandStretcher::OptionFormantShifted);
+    rubberband->setPitchOption(high
+            ? RubberBand::RubberBandStretcher::OptionPitchHighQuality
+            : RubberBand::RubberBandStretcher::OptionPitchHighSpeed);
+}
+
+void TimeStretcher::setBackend(StretchBackend backend) {
+    if (backend == this->backend) {
+        return;
+    }
+    this->backend = backend;
+    reset();
+}
+
+void TimeStretcher::setWaitForPages(bool wait) {
+    waitForPages = wait;
+}
+
+void TimeStretcher::setOutputRate(int rate) {
+    outputRate = std::max(rate, 1);
+    updateRatios();
+}
+
+/**
+ * Give the rubberband the time ratio and pitch scale for the user's speed and
+ * transposition at the output sample rate. Output played at a higher rate than
+ * the input must be made longer to last as long, and the stretching keeps the
+ * period of each tone in samples, so it must also be shifted down to sound at
+ * the same pitch. When the rates match, the rate ratio is exactly 1.
+ */
+void TimeStretcher::updateRatios() {
+    double rateRatio = outputRate / (double) inputRate;
+    double timeRatio = rateRatio / speed;
+    double pitchScale = std::pow(2.0, semitones / 12.0) / rateRatio;
+    rubberband->setTimeRatio(timeRatio);
+    rubberband->setPitchScale(pitchScale);
+    native->setTimeRatio(timeRatio);
+    native->setPitchScale(pitchScale);
+    native->setRateRatio(rateRatio);
+}
+
+/**
+ * Read the next block of the sound file and feed it into the stretching
+ * engine, deinterleaving it into the engine's input buffers. Frames past the
+ * end of the file are read as silence.
+ *
+ * @param frames the number of frames to feed, at most maxProcessSize
+ */
+void TimeStretcher::feed(int frames) {
+    soundFile->readFrames(playheadPos, frames, &inputFrames[0],
+            waitForPages);
+    switch (fileChannels) {
+        case 1:
+            deinterleave<1>(&inputFrames[0], &stretchInBuf[0], frames);
+            break;
+        case 2:
+            deinterleave<2>(&inputFrames[0], &stretchInBuf[0], frames);
+            break;
+        default:
+            downmixToStereo(&inputFrames[0], fileChannels, &stretchInBuf[0],
+                    frames);
+    }
+
+    if (backend == STRETCH_NATIVE) {
+        native->process(&(stretchInBuf[0]), frames);
+    } else {
+        rubberband->process(&(stretchInBuf[0]), frames, false);
+    }
+
+    playheadPos += frames;
+}
+
+bool TimeStretcher::lockMemory() {
+    bool ok = TuneTutor::lockMemory(inputFrames)
+        && TuneTutor::lockMemory(stretchInData)
+        && TuneTutor::lockMemory(stretchOutData)
+        && native->lockMemory();
+
+    // Rubber Band allocates everything up front, so a few blocks of silence
+    // touch all of it that playback will
+    std::fill(stretchInData.begin(), stretchInData.end(), 0.0f);
+    for (int i = 0; i < prefaultBlocks; i++) {
         rubberband->process(&(stretchInBuf[0]), maxProcessSize, false);
+        while (rubberband->available() > 0) {
+            rubberband->retrieve(&(stretchOutBuf[0]), maxProcessSize);
+        }
+    }
+    rubberband->reset();
+    return ok;
+}
 
-        playheadPos += maxProcessSize;
+void TimeStretcher::unlockMemory() {
+    TuneTutor::unlockMemory(inputFrames);
+    TuneTutor::unlockMemory(stretchInData);
+    TuneTutor::unlockMemory(stretchOutData);
+    native->unlockMemory();
+}
+
+/**
+ * Interleave frames from the stretcher output buffers into the audio output.
+ */
+void TimeStretcher::writeOutput(float *output, size_t frames,
+        int outputChannels) {
+    if (channels == 1 && outputChannels == 1) {
+        interleave<1, 1>(&stretchOutBuf[0], output, frames);
+    } else if (channels == 1 && outputChannels == 2) {
+        interleave<1, 2>(&stretchOutBuf[0], output, frames);
+    } else if (channels == 2 && outputChannels == 2) {
+        interleave<2, 2>(&stretchOutBuf[0], output, frames);
+    } else {
+        interleaveAny(&stretchOutBuf[0], channels, output, outputChannels,
+                frames);
     }
+}
 
-    size_t samplesRetrieved = rubberband->retrieve(&(stretchOutBuf[0]),
-            bufferSize);
+void TimeStretcher::getOutput(float *output, int bufferSize,
+        int outputChannels) {
+    // Let a paged sound file start decoding what comes next
+    soundFile->prefetch(playheadPos);
 
-    // Interleave output from rubberband into audio output
-    for (int i = 0; i < samplesRetrieved && i < bufferSize; i++) {
-        output[i * channels] = stretchOutBufL[i];
-        output[i * channels + 1] = stretchOutBufR[i];
+    // Retrieve at most maxProcessSize frames at a time, which is all the
+    // output buffers hold
+    int done = 0;
+    while (done < bufferSize) {
+        int want = std::min(bufferSize - done, maxProcessSize);
+
+        // While there are fewer output samples available than wanted, feed
+        // more input samples into the engine. The native engine only gets
+        // what it needs for its next hop, so that slowing a tune right down
+        // can't grow its output past the room reserved for it.
+        if (backend == STRETCH_NATIVE) {
+            while (native->available() < want) {
+                feed(std::min((int) native->getSamplesRequired(),
+                            maxProcessSize));
+            }
+        } else {
+            while (rubberband->available() < want) {
+                feed(maxProcessSize);
+            }
+        }
+
+        size_t retrieved = backend == STRETCH_NATIVE
+            ? native->retrieve(&(stretchOutBuf[0]), want)
+            : rubberband->retrieve(&(stretchOutBuf[0]), want);
+        if (retrieved == 0) {
+            break;
+        }
+        writeOutput(output + done * outputChannels, retrieved,
+                outputChannels);
+        done += retrieved;
     }
+    std::fill(output + done * outputChannels,
+            output + bufferSize * outputChannels, 0.0f);
 }
 
 TimeStretcher::~TimeStretcher() {
     if (rubberband != NULL) {
         delete rubberband;
     }
+    delete native;
 }
 
 }
@@ -16,15 +16,34 @@
 
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <iostream>
 
 #include <rubberband/RubberBandStretcher.h>
 
+#include "nativestretcher.h"
 #include "soundfile.h"
 
 namespace TuneTutor {
 
+/**
+ * Tiers of time stretching quality, from cheapest to most expensive.
+ */
+enum StretchQuality {
+    QUALITY_LOW,
+    QUALITY_MEDIUM,
+    QUALITY_HIGH
+};
+
+/**
+ * The engines that can do the time stretching.
+ */
+enum StretchBackend {
+    STRETCH_RUBBERBAND,
+    STRETCH_NATIVE
+};
+
 /**
  * The TimeStretcher class provides time stretching (i.e. slowing down the audio
  * independently of pitch) and pitch shifting functionality. It is a wrapper
@@ -32,18 +51,38 @@ namespace TuneTutor {
  * configures the parameters of the RubberBandStretcher, does the required
  * buffering and sample (de-)interleaving, feeds samples into the
  * RubberBandStretcher and retrieves the processed output, and provides a simple
- * interface used by the ofApp class.
+ * interface used by the ofApp class. A NativeStretcher can be used in place of
+ * the RubberBandStretcher on machines too slow for it.
+ *
+ * A mono file is stretched as one channel and copied to every output channel,
+ * so that it costs half as much as a stereo file. A file with more than two
+ * channels is mixed down to stereo before it is stretched.
+ *
+ * When the output device runs at a different sample rate than the sound file,
+ * the conversion is folded into the time ratio and pitch scale given to the
+ * RubberBandStretcher, so that there is no separate resampling pass.
  */
 class TimeStretcher {
 
     public:
 
-        /** @param soundFile Must already have a sound loaded via load() */
+        /**
+         * @param soundFile Must already have a sound loaded via load(), and
+         *        must outlive the TimeStretcher
+         */
         TimeStretcher(const SoundFile &soundFile);
         ~TimeStretcher();
 
         /** @param position the frame to seek to */
-        void seek(int position);
+        void seek(int64_t position);
+
+        /**
+         * Discard the audio buffered inside the RubberBandStretcher, so that
+         * the next output starts from the playhead position rather than from
+         * wherever the stretcher was before a seek. Must be called from the
+         * thread that calls getOutput().
+         */
+        void reset();
 
         /**
          * Get the current playhead position as the frame index into the input
@@ -52,7 +91,7 @@ class TimeStretcher {
          *
          * @return the current playhead position
          */
-        int getPosition() const;
+        int64_t getPosition() const;
 
         /**
          * Set the playback speed ratio. 1 is the original speed, 0.5 is half
@@ -65,36 +104,116 @@ class TimeStretcher {
         /** @param semitones number of semitones by which to transpose */
         void setPitch(double semitones);
 
+        /**
+         * Set the quality tier. The tiers differ only in options that the
+         * RubberBandStretcher can change while it runs, so switching is
+         * seamless. The tier is QUALITY_MEDIUM until this is called. Must be
+         * called from the thread that calls getOutput().
+         *
+         * @param quality the quality tier
+         */
+        void setQuality(StretchQuality quality);
+
+        /**
+         * Choose the engine that does the stretching. Switching discards the
+         * audio buffered in the engine being switched to. The backend is
+         * STRETCH_RUBBERBAND until this is called. Must be called from the
+         * thread that calls getOutput().
+         *
+         * @param backend the engine to use
+         */
+        void setBackend(StretchBackend backend);
+
+        /**
+         * Choose whether reading the sound file may wait for its pages to be
+         * decoded. It does until this is called; the stretcher that plays on
+         * the audio thread must not, and hears pages that aren't decoded yet
+         * as silence instead.
+         *
+         * @param wait false if the sound file must be read without waiting
+         */
+        void setWaitForPages(bool wait);
+
+        /**
+         * Set the sample rate of the output device. It is the sound file's
+         * sample rate until this is called.
+         *
+         * @param rate the output sample rate in Hz
+         */
+        void setOutputRate(int rate);
+
         /**
          * Get a block of output frames from the time stretcher and advance the
          * playhead position. The samples in each frame will be interleaved by
-         * channel. The number of channels is assumed to match the number of
-         * channels in the sound file.
+         * channel.
          *
          * @param output a pointer to the output buffer
          * @param bufferSize the number of frames in the output buffer
+         * @param outputChannels the number of channels in each output frame,
+         *        which needn't match the sound file
+         */
+        void getOutput(float *output, int bufferSize, int outputChannels);
+
+        /**
+         * Lock the buffers of the TimeStretcher and the NativeStretcher in
+         * RAM, with lockMemory() from realtime.h. The RubberBandStretcher's
+         * own buffers are out of reach, but it is run on silence so that
+         * they are at least faulted in. Must not be called while getOutput()
+         * may be running.
+         *
+         * @return true if every buffer was locked
          */
-        void getOutput(float *output, int bufferSize);
+        bool lockMemory();
+
+        /** Undo lockMemory() */
+        void unlockMemory();
 
     private:
         const int maxProcessSize = 512;
         const double minSpeedRatio = 0.01;
 
-        SoundFile soundFile;
+        // Blocks of silence run through the RubberBandStretcher to fault in
+        // its buffers
+        const int prefaultBlocks = 16;
+
+        // Channels in the sound file, and channels stretched: 1 for a mono
+        // file and 2 for any other
+        int fileChannels;
         int channels;
-        std::vector<float> inputSamples;
+
+        const SoundFile *soundFile;
         RubberBand::RubberBandStretcher *rubberband = NULL;
-        int playheadPos;
-        
-        // Input buffers for the RubberBandStretcher
+        NativeStretcher *native = NULL;
+        StretchBackend backend;
+        int64_t playheadPos;
+
+        // Sample rates of the sound file and the output device
+        int inputRate;
+        int outputRate;
+
+        // Playback speed ratio and transposition set by the user
+        double speed;
+        double semitones;
+
+        StretchQuality quality;
+
+        // Whether reading the sound file may wait for the decoder
+        bool waitForPages;
+
+        // Interleaved input frames read from the sound file
+        std::vector<float> inputFrames;
+
+        // Input buffers for the RubberBandStretcher, one per channel
         std::vector<float*> stretchInBuf;
-        std::vector<float> stretchInBufL;
-        std::vector<float> stretchInBufR;
+        std::vector<float> stretchInData;
 
-        // Output buffers for the RubberBandStretcher
+        // Output buffers for the RubberBandStretcher, one per channel
         std::vector<float*> stretchOutBuf;
-        std::vector<float> stretchOutBufL;
-        std::vector<float> stretchOutBufR;
+        std::vector<float> stretchOutData;
+
+        void updateRatios();
+        void feed(int frames);
+        void writeOutput(float *output, size_t frames, int outputChannels);
 };
 
 }
@@ -0,0 +1,358 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include "binaryio.h"
+#include "pitchdetector.h"
+#include "soundfile.h"
+#include "trackaligner.h"
+#include "util.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const char fileMagic[4] = {'T', 'T', 'W', 1};
+
+typedef std::vector<std::pair<uint32_t, uint32_t> > Path;
+
+/** Largest pitch difference counted, in semitones */
+const float maxDifference = 3;
+
+/**
+ * Carry the last detected pitch forward over places where no pitch was
+ * detected, and subtract the median pitch so that the track is independent of
+ * the key it was played in.
+ */
+std::vector<float> normalize(std::vector<float> pitches) {
+    std::vector<float> voiced;
+    for (float pitch : pitches) {
+        if (pitch > 0) {
+            voiced.push_back(pitch);
+        }
+    }
+    if (voiced.empty()) {
+        return std::vector<float>(pitches.size(), 0);
+    }
+    std::nth_element(voiced.begin(), voiced.begin() + voiced.size() / 2,
+            voiced.end());
+    float median = voiced[voiced.size() / 2];
+
+    float last = median;
+    for (float &pitch : pitches) {
+        if (pitch > 0) {
+            last = pitch;
+        }
+        pitch = last - median;
+    }
+    return pitches;
+}
+
+/** @return the track at half the resolution */
+std::vector<float> halve(const std::vector<float> &track) {
+    std::vector<float> half((track.size() + 1) / 2);
+    for (size_t i = 0; i < half.size(); i++) {
+        size_t next = std::min(2 * i + 1, track.size() - 1);
+        half[i] = (track[2 * i] + track[next]) / 2;
+    }
+    return half;
+}
+
+/**
+ * Find the cheapest path from the first to the last pitch values of both
+ * tracks, only visiting the columns lo[i] to hi[i] of each row i. The windows
+ * must start at column 0, end at the last column, never move left, and
+ * overlap or touch from one row to the next.
+ */
+Path alignInWindows(const std::vector<float> &a, const std::vector<float> &b,
+        const std::vector<size_t> &lo, const std::vector<size_t> &hi) {
+    const float inf = std::numeric_limits<float>::max() / 2;
+    enum Step { DIAGONAL, UP, LEFT };
+    size_t n = a.size();
+
+    // Steps taken to reach each cell, row by row
+    std::vector<size_t> rowStart(n + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        rowStart[i + 1] = rowStart[i] + hi[i] - lo[i] + 1;
+    }
+    std::vector<uint8_t> steps(rowStart[n]);
+
+    std::vector<float> prev;
+    std::vector<float> cur;
+    for (size_t i = 0; i < n; i++) {
+        cur.assign(hi[i] - lo[i] + 1, inf);
+        for (size_t j = lo[i]; j <= hi[i]; j++) {
+            float best = inf;
+            uint8_t step = DIAGONAL;
+            if (i == 0 && j == 0) {
+                best = 0;
+            }
+            if (i > 0 && j > lo[i - 1] && j - 1 <= hi[i - 1]
+                    && prev[j - 1 - lo[i - 1]] < best) {
+                best = prev[j - 1 - lo[i - 1]];
+                step = DIAGONAL;
+            }
+            if (i > 0 && j >= lo[i - 1] && j <= hi[i - 1]
+                    && prev[j - lo[i - 1]] < best) {
+                best = prev[j - lo[i - 1]];
+                step = UP;
+            }
+            if (j > lo[i] && cur[j - 1 - lo[i]] < best) {
+                best = cur[j - 1 - lo[i]];
+                step = LEFT;
+            }
+            cur[j - lo[i]] = best
+                + std::min(std::fabs(a[i] - b[j]), maxDifference);
+            steps[rowStart[i] + j - lo[i]] = step;
+        }
+        std::swap(prev, cur);
+    }
+
+    Path path;
+    size_t i = n - 1;
+    size_t j = b.size() - 1;
+    while (true) {
+        path.push_back(std::make_pair((uint32_t) i, (uint32_t) j));
+        if (i == 0 && j == 0) {
+            break;
+        }
+        uint8_t step = steps[rowStart[i] + j - lo[i]];
+        if (step != LEFT) {
+            i--;
+        }
+        if (step != UP) {
+            j--;
+        }
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+/**
+ * Align two tracks by aligning them at half the resolution, if they are long,
+ * and then searching a band around that path at full resolution.
+ */
+Path align(const std::vector<float> &a, const std::vector<float> &b,
+        size_t coarsestLength, int radius, const std::atomic<bool> &stopping) {
+    size_t n = a.size();
+    size_t m = b.size();
+    std::vector<size_t> lo(n, 0);
+    std::vector<size_t> hi(n, m - 1);
+
+    if (std::max(n, m) > coarsestLength && std::min(n, m) >= 2) {
+        Path coarse = align(halve(a), halve(b), coarsestLength, radius,
+                stopping);
+        if (stopping) {
+            return Path();
+        }
+
+        // Project the coarse path onto this level and widen it
+        lo.assign(n, m - 1);
+        hi.assign(n, 0);
+        for (const std::pair<uint32_t, uint32_t> &cell : coarse) {
+            for (size_t i = 2 * cell.first;
+                    i <= 2 * cell.first + 1 && i < n; i++) {
+                lo[i] = std::min(lo[i], (size_t) 2 * cell.second);
+                hi[i] = std::max(hi[i],
+                        std::min((size_t) 2 * cell.second + 1, m - 1));
+            }
+        }
+        for (size_t i = 0; i < n; i++) {
+            lo[i] = lo[i] > (size_t) radius ? lo[i] - radius : 0;
+            hi[i] = std::min(hi[i] + radius, m - 1);
+        }
+
+        // Make sure the windows never move left
+        for (size_t i = n - 1; i > 0; i--) {
+            lo[i - 1] = std::min(lo[i - 1], lo[i]);
+        }
+        for (size_t i = 1; i < n; i++) {
+            hi[i] = std::max(hi[i], hi[i - 1]);
+        }
+        lo[0] = 0;
+        hi[n - 1] = m - 1;
+    }
+    return alignInWindows(a, b, lo, hi);
+}
+
+}
+
+WarpMap::WarpMap() {
+}
+
+bool WarpMap::isEmpty() const {
+    return from.empty();
+}
+
+void WarpMap::setPath(
+        const std::vector<std::pair<uint32_t, uint32_t> > &path) {
+    from.clear();
+    to.clear();
+    for (const std::pair<uint32_t, uint32_t> &point : path) {
+        from.push_back(point.first);
+        to.push_back(point.second);
+    }
+}
+
+double WarpMap::map(double position) const {
+    if (from.empty()) {
+        return position;
+    }
+
+    // Several points of the path may share a position in the first
+    // recording; use the middle of the positions they map to
+    std::vector<uint32_t>::const_iterator next =
+        std::upper_bound(from.begin(), from.end(), position);
+    if (next == from.begin()) {
+        return to.front() - (from.front() - position);
+    }
+    if (next == from.end()) {
+        return to.back() + (position - from.back());
+    }
+    std::vector<uint32_t>::const_iterator first =
+        std::lower_bound(from.begin(), next, *(next - 1));
+    std::vector<uint32_t>::const_iterator nextEnd =
+        std::upper_bound(next, from.end(), *next);
+    double x0 = *first;
+    double y0 = (to[first - from.begin()] + to[next - 1 - from.begin()]) / 2.0;
+    double x1 = *next;
+    double y1 = (to[next - from.begin()] + to[nextEnd - 1 - from.begin()])
+        / 2.0;
+    return y0 + (position - x0) * (y1 - y0) / (x1 - x0);
+}
+
+WarpMap WarpMap::inverted() const {
+    WarpMap inverse;
+    inverse.from = to;
+    inverse.to = from;
+    return inverse;
+}
+
+bool WarpMap::load(std::string path) {
+    std::vector<char> data;
+    if (!readFile(path, data) || data.size() < sizeof(fileMagic)
+            || memcmp(&data[0], fileMagic, sizeof(fileMagic)) != 0) {
+        return false;
+    }
+    BinaryReader r(&data[sizeof(fileMagic)], data.size() - sizeof(fileMagic));
+    uint32_t count;
+    if (!r.get(count)) {
+        return false;
+    }
+    std::vector<uint32_t> newFrom(count);
+    std::vector<uint32_t> newTo(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!r.get(newFrom[i]) || !r.get(newTo[i])) {
+            std::cout << "WarpMap: " << path << " is truncated" << std::endl;
+            return false;
+        }
+    }
+    std::swap(from, newFrom);
+    std::swap(to, newTo);
+    return true;
+}
+
+bool WarpMap::save(std::string path) const {
+    std::vector<char> buf(fileMagic, fileMagic + sizeof(fileMagic));
+    put<uint32_t>(buf, from.size());
+    for (size_t i = 0; i < from.size(); i++) {
+        put(buf, from[i]);
+        put(buf, to[i]);
+    }
+    if (!replaceFile(path, buf)) {
+        std::cout << "WarpMap: error writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+TrackAligner::TrackAligner() {
+    running = false;
+    stopping = false;
+}
+
+void TrackAligner::start(const std::vector<float> &pitches,
+        std::string otherPath, std::string settingsRoot) {
+    if (running || thread.joinable()) {
+        return;
+    }
+    this->pitches = pitches;
+    this->otherPath = otherPath;
+    this->settingsRoot = settingsRoot;
+    otherHash = "";
+    result = WarpMap();
+    running = true;
+    thread = std::thread(&TrackAligner::run, this);
+}
+
+bool TrackAligner::isRunning() const {
+    return running;
+}
+
+std::string TrackAligner::finish(WarpMap &map) {
+    if (thread.joinable()) {
+        thread.join();
+    }
+    map = result;
+    return otherHash;
+}
+
+void TrackAligner::run() {
+    std::string hash = getContentHash(otherPath);
+    SoundFile soundFile;
+    if (hash == "" || pitches.empty() || !soundFile.load(otherPath)) {
+        std::cout << "TrackAligner: error loading " << otherPath << std::endl;
+        running = false;
+        return;
+    }
+
+    // The other recording's pitches are cached just as if it had been opened
+    PitchDetector pitchDetector(soundFile);
+    std::string settingsPath = settingsRoot + "/" + hash;
+    if (!pitchDetector.load(settingsPath + "/pitches.dat")) {
+        pitchDetector.detectPitches();
+        if (createDirectories(settingsPath)) {
+            pitchDetector.save(settingsPath + "/pitches.dat");
+        }
+    }
+    if (pitchDetector.getPitches().empty()) {
+        running = false;
+        return;
+    }
+
+    Path path = align(normalize(pitches),
+            normalize(pitchDetector.getPitches()), coarsestLength, radius,
+            stopping);
+    if (!path.empty()) {
+        result.setPath(path);
+        otherHash = hash;
+    }
+    running = false;
+}
+
+TrackAligner::~TrackAligner() {
+    stopping = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+}
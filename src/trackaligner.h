@@ -0,0 +1,138 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * The WarpMap class maps positions in one recording of a tune to the
+ * musically matching positions in another. It is a monotonic path through
+ * pairs of pitch value indices, one from each recording, and positions
+ * between the points of the path are interpolated.
+ */
+class WarpMap {
+
+    public:
+        WarpMap();
+
+        /** @return true if there is no path */
+        bool isEmpty() const;
+
+        /**
+         * @param path pairs of pitch value indices in the first and second
+         *        recording; neither index may decrease along the path
+         */
+        void setPath(const std::vector<std::pair<uint32_t, uint32_t> > &path);
+
+        /**
+         * @param position a position in the first recording, in pitch values
+         * @return the matching position in the second recording
+         */
+        double map(double position) const;
+
+        /** @return a map from the second recording to the first */
+        WarpMap inverted() const;
+
+        /**
+         * @param path the full path to the file written by save()
+         * @return true if the file was loaded
+         */
+        bool load(std::string path);
+
+        /**
+         * @param path the full path to the file to write
+         * @return true if the file was written
+         */
+        bool save(std::string path) const;
+
+    private:
+        std::vector<uint32_t> from;
+        std::vector<uint32_t> to;
+};
+
+/**
+ * The TrackAligner class aligns the pitch track of the current recording of a
+ * tune with that of another recording, in the background. The other recording
+ * is decoded and its pitches detected (or loaded from its pitch cache) on the
+ * same background thread.
+ *
+ * Each track has its median pitch subtracted, so recordings in different keys
+ * can be aligned, and the two are aligned with dynamic time warping over a
+ * pyramid of halved resolutions: the full cost matrix is computed only at the
+ * coarsest level, and each finer level only searches a narrow band around the
+ * path found at the level above. Time and memory are therefore proportional to
+ * the length of the recordings rather than to its square.
+ */
+class TrackAligner {
+
+    public:
+        TrackAligner();
+        ~TrackAligner();
+
+        /**
+         * Start aligning in the background. Does nothing if an alignment is
+         * already running.
+         *
+         * @param pitches the pitch track of the current recording; it is
+         *        copied
+         * @param otherPath the full path to the other recording
+         * @param settingsRoot the directory containing each tune's settings
+         *        directory, where the other recording's pitches are cached
+         */
+        void start(const std::vector<float> &pitches, std::string otherPath,
+                std::string settingsRoot);
+
+        /** @return true if an alignment has been started and not finished */
+        bool isRunning() const;
+
+        /**
+         * Wait for the alignment to finish, and get the result. Call this once
+         * for each alignment, after isRunning() returns false.
+         *
+         * @param map receives the map from the current recording to the other
+         * @return the content hash of the other recording, or an empty string
+         *         if it couldn't be loaded
+         */
+        std::string finish(WarpMap &map);
+
+    private:
+        /** Length at or below which the full cost matrix is computed */
+        const size_t coarsestLength = 256;
+
+        /** Extra pitch values searched on each side of the projected path */
+        const int radius = 8;
+
+        std::thread thread;
+        std::atomic<bool> running;
+        std::atomic<bool> stopping;
+
+        std::vector<float> pitches;
+        std::string otherPath;
+        std::string settingsRoot;
+        std::string otherHash;
+        WarpMap result;
+
+        void run();
+};
+
+}
@@ -0,0 +1,360 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "binaryio.h"
+#include "tunestate.h"
+
+namespace TuneTutor {
+
+namespace {
+
+const char fileMagic[4] = {'T', 'T', 'S', 1};
+
+// Rewrite the file when it has this many times more records than values
+const int compactionRatio = 4;
+
+enum RecordType {
+    RECORD_NUMBER = 1,
+    RECORD_TEXT,
+    RECORD_MARK,
+    RECORD_DELETE_NUMBER,
+    RECORD_DELETE_TEXT,
+    RECORD_DELETE_MARK,
+    RECORD_MARK64,
+    RECORD_DELETE_MARK64
+};
+
+/*
+ * Each record is a one-byte type and a four-byte payload length, followed by
+ * the payload. Mark positions that fit in 32 bits are written as RECORD_MARK
+ * and RECORD_DELETE_MARK, which older versions can read; only positions
+ * beyond that, more than about 13 hours into a recording, need the 64-bit
+ * record types.
+ */
+
+/** Start a record, returning the offset of its length field */
+size_t beginRecord(std::vector<char> &buf, RecordType type) {
+    buf.push_back((char) type);
+    size_t lengthPos = buf.size();
+    put<uint32_t>(buf, 0);
+    return lengthPos;
+}
+
+void endRecord(std::vector<char> &buf, size_t lengthPos) {
+    uint32_t length = buf.size() - lengthPos - sizeof(uint32_t);
+    memcpy(&buf[lengthPos], &length, sizeof(length));
+}
+
+/**
+ * Apply one record to the state.
+ * @return false if the record is malformed
+ */
+bool applyRecord(int type, BinaryReader &r, TuneState &state) {
+    std::string key, text;
+    double number;
+    int32_t position;
+    int64_t position64;
+    switch (type) {
+        case RECORD_NUMBER:
+            if (!r.getString(key) || !r.get(number)) {
+                return false;
+            }
+            state.numbers[key] = number;
+            return true;
+        case RECORD_TEXT:
+            if (!r.getString(key) || !r.getString(text)) {
+                return false;
+            }
+            state.texts[key] = text;
+            return true;
+        case RECORD_MARK:
+            if (!r.get(position) || !r.getString(text)) {
+                return false;
+            }
+            state.marks[position] = text;
+            return true;
+        case RECORD_DELETE_NUMBER:
+            if (!r.getString(key)) {
+                return false;
+            }
+            state.numbers.erase(key);
+            return true;
+        case RECORD_DELETE_TEXT:
+            if (!r.getString(key)) {
+                return false;
+            }
+            state.texts.erase(key);
+            return true;
+        case RECORD_DELETE_MARK:
+            if (!r.get(position)) {
+                return false;
+            }
+            state.marks.erase(position);
+            return true;
+        case RECORD_MARK64:
+            if (!r.get(position64) || !r.getString(text)) {
+                return false;
+            }
+            state.marks[position64] = text;
+            return true;
+        case RECORD_DELETE_MARK64:
+            if (!r.get(position64)) {
+                return false;
+            }
+            state.marks.erase(position64);
+            return true;
+        default:
+            // Unknown record types are skipped, so that older versions can
+            // read files written by newer ones
+            return true;
+    }
+}
+
+void putNumber(std::vector<char> &buf, const std::string &key, double value) {
+    size_t lengthPos = beginRecord(buf, RECORD_NUMBER);
+    putString(buf, key);
+    put<double>(buf, value);
+    endRecord(buf, lengthPos);
+}
+
+void putText(std::vector<char> &buf, const std::string &key,
+        const std::string &value) {
+    size_t lengthPos = beginRecord(buf, RECORD_TEXT);
+    putString(buf, key);
+    putString(buf, value);
+    endRecord(buf, lengthPos);
+}
+
+/** @return true if a mark position can be written as a 32-bit record */
+bool fitsInt32(int64_t position) {
+    return position >= INT32_MIN && position <= INT32_MAX;
+}
+
+void putMark(std::vector<char> &buf, int64_t position,
+        const std::string &label) {
+    size_t lengthPos;
+    if (fitsInt32(position)) {
+        lengthPos = beginRecord(buf, RECORD_MARK);
+        put<int32_t>(buf, position);
+    } else {
+        lengthPos = beginRecord(buf, RECORD_MARK64);
+        put<int64_t>(buf, position);
+    }
+    putString(buf, label);
+    endRecord(buf, lengthPos);
+}
+
+void putDelete(std::vector<char> &buf, RecordType type,
+        const std::string &key) {
+    size_t lengthPos = beginRecord(buf, type);
+    putString(buf, key);
+    endRecord(buf, lengthPos);
+}
+
+void putDeleteMark(std::vector<char> &buf, int64_t position) {
+    size_t lengthPos;
+    if (fitsInt32(position)) {
+        lengthPos = beginRecord(buf, RECORD_DELETE_MARK);
+        put<int32_t>(buf, position);
+    } else {
+        lengthPos = beginRecord(buf, RECORD_DELETE_MARK64);
+        put<int64_t>(buf, position);
+    }
+    endRecord(buf, lengthPos);
+}
+
+/**
+ * Walk two sorted maps in step, calling changed(key, value) for each entry of
+ * current that is missing from or different in stored, and removed(key) for
+ * each entry of stored that is missing from current.
+ */
+template <typename Map, typename Changed, typename Removed>
+void diffMaps(const Map &stored, const Map &current, Changed changed,
+        Removed removed) {
+    typename Map::const_iterator s = stored.begin();
+    typename Map::const_iterator c = current.begin();
+    while (s != stored.end() || c != current.end()) {
+        if (c == current.end() || (s != stored.end() && s->first < c->first)) {
+            removed(s->first);
+            ++s;
+        } else if (s == stored.end() || c->first < s->first) {
+            changed(c->first, c->second);
+            ++c;
+        } else {
+            if (!(s->second == c->second)) {
+                changed(c->first, c->second);
+            }
+            ++s;
+            ++c;
+        }
+    }
+}
+
+}
+
+TuneStateStore::TuneStateStore() {
+    path = "";
+    recordCount = 0;
+    failing = false;
+}
+
+bool TuneStateStore::load(std::string path, TuneState &state) {
+    this->path = path;
+    stored = TuneState();
+    recordCount = 0;
+    failing = false;
+
+    std::vector<char> data;
+    if (!readFile(path, data)) {
+        return false;
+    }
+
+    if (data.size() < sizeof(fileMagic)
+            || memcmp(&data[0], fileMagic, sizeof(fileMagic)) != 0) {
+        std::cout << "TuneStateStore: " << path << " is not a state file"
+            << std::endl;
+        return false;
+    }
+
+    size_t pos = sizeof(fileMagic);
+    while (pos < data.size()) {
+        uint32_t length;
+        if (data.size() - pos < 1 + sizeof(length)) {
+            break;
+        }
+        int type = data[pos];
+        memcpy(&length, &data[pos + 1], sizeof(length));
+        pos += 1 + sizeof(length);
+        if (data.size() - pos < length) {
+            break;
+        }
+        BinaryReader r(&data[pos], length);
+        if (!applyRecord(type, r, stored)) {
+            break;
+        }
+        pos += length;
+        recordCount++;
+    }
+    if (pos < data.size()) {
+        std::cout << "TuneStateStore: ignoring truncated record at offset "
+            << pos << " of " << path << std::endl;
+
+        // Records appended after the bad one would never be read, so have the
+        // next save rewrite the file instead
+        recordCount = 0;
+    }
+
+    state = stored;
+    return true;
+}
+
+void TuneStateStore::appendChanges(const TuneState &state,
+        std::vector<char> &buf, int &count) const {
+    diffMaps(stored.numbers, state.numbers,
+            [&](const std::string &key, double value) {
+                putNumber(buf, key, value);
+                count++;
+            },
+            [&](const std::string &key) {
+                putDelete(buf, RECORD_DELETE_NUMBER, key);
+                count++;
+            });
+    diffMaps(stored.texts, state.texts,
+            [&](const std::string &key, const std::string &value) {
+                putText(buf, key, value);
+                count++;
+            },
+            [&](const std::string &key) {
+                putDelete(buf, RECORD_DELETE_TEXT, key);
+                count++;
+            });
+    diffMaps(stored.marks, state.marks,
+            [&](int64_t position, const std::string &label) {
+                putMark(buf, position, label);
+                count++;
+            },
+            [&](int64_t position) {
+                putDeleteMark(buf, position);
+                count++;
+            });
+}
+
+bool TuneStateStore::save(const TuneState &state) {
+    if (path == "") {
+        return false;
+    }
+
+    int valueCount = state.numbers.size() + state.texts.size()
+        + state.marks.size();
+    std::vector<char> buf;
+    int count = 0;
+    appendChanges(state, buf, count);
+    if (count == 0) {
+        return true;
+    }
+    if (recordCount == 0
+            || recordCount + count > compactionRatio * (valueCount + 16)) {
+        return rewrite(state);
+    }
+
+    // A failed append may have left a torn record, after which load() would
+    // ignore everything, so the next save rewrites the file instead
+    if (!writeFile(path, buf, "ab")) {
+        if (!failing) {
+            std::cout << "TuneStateStore: error appending to " << path
+                << std::endl;
+        }
+        failing = true;
+        recordCount = 0;
+        return false;
+    }
+    stored = state;
+    recordCount += count;
+    failing = false;
+    return true;
+}
+
+/**
+ * Write the whole state to a new file and rename it over the old one, so that
+ * the old file is left intact if writing fails partway.
+ */
+bool TuneStateStore::rewrite(const TuneState &state) {
+    std::vector<char> buf(fileMagic, fileMagic + sizeof(fileMagic));
+    int count = 0;
+    TuneState empty;
+    std::swap(stored, empty);
+    appendChanges(state, buf, count);
+    std::swap(stored, empty);
+
+    if (!replaceFile(path, buf)) {
+        if (!failing) {
+            std::cout << "TuneStateStore: error writing " << path
+                << std::endl;
+        }
+        failing = true;
+        return false;
+    }
+    stored = state;
+    recordCount = count;
+    failing = false;
+    return true;
+}
+
+}
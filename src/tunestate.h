@@ -0,0 +1,96 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace TuneTutor {
+
+/**
+ * The saved state of a tune: GUI parameters and selection as named numbers,
+ * metadata fields as named text, and marks as labels keyed by position in
+ * sample frames.
+ */
+struct TuneState {
+    std::map<std::string, double> numbers;
+    std::map<std::string, std::string> texts;
+    std::map<int64_t, std::string> marks;
+};
+
+/**
+ * The TuneStateStore class keeps a TuneState in a single compact binary file.
+ * The file is an append-only log of records, each of which sets or deletes one
+ * value, so loading it is a single pass that replays the records in order.
+ * Saving compares the state to what was last loaded or saved and appends only
+ * the records that changed. When the log has grown to several times the size
+ * of the state it holds, it is rewritten (to a temporary file which is then
+ * renamed over the original) with one record per value.
+ *
+ * A record truncated by an interrupted write is ignored when loading, along
+ * with anything after it, and the next save rewrites the file without it. A
+ * save whose append fails rewrites the file the next time for the same
+ * reason.
+ */
+class TuneStateStore {
+
+    public:
+        TuneStateStore();
+
+        /**
+         * Load the state stored in the given file, and use that file for
+         * subsequent saves. If the file doesn't exist, the state is left
+         * unchanged and the next save writes it in full.
+         *
+         * @param path the full path to the state file
+         * @param state receives the loaded state
+         * @return true if the file existed and was loaded
+         */
+        bool load(std::string path, TuneState &state);
+
+        /**
+         * Write the changes between the given state and the stored state.
+         *
+         * @param state the current state
+         * @return true if the changes were written successfully
+         */
+        bool save(const TuneState &state);
+
+    private:
+        std::string path;
+        TuneState stored;
+
+        /**
+         * Number of records in the file, or 0 if the next save must rewrite
+         * it
+         */
+        int recordCount;
+
+        /**
+         * True after a save has failed, so that an error that persists, such
+         * as a full disk, is reported once rather than on every save
+         */
+        bool failing;
+
+        void appendChanges(const TuneState &state, std::vector<char> &buf,
+                int &count) const;
+        bool rewrite(const TuneState &state);
+};
+
+}
@@ -19,7 +19,11 @@
 #include <string>
 
 extern "C" {
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <pwd.h>
 }
@@ -35,3 +39,106 @@ std::string getHomeDirectory() {
     return std::string(homedir);
 }
 
+
+std::vector<FileInfo> listFiles(std::string directory) {
+    std::vector<FileInfo> files;
+    std::vector<std::string> dirs(1, directory);
+    while (!dirs.empty()) {
+        std::string dirPath = dirs.back();
+        dirs.pop_back();
+        DIR *dir = opendir(dirPath.c_str());
+        if (dir == NULL) {
+            continue;
+        }
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.') {
+                continue;
+            }
+            std::string path = dirPath + "/" + ent->d_name;
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                dirs.push_back(path);
+            } else if (S_ISREG(st.st_mode)) {
+                FileInfo info;
+                info.path = path;
+                info.modified = st.st_mtime;
+                info.size = st.st_size;
+                files.push_back(info);
+            }
+        }
+        closedir(dir);
+    }
+    return files;
+}
+
+bool getFileInfo(std::string path, FileInfo &info) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    info.path = path;
+    info.modified = st.st_mtime;
+    info.size = st.st_size;
+    return true;
+}
+
+bool createDirectories(std::string path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        return S_ISDIR(st.st_mode);
+    }
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        createDirectories(path.substr(0, slash));
+    }
+    // Another thread may have created it in the meantime
+    return mkdir(path.c_str(), 0755) == 0 || stat(path.c_str(), &st) == 0;
+}
+
+MappedFile::MappedFile() {
+    data = NULL;
+    size = 0;
+}
+
+bool MappedFile::open(std::string path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // The mapping keeps the file open by itself
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    if (data != NULL) {
+        munmap(data, size);
+    }
+    data = mapped;
+    size = st.st_size;
+    return true;
+}
+
+const char *MappedFile::getData() const {
+    return (const char *) data;
+}
+
+size_t MappedFile::getSize() const {
+    return size;
+}
+
+MappedFile::~MappedFile() {
+    if (data != NULL) {
+        munmap(data, size);
+    }
+}
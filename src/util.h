@@ -20,9 +20,77 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 /**
  * @return the current user's home directory
  */
 std::string getHomeDirectory();
+
+/**
+ * A file found by listFiles()
+ */
+struct FileInfo {
+    std::string path;
+    int64_t modified;
+    int64_t size;
+};
+
+/**
+ * List the regular files under a directory and its subdirectories, skipping
+ * hidden files and directories and not following symbolic links.
+ *
+ * @param directory the directory to list
+ * @return the files found, in no particular order
+ */
+std::vector<FileInfo> listFiles(std::string directory);
+
+/**
+ * Get the modification time and size of a file.
+ *
+ * @param path the path to the file
+ * @param info receives the path, modification time and size
+ * @return false if the file doesn't exist or can't be read
+ */
+bool getFileInfo(std::string path, FileInfo &info);
+
+/**
+ * Create a directory and any missing parent directories.
+ *
+ * @param path the directory to create
+ * @return true if the directory exists afterward
+ */
+bool createDirectories(std::string path);
+
+/**
+ * A file mapped read-only into memory, so that its contents are paged in by
+ * the operating system as they are used rather than read up front. The
+ * mapping lasts until the object is destroyed.
+ */
+class MappedFile {
+
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        /**
+         * @param path the file to map
+         * @return true if the file was mapped
+         */
+        bool open(std::string path);
+
+        /** @return the start of the file's contents, or NULL if not mapped */
+        const char *getData() const;
+
+        /** @return the size of the file in bytes */
+        size_t getSize() const;
+
+    private:
+        void *data;
+        size_t size;
+
+        MappedFile(const MappedFile &other);
+        MappedFile &operator=(const MappedFile &other);
+};
@@ -0,0 +1,257 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "wavdecoder.h"
+
+namespace TuneTutor {
+
+namespace {
+
+// Format tags of the fmt chunk
+const int formatPcm = 1;
+const int formatFloat = 3;
+const int formatExtensible = 0xFFFE;
+
+uint16_t getLE16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+uint32_t getLE32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+/**
+ * @return true if this machine stores numbers least significant byte first,
+ *         as WAVE files do, so that their samples can be used in place
+ */
+bool isLittleEndian() {
+    uint16_t one = 1;
+    return *(unsigned char *) &one == 1;
+}
+
+}
+
+WavDecoder::WavDecoder() {
+    sampleRate = 0;
+    channels = 0;
+    length = 0;
+    encoding = WAV_PCM16;
+    samples = NULL;
+    bytesPerFrame = 0;
+    bytesPerSample = 0;
+    readPosition = 0;
+}
+
+bool WavDecoder::open(std::string path) {
+    if (!file.open(path)) {
+        std::cout << "WavDecoder: can't open " << path << std::endl;
+        return false;
+    }
+    const unsigned char *data = (const unsigned char *) file.getData();
+    size_t size = file.getSize();
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0
+            || memcmp(data + 8, "WAVE", 4) != 0) {
+        std::cout << "WavDecoder: " << path << " is not a WAVE file"
+            << std::endl;
+        return false;
+    }
+
+    // Walk the chunks, each of which is padded to an even size
+    bool haveFormat = false;
+    size_t pos = 12;
+    while (pos + 8 <= size) {
+        const unsigned char *chunk = data + pos + 8;
+        size_t chunkSize = std::min((size_t) getLE32(data + pos + 4),
+                size - pos - 8);
+        if (memcmp(data + pos, "fmt ", 4) == 0) {
+            haveFormat = readFormat(chunk, chunkSize);
+            if (!haveFormat) {
+                std::cout << "WavDecoder: " << path
+                    << " has an unsupported sample format" << std::endl;
+                return false;
+            }
+        } else if (memcmp(data + pos, "data", 4) == 0 && haveFormat) {
+            // A file still being written may claim more data than it has
+            samples = chunk;
+            length = chunkSize / bytesPerFrame;
+        } else if (memcmp(data + pos, "LIST", 4) == 0 && chunkSize >= 4
+                && memcmp(chunk, "INFO", 4) == 0) {
+            readInfo(chunk + 4, chunkSize - 4);
+        }
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+    return samples != NULL;
+}
+
+/**
+ * Read the fmt chunk, which gives the encoding of the samples.
+ * @return false if the encoding is not supported
+ */
+bool WavDecoder::readFormat(const unsigned char *chunk, size_t size) {
+    if (size < 16) {
+        return false;
+    }
+    int tag = getLE16(chunk);
+    channels = getLE16(chunk + 2);
+    sampleRate = getLE32(chunk + 4);
+    bytesPerFrame = getLE16(chunk + 12);
+    int bits = getLE16(chunk + 14);
+    bytesPerSample = (bits + 7) / 8;
+    if (tag == formatExtensible && size >= 26) {
+        // The first two bytes of the subformat GUID are the format tag
+        tag = getLE16(chunk + 24);
+    }
+    if (channels <= 0 || bytesPerFrame == 0
+            || bytesPerFrame < channels * bytesPerSample) {
+        return false;
+    }
+
+    if (tag == formatPcm && bits == 8) {
+        encoding = WAV_PCM8;
+    } else if (tag == formatPcm && bits == 16) {
+        encoding = WAV_PCM16;
+    } else if (tag == formatPcm && bits == 24) {
+        encoding = WAV_PCM24;
+    } else if (tag == formatPcm && bits == 32) {
+        encoding = WAV_PCM32;
+    } else if (tag == formatFloat && bits == 32) {
+        encoding = WAV_FLOAT32;
+    } else if (tag == formatFloat && bits == 64) {
+        encoding = WAV_FLOAT64;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read the title, artist and album from the subchunks of a LIST INFO chunk.
+ */
+void WavDecoder::readInfo(const unsigned char *chunk, size_t size) {
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+        const char *text = (const char *) chunk + pos + 8;
+        size_t textSize = std::min((size_t) getLE32(chunk + pos + 4),
+                size - pos - 8);
+
+        // The text is usually null-terminated, but needn't be
+        std::string value(text, strnlen(text, textSize));
+        if (memcmp(chunk + pos, "INAM", 4) == 0) {
+            metadata.title = value;
+        } else if (memcmp(chunk + pos, "IART", 4) == 0) {
+            metadata.artist = value;
+        } else if (memcmp(chunk + pos, "IPRD", 4) == 0) {
+            metadata.album = value;
+        }
+        pos += 8 + textSize + (textSize & 1);
+    }
+}
+
+int WavDecoder::getSampleRate() const {
+    return sampleRate;
+}
+
+int WavDecoder::getChannels() const {
+    return channels;
+}
+
+int64_t WavDecoder::getLength() const {
+    return length;
+}
+
+SoundFileMetadata WavDecoder::getMetadata() const {
+    return metadata;
+}
+
+bool WavDecoder::getMappedSamples(const void *&data, SampleFormat &format) {
+    // The samples must be packed, and aligned for the CPU to load them
+    if (!isLittleEndian() || samples == NULL) {
+        return false;
+    }
+    if (encoding == WAV_PCM16 && bytesPerFrame == channels * sizeof(int16_t)
+            && (uintptr_t) samples % sizeof(int16_t) == 0) {
+        format = SAMPLE_INT16;
+    } else if (encoding == WAV_FLOAT32
+            && bytesPerFrame == channels * sizeof(float)
+            && (uintptr_t) samples % sizeof(float) == 0) {
+        format = SAMPLE_FLOAT32;
+    } else {
+        return false;
+    }
+    data = samples;
+    return true;
+}
+
+bool WavDecoder::seek(int64_t frame) {
+    if (frame < 0 || frame > length) {
+        return false;
+    }
+    readPosition = frame;
+    return true;
+}
+
+size_t WavDecoder::read(float *out, size_t frames) {
+    frames = std::min((int64_t) frames, length - readPosition);
+    const unsigned char *p = samples + readPosition * bytesPerFrame;
+    size_t padding = bytesPerFrame - channels * bytesPerSample;
+    float *end = out + frames * channels;
+    while (out < end) {
+        for (int c = 0; c < channels; c++) {
+            switch (encoding) {
+                case WAV_PCM8:
+                    // 8-bit samples are unsigned
+                    *out++ = (p[0] - 128) * (1.0f / 128);
+                    break;
+                case WAV_PCM16:
+                    *out++ = (int16_t) getLE16(p) * (1.0f / 32768);
+                    break;
+                case WAV_PCM24:
+                    *out++ = (int32_t) ((uint32_t) p[0] << 8
+                            | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24)
+                        * (1.0f / 2147483648.0f);
+                    break;
+                case WAV_PCM32:
+                    *out++ = (int32_t) getLE32(p) * (1.0f / 2147483648.0f);
+                    break;
+                case WAV_FLOAT32: {
+                    uint32_t bits = getLE32(p);
+                    float value;
+                    memcpy(&value, &bits, sizeof(value));
+                    *out++ = value;
+                    break;
+                }
+                case WAV_FLOAT64: {
+                    uint64_t bits = getLE32(p)
+                        | (uint64_t) getLE32(p + 4) << 32;
+                    double value;
+                    memcpy(&value, &bits, sizeof(value));
+                    *out++ = (float) value;
+                    break;
+                }
+            }
+            p += bytesPerSample;
+        }
+        p += padding;
+    }
+    readPosition += frames;
+    return frames;
+}
+
+}
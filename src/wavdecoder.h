@@ -0,0 +1,80 @@
+/* Copyright 2015 Benjamin R. Saylor <brsaylor@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "audiodecoder.h"
+#include "util.h"
+
+namespace TuneTutor {
+
+/**
+ * The WavDecoder class reads RIFF WAVE files, with integer samples of 8 to 32
+ * bits or floating-point samples. The file is mapped into memory rather than
+ * read, so 16-bit and 32-bit float files, the most common, can be used in
+ * place without any decoding or copying; the operating system pages them in
+ * as they are played.
+ */
+class WavDecoder : public AudioDecoder {
+
+    public:
+        WavDecoder();
+
+        bool open(std::string path);
+        int getSampleRate() const;
+        int getChannels() const;
+        int64_t getLength() const;
+        SoundFileMetadata getMetadata() const;
+        bool getMappedSamples(const void *&data, SampleFormat &format);
+
+    protected:
+        bool seek(int64_t frame);
+        size_t read(float *out, size_t frames);
+
+    private:
+        /** The sample encodings that can be read */
+        enum Encoding {
+            WAV_PCM8,
+            WAV_PCM16,
+            WAV_PCM24,
+            WAV_PCM32,
+            WAV_FLOAT32,
+            WAV_FLOAT64
+        };
+
+        MappedFile file;
+        int sampleRate;
+        int channels;
+        int64_t length;
+        SoundFileMetadata metadata;
+        Encoding encoding;
+
+        // The first byte of the sample data, and the sizes of one frame and
+        // of one sample within it
+        const unsigned char *samples;
+        size_t bytesPerFrame;
+        size_t bytesPerSample;
+
+        // The frame the next read will start at
+        int64_t readPosition;
+
+        bool readFormat(const unsigned char *chunk, size_t size);
+        void readInfo(const unsigned char *chunk, size_t size);
+};
+
+}